@@ -0,0 +1,304 @@
+/*
+** batch.c
+**
+** Batch mode (--batch). Every line of a manifest file holds the options for one output file,
+** exactly as they would be given on the command-line, followed by its filename. The whole
+** manifest is generated in one process: the lines are all parsed first (getopt() is not
+** thread-safe), and the files are then generated by a pool of worker threads, each claiming
+** the next file as soon as it has finished the last. Period tables (see wf_cache.c) belong to
+** the process, so every file with the same periodic waveform shares one.
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include "wavgen.h"
+
+/*
+** One line of the manifest: one output file.
+*/
+struct BATCH_ENTRY {
+    struct FIXED_PARAMS           fixed;
+    struct COMMON_USER_PARAMS     user;
+    struct ADDITIONAL_USER_PARAMS extra;
+
+    char    *line;          // The text of the line, split in place into the options.
+    unsigned line_number;   // For reporting errors.
+    bool     valid;         // True if the options were parsed successfully.
+    bool     success;       // True once the file has been written successfully.
+};
+
+/*
+** State shared between all the worker threads.
+*/
+struct BATCH_JOB {
+    struct BATCH_ENTRY *entries;
+    size_t              num_entries;
+
+    atomic_size_t next_entry;   // The next entry to be claimed by a worker.
+};
+
+/*
+** Find a file that a line of the manifest writes (its output, or a sweep's inverse filter) that
+** is also written by an earlier valid line, or by the line itself. The files are written at the
+** same time by different threads, so each must only be written once.
+** Returns the name of the file written twice, or NULL if there is none.
+*/
+static const char *batch_find_clash(const struct BATCH_JOB *job, const struct BATCH_ENTRY *entry)
+{
+    const struct BATCH_ENTRY *earlier;
+    const char *names[2] = { entry->user.filename, entry->extra.inverse_file };
+    size_t      index;
+    size_t      name;
+
+    if ((names[1] != NULL) && (strcmp(names[0], names[1]) == 0)) {
+        return names[1];
+    }
+
+    for (index = 0; &job->entries[index] != entry; ++index) {
+        earlier = &job->entries[index];
+        for (name = 0; earlier->valid && (name < 2U) && (names[name] != NULL); ++name) {
+            if ((strcmp(names[name], earlier->user.filename) == 0) ||
+                ((earlier->extra.inverse_file != NULL) && (strcmp(names[name], earlier->extra.inverse_file) == 0))) {
+                return names[name];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+** Read the next line of the manifest (of any length) into a buffer that is grown as needed.
+** This is fgets() rather than getline(), which isn't available everywhere (e.g. on Windows).
+** Returns false at the end of the manifest, or if it could not be read.
+*/
+static bool batch_read_line(FILE *file, char **line, size_t *line_size)
+{
+    size_t length = 0;
+    size_t size;
+    char  *bigger;
+
+    for (;;) {
+        if ((*line_size - length) < 2U) {
+            size   = (*line_size == 0) ? 256U : (*line_size * 2U);
+            bigger = realloc(*line, size);
+            if (bigger == NULL) {
+                return false;
+            }
+            *line      = bigger;
+            *line_size = size;
+        }
+
+        if (fgets(*line + length, (int) (*line_size - length), file) == NULL) {
+            return (length > 0) && !ferror(file);
+        }
+
+        length += strlen(*line + length);
+        if ((length > 0) && ((*line)[length - 1U] == '\n')) {
+            return true;
+        }
+    }
+}
+
+/*
+** Read the manifest and parse the options on each line.
+** Returns false if the manifest could not be read (invalid lines are just marked as such).
+*/
+static bool batch_read(struct FIXED_PARAMS *fixed, const char *manifest, struct BATCH_JOB *job)
+{
+    struct BATCH_ENTRY *entries;
+    struct BATCH_ENTRY *entry;
+    FILE    *file;
+    char    *line = NULL;
+    size_t   line_size = 0;
+    size_t   capacity = 0;
+    unsigned line_number = 0;
+    char    *args[MAX_LINE_ARGS];
+    char    *text;
+    const char *clash;
+    int      num_args;
+    bool     success = true;
+
+    file = fopen(manifest, "r");
+    if (file == NULL) {
+        log_info(fixed, "ERROR: Could not open batch manifest '%s'\n", manifest);
+        return false;
+    }
+
+    while (batch_read_line(file, &line, &line_size)) {
+        ++line_number;
+
+        /* Skip blank lines and comments.*/
+        for (text = line; isspace((unsigned char) *text); ++text) {
+        }
+        if ((*text == '\0') || (*text == '#')) {
+            continue;
+        }
+
+        if (job->num_entries == capacity) {
+            capacity = (capacity == 0) ? 64U : (capacity * 2U);
+            entries  = realloc(job->entries, capacity * sizeof(struct BATCH_ENTRY));
+            if (entries == NULL) {
+                log_info(fixed, "ERROR: Not enough memory for the batch manifest.\n");
+                success = false;
+                break;
+            }
+            job->entries = entries;
+        }
+
+        entry = &job->entries[job->num_entries];
+        memset(entry, 0, sizeof(struct BATCH_ENTRY));
+        entry->line_number = line_number;
+
+        entry->line = strdup(text);
+        if (entry->line == NULL) {
+            log_info(fixed, "ERROR: Not enough memory for the batch manifest.\n");
+            success = false;
+            break;
+        }
+        ++job->num_entries;
+
+        num_args = split_args(entry->line, args);
+        if (num_args < 0) {
+            log_info(fixed, "ERROR: Too many options on line %u of the manifest.\n", line_number);
+            continue;
+        }
+
+        /* Every line writes a file, so its options are parsed as if not piping.*/
+        entry->fixed.piping = false;
+        if (parse_opts(num_args, args, &entry->fixed, &entry->user, &entry->extra) != OPTS_OK) {
+            log_info(fixed, "ERROR: Invalid options on line %u of the manifest.\n", line_number);
+            continue;
+        }
+
+        if (entry->user.realtime || entry->user.unbounded || (entry->user.batch_file != NULL) ||
+            (entry->user.serve_path != NULL)) {
+            log_info(fixed, "ERROR: Line %u of the manifest can't be real-time, unbounded, a batch or a server.\n", line_number);
+            continue;
+        }
+
+        clash = batch_find_clash(job, entry);
+        if (clash != NULL) {
+            log_info(fixed, "ERROR: Line %u of the manifest writes '%s', which is written more than once.\n", line_number, clash);
+            continue;
+        }
+
+        /* The pool provides the parallelism, so each file is written by one thread.*/
+        entry->user.num_threads = 1U;
+        entry->fixed.verbose    = entry->fixed.verbose || fixed->verbose;
+        entry->valid            = true;
+    }
+
+    if (success && !feof(file)) {
+        log_info(fixed, "ERROR: Could not read line %u of the batch manifest.\n", line_number + 1U);
+        success = false;
+    }
+
+    free(line);
+    fclose(file);
+
+    return success;
+}
+
+/*
+** Worker thread: claim and generate files until there are none left.
+*/
+static void *batch_worker(void *arg)
+{
+    struct BATCH_JOB   *job = arg;
+    struct BATCH_ENTRY *entry;
+    FILE  *wavfile;
+    size_t index;
+
+    while ((index = atomic_fetch_add(&job->next_entry, 1U)) < job->num_entries) {
+        entry = &job->entries[index];
+        if (!entry->valid) {
+            continue;
+        }
+
+        wavfile = fopen(entry->user.filename, "w+");
+        if (wavfile == NULL) {
+            log_info(&entry->fixed, "ERROR: Could not create or open output file '%s'\n", entry->user.filename);
+            continue;
+        }
+
+        /* As for a single file, a sweep's inverse filter is written first.*/
+        entry->success = (entry->extra.inverse_file == NULL) ||
+                         write_sweep_inverse(&entry->fixed, &entry->user, &entry->extra);
+
+        if (entry->success) {
+            entry->success = write_stream(&entry->fixed, &entry->user, &entry->extra, wavfile);
+        }
+
+        if (fclose(wavfile) != 0) {
+            entry->success = false;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+** Generate every file listed in the manifest given by --batch, using up to --threads workers.
+** Returns true if every line was valid and every file was written successfully.
+*/
+bool run_batch(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user)
+{
+    struct BATCH_JOB job;
+    pthread_t workers[MAX_THREADS];
+    uint16_t  num_workers;
+    uint16_t  index;
+    size_t    entry;
+    size_t    num_written = 0;
+    bool      success;
+
+    memset(&job, 0, sizeof(struct BATCH_JOB));
+    atomic_init(&job.next_entry, 0U);
+
+    success = batch_read(fixed, user->batch_file, &job);
+
+    if (success) {
+        num_workers = user->num_threads;
+        if (num_workers > job.num_entries) {
+            num_workers = (uint16_t) job.num_entries;
+        }
+        log_extra(fixed, "Generating %zu files with %u threads.\n", job.num_entries, num_workers);
+
+        for (index = 0; index < num_workers; ++index) {
+            if (pthread_create(&workers[index], NULL, batch_worker, &job) != 0) {
+                break;
+            }
+        }
+        num_workers = index;
+
+        /* If no thread could be started at all, do the work here instead.*/
+        if (num_workers == 0) {
+            batch_worker(&job);
+        }
+
+        for (index = 0; index < num_workers; ++index) {
+            pthread_join(workers[index], NULL);
+        }
+
+        for (entry = 0; entry < job.num_entries; ++entry) {
+            if (job.entries[entry].success) {
+                ++num_written;
+            }
+            else {
+                if (job.entries[entry].valid) {
+                    log_info(fixed, "ERROR: Failed to write '%s' (line %u of the manifest).\n",
+                             job.entries[entry].user.filename, job.entries[entry].line_number);
+                }
+                success = false;
+            }
+        }
+
+        log_info(fixed, "Generated %zu of %zu files.\n", num_written, job.num_entries);
+    }
+
+    for (entry = 0; entry < job.num_entries; ++entry) {
+        free(job.entries[entry].line);
+    }
+    free(job.entries);
+
+    return success;
+}
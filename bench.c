@@ -0,0 +1,310 @@
+/*
+** bench.c
+**
+** A micro-benchmark for wavgen's generators and output stages (the wavgen-bench target).
+** Each waveform generator, and each output path (the format conversion, level, marker and pack
+** stages of finalise_block()), is run over a fixed number of frames for a few channel counts.
+** Nothing is written to disk, so only the processing itself is measured.
+**
+** Results are printed as CSV (one header line, then one line per test) so that they can be
+** collected from each (cross-compiled) target and compared, e.g.:
+** ./wavgen-bench -n 4194304 -c 2 > results-armhf.csv
+*/
+#include <getopt.h>
+#include <time.h>
+#include "wavgen.h"
+
+#define BENCH_DEFAULT_FRAMES (1048576U)     // Frames processed by each test.
+#define BENCH_REPEATS        (3U)           // Each test is repeated and the fastest run is reported.
+
+static const uint8_t bench_channels[] = { 1U, 2U, 8U };
+
+static const struct {
+    const char   *name;
+    WAVEFORM_TYPE type;
+    bool          uncorrelated;     // A different noise stream on each channel (-u).
+    PINK_TYPE     pink_type;
+} bench_generators[] = {
+    { "burst",        WAVEFORM_TYPE_BURST,   false, PINK_KELLET       },
+    { "counter",      WAVEFORM_TYPE_COUNTER, false, PINK_KELLET       },
+    { "saw",          WAVEFORM_TYPE_SAW,     false, PINK_KELLET       },
+    { "silence",      WAVEFORM_TYPE_SILENCE, false, PINK_KELLET       },
+    { "sine",         WAVEFORM_TYPE_SINE,    false, PINK_KELLET       },
+    { "square",       WAVEFORM_TYPE_SQUARE,  false, PINK_KELLET       },
+    { "steps",        WAVEFORM_TYPE_STEPS,   false, PINK_KELLET       },
+    { "pink",         WAVEFORM_TYPE_PINK,    false, PINK_KELLET       },
+    { "pink-u",       WAVEFORM_TYPE_PINK,    true,  PINK_KELLET       },
+    { "pink-u-float", WAVEFORM_TYPE_PINK,    true,  PINK_KELLET_FLOAT },
+    { "pink-u-voss",  WAVEFORM_TYPE_PINK,    true,  PINK_VOSS         },
+    { "white",        WAVEFORM_TYPE_WHITE,   false, PINK_KELLET       },
+    { "white-u",      WAVEFORM_TYPE_WHITE,   true,  PINK_KELLET       },
+    { "sweep",        WAVEFORM_TYPE_SWEEP,   false, PINK_KELLET       },
+};
+
+static const struct {
+    const char *name;
+    uint8_t     bits_per_sample;
+    bool        save_as_float;
+    bool        gain;           // Apply a (non-unity) level change.
+    bool        markers;        // Add channel markers (LSB).
+    DITHER_TYPE dither;
+} bench_outputs[] = {
+    { "s16",         16U, false, false, false, DITHER_NONE   },
+    { "s16-gain",    16U, false, true,  false, DITHER_NONE   },
+    { "s16-markers", 16U, false, false, true,  DITHER_NONE   },
+    { "s16-tpdf",    16U, false, false, false, DITHER_TPDF   },
+    { "s16-shaped",  16U, false, false, false, DITHER_SHAPED },
+    { "s24",         24U, false, false, false, DITHER_NONE   },
+    { "s24-tpdf",    24U, false, false, false, DITHER_TPDF   },
+    { "s32",         32U, false, false, false, DITHER_NONE   },
+    { "s32-gain",    32U, false, true,  false, DITHER_NONE   },
+    { "s32-markers", 32U, false, false, true,  DITHER_NONE   },
+    { "u8",           8U, false, false, false, DITHER_NONE   },
+    { "float",       32U, true,  false, false, DITHER_NONE   },
+    { "float-gain",  32U, true,  true,  false, DITHER_NONE   },
+};
+
+/*
+** A monotonic time-stamp in nanoseconds.
+*/
+static uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t) now.tv_sec * 1000000000ULL) + (uint64_t) now.tv_nsec;
+}
+
+/*
+** Print one result line. The byte count is whatever the test produced (generated samples for
+** the generators, packed output for the output paths).
+*/
+static void bench_report(const char *suite, const char *name, uint8_t num_channels,
+                         uint64_t num_frames, uint64_t num_bytes, uint64_t elapsed_ns)
+{
+    double seconds;
+
+    if (elapsed_ns == 0) {
+        elapsed_ns = 1; // Too quick to measure, but avoid dividing by zero.
+    }
+    seconds = (double) elapsed_ns / 1e9;
+
+    printf("%s,%s,%u,%" PRIu64 ",%.3f,%.1f,%.0f\n", suite, name, num_channels, num_frames,
+           (double) elapsed_ns / (double) (num_frames * num_channels),
+           ((double) num_bytes / 1e6) / seconds,
+           (double) num_frames / seconds);
+}
+
+/*
+** Set up the parameters that every test shares, as parse_opts() would for the defaults.
+*/
+static void bench_params(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user,
+                         struct ADDITIONAL_USER_PARAMS *extra, uint8_t num_channels)
+{
+    memset(fixed, 0, sizeof(struct FIXED_PARAMS));
+    memset(user,  0, sizeof(struct COMMON_USER_PARAMS));
+    memset(extra, 0, sizeof(struct ADDITIONAL_USER_PARAMS));
+
+    fixed->gain   = 1.0;
+    fixed->piping = true;   // No logging from the stages being measured.
+
+    user->num_channels     = num_channels;
+    user->bits_per_sample  = 32U;
+    user->bytes_per_sample = 4U;
+    user->sample_rate      = 48000U;
+    user->frequency_hz     = 997U;  // Not a divisor of the sample rate, as is usual for test tones.
+    user->block_frames     = DEFAULT_BLOCK_FRAMES;
+    user->num_threads      = 1U;
+    user->period_cache     = false;
+    user->num_samples      = (uint64_t) 10U * user->sample_rate * num_channels;  // A 10s sweep.
+
+    extra->power_fraction  = 1U;
+    extra->period_ms       = 100U;
+    extra->num_cycles      = 1U;
+    extra->sweep_end_hz    = 20000U;
+}
+
+/*
+** Time a generator alone, a block at a time.
+*/
+static uint64_t bench_generator(struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                                SAMPLE *buffer, uint64_t num_frames)
+{
+    struct WAVEFORM_STATE state;
+    uint64_t start;
+    uint64_t frame;
+    uint32_t block_frames;
+
+    generate_init(&state);
+    start = bench_now_ns();
+
+    for (frame = 0; frame < num_frames; frame += block_frames) {
+        block_frames = user->block_frames;
+        if ((num_frames - frame) < block_frames) {
+            block_frames = (uint32_t) (num_frames - frame);
+        }
+
+        generate_direct(&state, user, extra, buffer, block_frames);
+        state.sample_number += block_frames;
+    }
+
+    return bench_now_ns() - start;
+}
+
+/*
+** Time the output stages on one pre-generated block, packing into memory.
+** The block is finalised in place, so it is restored from the source before each pass (outside
+** of the timing) otherwise repeated level changes would leave it decaying towards zero, and
+** float samples then take the slow path for denormals.
+*/
+static uint64_t bench_output(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user,
+                             struct ADDITIONAL_USER_PARAMS *extra, const SAMPLE *source,
+                             SAMPLE *buffer, uint8_t *output, uint64_t num_frames)
+{
+    struct OUTPUT_WRITER  writer;
+    struct WAVEFORM_STATE state;
+    uint64_t elapsed_ns = 0;
+    uint64_t start;
+    uint64_t frame;
+    uint32_t block_frames;
+    size_t   block_bytes;
+
+    generate_init(&state);
+
+    for (frame = 0; frame < num_frames; frame += block_frames) {
+        block_frames = user->block_frames;
+        if ((num_frames - frame) < block_frames) {
+            block_frames = (uint32_t) (num_frames - frame);
+        }
+
+        /* As if each block had just been generated (for the dither).*/
+        state.sample_number += block_frames;
+
+        memcpy(buffer, source, (size_t) block_frames * user->num_channels * sizeof(SAMPLE));
+
+        block_bytes = (size_t) block_frames * user->num_channels * user->bytes_per_sample;
+        writer_init_mapped(&writer, output, block_bytes);
+
+        start = bench_now_ns();
+        if (!finalise_block(fixed, user, extra, &state, buffer, block_frames, &writer)) {
+            return 0;
+        }
+        elapsed_ns += bench_now_ns() - start;
+    }
+
+    return elapsed_ns;
+}
+
+/*
+** The benchmark entry point.
+*/
+int main(int argc, char *argv[])
+{
+    struct FIXED_PARAMS           fixed;
+    struct COMMON_USER_PARAMS     user;
+    struct ADDITIONAL_USER_PARAMS extra;
+
+    uint64_t num_frames   = BENCH_DEFAULT_FRAMES;
+    uint8_t  num_channels = 0;  // Zero runs every channel count in bench_channels[].
+    const uint8_t *channels = bench_channels;
+    size_t   num_counts   = sizeof(bench_channels);
+    uint64_t best_ns;
+    uint64_t elapsed_ns;
+    SAMPLE  *source;
+    SAMPLE  *buffer;
+    uint8_t *output;
+    size_t   test;
+    size_t   chnl_index;
+    uint32_t repeat;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "c:n:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            num_channels = (uint8_t) atoi(optarg);
+            if ((num_channels < 1U) || (num_channels > MAX_CHANNELS)) {
+                fprintf(stderr, "Channels must be 1 to %u.\n", MAX_CHANNELS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'n':
+            sscanf(optarg, "%" SCNu64, &num_frames);
+            if (num_frames < 1U) {
+                num_frames = 1U;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "Usage: %s [-n frames] [-c channels]\n", argv[0]);
+            exit((opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    source = malloc((size_t) DEFAULT_BLOCK_FRAMES * MAX_CHANNELS * sizeof(SAMPLE));
+    buffer = malloc((size_t) DEFAULT_BLOCK_FRAMES * MAX_CHANNELS * sizeof(SAMPLE));
+    output = malloc((size_t) DEFAULT_BLOCK_FRAMES * MAX_CHANNELS * sizeof(SAMPLE));
+    if ((source == NULL) || (buffer == NULL) || (output == NULL)) {
+        fprintf(stderr, "Failed to allocate the sample buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("suite,name,channels,frames,ns_per_sample,mb_per_s,frames_per_s\n");
+
+    /* A channel count given on the command-line replaces the standard set.*/
+    if (num_channels != 0) {
+        channels   = &num_channels;
+        num_counts = 1U;
+    }
+
+    for (chnl_index = 0; chnl_index < num_counts; ++chnl_index) {
+
+        /* Every generator, on its own.*/
+        for (test = 0; test < (sizeof(bench_generators) / sizeof(bench_generators[0])); ++test) {
+            bench_params(&fixed, &user, &extra, channels[chnl_index]);
+            user.wf_type = bench_generators[test].type;
+            extra.uncorrelated = bench_generators[test].uncorrelated;
+            extra.pink_type    = bench_generators[test].pink_type;
+
+            best_ns = UINT64_MAX;
+            for (repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+                elapsed_ns = bench_generator(&user, &extra, buffer, num_frames);
+                best_ns    = (elapsed_ns < best_ns) ? elapsed_ns : best_ns;
+            }
+
+            bench_report("generate", bench_generators[test].name, user.num_channels, num_frames,
+                         num_frames * user.num_channels * sizeof(SAMPLE), best_ns);
+        }
+
+        /* Every output path, on a block of sine-wave (or counter, for markers).*/
+        for (test = 0; test < (sizeof(bench_outputs) / sizeof(bench_outputs[0])); ++test) {
+            bench_params(&fixed, &user, &extra, channels[chnl_index]);
+            user.bits_per_sample  = bench_outputs[test].bits_per_sample;
+            user.bytes_per_sample = user.bits_per_sample / 8U;
+            user.save_as_float    = bench_outputs[test].save_as_float;
+            user.wf_type          = bench_outputs[test].markers ? WAVEFORM_TYPE_COUNTER : WAVEFORM_TYPE_SINE;
+            extra.markers_on      = bench_outputs[test].markers;
+            user.dither           = bench_outputs[test].dither;
+            if (bench_outputs[test].gain) {
+                fixed.gain = gain_from_params(&fixed, 0.0f, -6.0f, 1U);
+            }
+
+            best_ns = UINT64_MAX;
+            for (repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+                bench_generator(&user, &extra, source, user.block_frames);
+                elapsed_ns = bench_output(&fixed, &user, &extra, source, buffer, output, num_frames);
+                best_ns    = (elapsed_ns < best_ns) ? elapsed_ns : best_ns;
+            }
+
+            bench_report("output", bench_outputs[test].name, user.num_channels, num_frames,
+                         num_frames * user.num_channels * user.bytes_per_sample, best_ns);
+        }
+    }
+
+    free(output);
+    free(buffer);
+    free(source);
+
+    return EXIT_SUCCESS;
+}
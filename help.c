@@ -12,21 +12,41 @@ void help(void)
     printf("Waveform Generator (wavgen) utility version %s\n", version_str);
     printf("\n");
     printf("Usage: wavgen -t <type> [opts] [filename]\n");
-    printf("       wavgen -t <type> [opts] | aplay [opts]\n\n");
+    printf("       wavgen -t <type> [opts] | aplay [opts]\n");
+    printf("       wavgen --batch <manifest> [--threads <n>]\n");
+    printf("       wavgen --serve <socket>\n");
+    printf("       wavgen verify [opts] [capture]\n\n");
     printf("Where opts:\n");
     printf(" -a [--align]     Alignment level in dBFS that the peak level is relative to.\n");
-    printf(" -b [--bitdepth]  Bit-depth of the samples (16, 24 or 32-bit), or 0 for float32 [32-bit].\n");
+    printf("    [--batch]     Generate every file listed in a manifest (options and a filename per line).\n");
+    printf(" -b [--bitdepth]  Bit-depth of the samples (8, 16, 24 or 32-bit), or 0 for float32 [32-bit].\n");
+    printf("    [--blocksize] Number of frames generated and written out at a time [%u].\n", DEFAULT_BLOCK_FRAMES);
     printf(" -c [--channels]  Number of channels in the generated output file [1].\n");
+    printf("    [--chan]      Give one channel its own waveform: 'channel:type[:frequency]', e.g. '2:sine:1k'.\n");
     printf(" -d [--duration]  Duration of the file content in seconds [default 1s].\n");
+    printf("    [--dither]    Dither 8, 16 and 24-bit output: 'none', 'tpdf' or 'shaped' (noise-shaped) [none].\n");
+    printf("    [--endfreq]   The frequency a sweep ends at (it starts at -f) [20kHz].\n");
+    printf("    [--fade]      Fade a sweep in and out over this duration [0].\n");
     printf(" -f [--frequency] Frequency (does not effect the 'count' types) [440Hz].\n");
     printf(" -h [--help]      Show this help page.\n");
+    printf("    [--inverse]   Also write a sweep's inverse filter (for deconvolution) to this file.\n");
     printf(" -l [--level]     Peak level in dBFS (does not effect non-audio types) [0dBFS].\n");
     printf(" -m [--markers]   Add channel markers (top or bottom byte) into samples [OFF].\n");
+    printf("    [--mix]       Mix another waveform with -t: 'type[:frequency[:level]]', e.g. 'sine:7k:-12' (up to %u).\n", MAX_MIX_SOURCES);
+    printf("    [--mmap]      Write the output file through a memory mapping (not when piping).\n");
     printf(" -n [--numcycles] Number of cycles for each burst or impulse waveform.\n");
+    printf("    [--nocache]   Always calculate periodic waveforms rather than copying one period.\n");
     printf(" -p [--period]    The period for intermittent burst or impulse waveforms.\n");
+    printf("    [--realtime]  Pace the output at the sample rate (endless unless -d/-s given).\n");
+    printf("    [--pink]      Pink noise engine: 'kellet' (filter), 'kellet-float' or 'voss' [kellet].\n");
     printf(" -w [--power]     Alternative to '-l', the 'power fraction' may be set instead.\n");
     printf(" -t [--type]      Type of waveform to be generated (see below for options).\n");
+    printf("    [--threads]   Number of threads used to generate file (not piped) output [1].\n");
+    printf("    [--serve]     Serve WAV streams on a UNIX socket (one request line of options per client).\n");
+    printf("    [--seed]      Seed for the noise types, so that different runs give different noise [0].\n");
     printf(" -s [--samples]   Number of samples per-channel (an alternative to 'duration').\n");
+    printf("    [--sweep]     A sweep's frequency scale: 'log' or 'linear' [log].\n");
+    printf("    [--unbounded] Generate endlessly, until stopped or the reading application exits.\n");
     printf(" -v [--verbose]   Output data to stdout, if not piping to another application.\n");
     printf("    [--version]   Show the version number and exit.\n");
     printf("and:\n");
@@ -44,12 +64,14 @@ void help(void)
     printf(" silence : Silence, apart from the added channel markers if selected with '-m'.\n");
     printf(" pink    : Pink noise generated by 1/f filtering the white noise source.\n");
     printf(" burst   : A periodic burst of sinewave cycles, useful for measuring latency.\n");
-    printf(" white   : White noise generated using a fast psudo-random noise generator.\n");
+    printf(" white   : White noise generated using a fast (counter-based) pseudo-random noise generator.\n");
+    printf(" sweep   : A sine sweep (chirp) from -f to --endfreq over the whole duration.\n");
     printf("\n");
     printf("e.g. wavgen -t counter -b 32 -c 2 -m msb /tmp/count-s32le-2ch-marked.wav\n");
     printf(" or  wavgen -t sine -b 32 -c 2 -d 1000 -f 1000 | aplay -D default\n");
     printf("\n");
-    printf("Use 'wavgen -t <type> --help' for context-sensitive help on each waveform type.\n");
+    printf("Use 'wavgen -t <type> --help' for context-sensitive help on each waveform type,\n");
+    printf("and 'wavgen verify --help' for help on checking a captured counter stream.\n");
 }
 
 void print_common_options()
@@ -115,6 +137,8 @@ void help_type_counter(void)
     printf("Configure the counter using these options:\n");
     print_common_options();
     printf(" -m <lsb|msb>   : Place channel markers in the LSB or MSB.\n");
+    printf("\n");
+    printf("A captured counter stream can be checked with 'wavgen verify' (see 'wavgen verify --help').\n");
 }
 
 void help_type_steps(void)
@@ -190,11 +214,9 @@ void help_type_sine(void)
     printf("\n");
     printf("Example: ./wavgen -t sine -c 2 -d 1000 -f 440 -a -18 -l -3.0 sine-22dbfs.wav\n");
     printf("\n");
-    printf("This type produces a pure sinewave at approximately the requested frequency.\n"
-           "If the requested frequency does not divide nicely into the sample-rate then\n"
-           "it will be adjusted to the nearest value to avoid adding frequency jitter\n"
-           "to the generated tone. At the most usual test frequencies such as 1000Hz\n"
-           "then you will get exactly what you ask for.\n");
+    printf("This type produces a pure sinewave at exactly the requested frequency, even\n"
+           "if the frequency does not divide nicely into the sample-rate (in which case\n"
+           "successive cycles will not all start at the same point).\n");
     printf("\n");
     printf("Channel markers are not allowed.\n");
     printf("\n");
@@ -250,6 +272,10 @@ void help_type_pink(void)
     printf(" -a <align>     : An optional alignment level (dBFS) that -l is relative to.\n");
     printf(" -m lsb         : Place channel markers in the LSB.\n");
     printf(" -u             : Generate uncorrelated noise (different on each channel)\n");
+    printf(" --seed <n>     : Generate different noise (the same seed gives the same noise) [0].\n");
+    printf(" --pink <type>  : 'kellet' filters white noise (double-precision), 'kellet-float' is the\n"
+           "                  same filter in single-precision (faster for many channels), and 'voss'\n"
+           "                  uses the cheaper Voss-McCartney algorithm (~-17dBFS RMS) [kellet].\n");
 }
 
 void help_type_white(void)
@@ -273,6 +299,36 @@ void help_type_white(void)
     printf(" -a <align>     : An optional alignment level (dBFS) that -l is relative to.\n");
     printf(" -m lsb         : Place channel markers in the LSB.\n");
     printf(" -u             : Generate uncorrelated noise (different on each channel)\n");
+    printf(" --seed <n>     : Generate different noise (the same seed gives the same noise) [0].\n");
+}
+
+void help_type_sweep(void)
+{
+    printf("SINE SWEEP (-t sweep):\n");
+    printf("\n");
+    printf("Example: ./wavgen -t sweep -f 20 --endfreq 20k -d 10s --fade 50 --inverse inverse.wav sweep.wav\n");
+    printf("\n");
+    printf("This type produces a sinewave that sweeps (chirps) from one frequency to another\n"
+           "over the whole duration, for measuring a frequency response (or, deconvolved\n"
+           "with the inverse filter, an impulse response) with a single file. A logarithmic\n"
+           "sweep spends the same time on each octave, a linear sweep on each hertz. The\n"
+           "phase follows the exact sweep, whatever the frequencies and duration.\n");
+    printf("\n");
+    printf("The inverse filter is the sweep reversed, with a 6dB/octave envelope for a log\n"
+           "sweep, written as a mono float file. Convolving a recording of the sweep with\n"
+           "it gives the impulse response of whatever the sweep was played through.\n");
+    printf("\n");
+    printf("Channel markers are not allowed.\n");
+    printf("\n");
+    printf("Configure the sweep using these options:\n");
+    print_common_options();
+    printf(" -f <frequency> : The frequency in Hz that the sweep starts at.\n");
+    printf(" --endfreq <f>  : The frequency in Hz that the sweep ends at [20kHz].\n");
+    printf(" --sweep <type> : 'log' or 'linear' [log].\n");
+    printf(" --fade <dur>   : Raised-cosine fade in and out, e.g. '50' (ms) [0].\n");
+    printf(" --inverse <f>  : Also write the inverse filter to the file given.\n");
+    printf(" -l <level>     : The signal amplitude in dB relative to the alignment level.\n");
+    printf(" -a <align>     : An optional alignment level (dBFS) that -l is relative to.\n");
 }
 
 void help_type_unknown(void)
@@ -289,10 +345,38 @@ void help_type_unknown(void)
     printf(" square  : A square-wave at frequency -f <freq>.\n");
     printf(" pink    : A pink noise source (1/f filtered white noise).\n");
     printf(" white   : A white noise source.\n");
+    printf(" sweep   : A logarithmic or linear sine sweep from -f <freq> to --endfreq <freq>.\n");
     printf("\n");
     printf("Use the -t or --type option to specify the waveform, e.g. -t saw or --type=sine\n");
 }
 
+void help_verify(void)
+{
+    printf("VERIFY (wavgen verify):\n");
+    printf("\n");
+    printf("Usage: wavgen verify [opts] [capture]\n");
+    printf("       arecord [opts] | wavgen verify [opts]\n");
+    printf("\n");
+    printf("Example: ./wavgen verify -m msb /tmp/capture.wav\n");
+    printf("\n");
+    printf("Checks a captured counter stream (or silence with channel markers), as a WAV file or raw\n"
+           "samples, read from the file given or from stdin. The counter must go up by one every\n"
+           "frame and every sample must have its own channel's marker. Anything else is reported\n"
+           "with the frame (and time) at which it happened: frames dropped, repeated or jumped back\n"
+           "to, channels swapped, rotated (an interleaving slip) or out of step, or bad markers.\n"
+           "The exit status is non-zero if anything was found.\n");
+    printf("\n");
+    printf("A WAV file's format is taken from its header. Raw samples use these options:\n");
+    printf(" -c <channels>  : The number of channels (1 - %u) [1].\n", MAX_CHANNELS);
+    printf(" -b <bitdepth>  : The bit-depth of the samples (8, 16, 24 or 32-bit) [32].\n");
+    printf(" -r <rate>      : The sample-rate in Hz, for the times reported [48000].\n");
+    printf("and for either:\n");
+    printf(" -t <type>      : 'counter' or 'silence' (markers only) [counter].\n");
+    printf(" -m <lsb|msb>   : The channel markers that were added, if any [none].\n");
+    printf(" -e <events>    : The number of events reported, the rest are just counted [%u].\n", VERIFY_MAX_EVENTS);
+    printf(" -v             : Verbose info.\n");
+}
+
 void help_version(void)
 {
     printf("Waveform Generator (wavgen) utility version %s\n", version_str);
@@ -340,6 +424,10 @@ void waveform_type_help(WAVEFORM_TYPE type)
         help_type_white();
         break;
 
+    case WAVEFORM_TYPE_SWEEP:
+        help_type_sweep();
+        break;
+
     default:
         help_type_unknown();
         break;
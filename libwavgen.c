@@ -0,0 +1,191 @@
+/*
+** libwavgen.c
+**
+** The libwavgen library interface (see libwavgen.h). Each stream holds its own copy of the
+** parameters that wavgen keeps in main(), and renders through the same block engine
+** (generate_block() and finalise_block()) packing straight into the caller's buffer.
+*/
+#include <getopt.h>
+#include <pthread.h>
+#include "libwavgen.h"
+#include "riff.h"
+#include "wavgen.h"
+
+struct WAVGEN_STREAM {
+    struct FIXED_PARAMS           fixed;
+    struct COMMON_USER_PARAMS     user;
+    struct ADDITIONAL_USER_PARAMS extra;
+    struct WAVEFORM_STATE         state;
+
+    bool     configured;    // True once the options have been parsed successfully.
+    uint64_t num_frames;    // The length of the stream, or UINT64_MAX if it is endless.
+    SAMPLE  *samples;       // A block of generated samples, before they are packed.
+};
+
+/*
+** getopt() keeps its state in globals, so only one stream can be configured at a time.
+*/
+static pthread_mutex_t options_lock = PTHREAD_MUTEX_INITIALIZER;
+
+WAVGEN_STREAM *wavgen_create(void)
+{
+    return calloc(1, sizeof(struct WAVGEN_STREAM));
+}
+
+int wavgen_configure(WAVGEN_STREAM *stream, int argc, char *argv[])
+{
+    OPTS_RESULT result;
+    int         saved_opterr;
+
+    free(stream->samples);
+    generate_free(&stream->state);
+    stream->samples    = NULL;
+    stream->configured = false;
+
+    /* Nothing is logged or shown (not even help), and there is no output file (the caller has the data).*/
+    memset(&stream->fixed, 0, sizeof(struct FIXED_PARAMS));
+    stream->fixed.piping   = true;
+    stream->fixed.embedded = true;
+
+    pthread_mutex_lock(&options_lock);
+    saved_opterr = opterr;
+    opterr       = 0;
+
+    result = parse_opts(argc, argv, &stream->fixed, &stream->user, &stream->extra);
+
+    opterr = saved_opterr;
+    pthread_mutex_unlock(&options_lock);
+
+    if (result != OPTS_OK) {
+        return WAVGEN_ERROR_OPTIONS;
+    }
+
+    /* The modes that write files or run on their own mean nothing for a stream rendered into memory.*/
+    if (stream->user.realtime || (stream->user.batch_file != NULL) || (stream->user.serve_path != NULL) ||
+        (stream->extra.inverse_file != NULL)) {
+        return WAVGEN_ERROR_OPTIONS;
+    }
+
+    /* Neither do the ways of writing a file, so they are ignored.*/
+    stream->user.num_threads = 1U;
+    stream->user.use_mmap    = false;
+
+    stream->samples = malloc((size_t) stream->user.block_frames * stream->user.num_channels * sizeof(SAMPLE));
+    if (stream->samples == NULL) {
+        return WAVGEN_ERROR_MEMORY;
+    }
+
+    stream->num_frames = stream->user.unbounded ? UINT64_MAX
+                                                : (stream->user.num_samples / stream->user.num_channels);
+
+    generate_init(&stream->state);
+    stream->configured = true;
+
+    return WAVGEN_OK;
+}
+
+int wavgen_get_format(WAVGEN_STREAM *stream, struct WAVGEN_FORMAT *format)
+{
+    if (!stream->configured) {
+        return WAVGEN_ERROR_STATE;
+    }
+
+    format->sample_rate     = stream->user.sample_rate;
+    format->num_channels    = stream->user.num_channels;
+    format->bits_per_sample = stream->user.bits_per_sample;
+    format->is_float        = stream->user.save_as_float;
+    format->bytes_per_frame = (uint32_t) stream->user.num_channels * stream->user.bytes_per_sample;
+    format->num_frames      = stream->num_frames;
+
+    return WAVGEN_OK;
+}
+
+int64_t wavgen_header(WAVGEN_STREAM *stream, void *buffer, size_t capacity)
+{
+    uint64_t num_data_bytes;
+    size_t   size;
+
+    if (!stream->configured) {
+        return WAVGEN_ERROR_STATE;
+    }
+
+    if (stream->num_frames == UINT64_MAX) {
+        num_data_bytes = RIFF_UNBOUNDED_SIZE;
+    }
+    else {
+        num_data_bytes = stream->num_frames * stream->user.num_channels * stream->user.bytes_per_sample;
+    }
+
+    /* Write the headers exactly as wavgen does, but into the caller's memory.*/
+    size = headers_to_buffer(&stream->fixed, &stream->user, num_data_bytes, false, buffer, capacity);
+    if (size == 0) {
+        return WAVGEN_ERROR_SPACE;
+    }
+
+    return (int64_t) size;
+}
+
+int64_t wavgen_render(WAVGEN_STREAM *stream, void *buffer, uint32_t num_frames)
+{
+    struct OUTPUT_WRITER writer;
+    SAMPLE  *block_buffer;
+    uint32_t block_frames;
+    uint32_t frame;
+
+    if (!stream->configured) {
+        return WAVGEN_ERROR_STATE;
+    }
+
+    /* Stop at the end of the stream (if it has one).*/
+    if ((stream->num_frames - stream->state.sample_number) < num_frames) {
+        num_frames = (uint32_t) (stream->num_frames - stream->state.sample_number);
+    }
+
+    writer_init_mapped(&writer, buffer,
+                       (size_t) num_frames * stream->user.num_channels * stream->user.bytes_per_sample);
+
+    for (frame = 0; frame < num_frames; frame += block_frames) {
+        block_frames = stream->user.block_frames;
+        if ((num_frames - frame) < block_frames) {
+            block_frames = num_frames - frame;
+        }
+
+        /* 32-bit and float samples are generated straight into the caller's buffer.*/
+        block_buffer = writer_in_place(&writer, &stream->user);
+        if (block_buffer == NULL) {
+            block_buffer = stream->samples;
+        }
+
+        generate_block(&stream->state, &stream->user, &stream->extra, block_buffer, block_frames);
+
+        if (!finalise_block(&stream->fixed, &stream->user, &stream->extra, &stream->state, block_buffer, block_frames, &writer)) {
+            return WAVGEN_ERROR_SPACE;
+        }
+    }
+
+    return (int64_t) num_frames;
+}
+
+int wavgen_seek(WAVGEN_STREAM *stream, uint64_t frame)
+{
+    if (!stream->configured) {
+        return WAVGEN_ERROR_STATE;
+    }
+
+    if (frame > stream->num_frames) {
+        frame = stream->num_frames;
+    }
+
+    generate_seek(&stream->state, &stream->user, &stream->extra, frame);
+
+    return WAVGEN_OK;
+}
+
+void wavgen_destroy(WAVGEN_STREAM *stream)
+{
+    if (stream != NULL) {
+        free(stream->samples);
+        generate_free(&stream->state);
+        free(stream);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+** libwavgen.h
+**
+** The C interface of libwavgen, which generates wavgen's waveforms in-process rather than by
+** running the wavgen application. A stream is configured with the same options as the command
+** line and then rendered into the caller's buffers, in the sample format asked for, block by block.
+** Nothing in the library exits the process or writes to the console: errors are returned rather
+** than logged, and asking for --help or --version is an error (WAVGEN_ERROR_OPTIONS).
+**
+** For example, to play a 1kHz stereo 16-bit sine-wave for one second:
+**
+**   char *args[] = { "wavgen", "-t", "sine", "-f", "1k", "-c", "2", "-b", "16", "-d", "1s" };
+**   WAVGEN_STREAM *stream = wavgen_create();
+**
+**   if (wavgen_configure(stream, 11, args) == WAVGEN_OK) {
+**       while ((frames = wavgen_render(stream, buffer, 1024)) > 0) {
+**           play(buffer, frames);
+**       }
+**   }
+**   wavgen_destroy(stream);
+**
+** Separate streams may be rendered on separate threads at the same time.
+*/
+#ifndef libwavgen_h
+#define libwavgen_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** The library is built with everything hidden (-fvisibility=hidden) apart from these functions,
+** so that wavgen's internals can't clash with the application's own symbols.
+*/
+#if defined(__GNUC__)
+#define WAVGEN_API __attribute__((visibility("default")))
+#else
+#define WAVGEN_API
+#endif
+
+/*
+** Results returned by the library functions. Errors are always negative.
+*/
+#define WAVGEN_OK            (0)
+#define WAVGEN_ERROR_OPTIONS (-1)   // The options were invalid (or only asked for help).
+#define WAVGEN_ERROR_MEMORY  (-2)   // Memory could not be allocated.
+#define WAVGEN_ERROR_STATE   (-3)   // The stream has not been (successfully) configured.
+#define WAVGEN_ERROR_SPACE   (-4)   // The buffer given is too small.
+
+/*
+** A generated stream. The contents are private to the library.
+*/
+typedef struct WAVGEN_STREAM WAVGEN_STREAM;
+
+/*
+** The format of the samples that a configured stream renders.
+*/
+struct WAVGEN_FORMAT {
+    uint32_t sample_rate;       // Frames per second.
+    uint16_t num_channels;      // Samples per (interleaved) frame.
+    uint16_t bits_per_sample;   // 8, 16, 24 or 32.
+    bool     is_float;          // True for 32-bit float samples, otherwise integers.
+    uint32_t bytes_per_frame;   // The size of each rendered frame.
+    uint64_t num_frames;        // The length of the stream, or UINT64_MAX if it is endless.
+};
+
+/*
+** Create a stream, which must be configured before it can be rendered.
+** Returns NULL if there is not enough memory.
+*/
+WAVGEN_API WAVGEN_STREAM *wavgen_create(void);
+
+/*
+** Configure (or re-configure) a stream from wavgen command-line options, e.g. "-t", "sine".
+** argv[0] is the program name, as it is for main(), and any filename is ignored. The stream
+** starts again from its first frame. Real-time, batch and server modes and a sweep's inverse
+** filter (--inverse) are errors, and --threads and --mmap are ignored.
+*/
+WAVGEN_API int wavgen_configure(WAVGEN_STREAM *stream, int argc, char *argv[]);
+
+/*
+** Get the sample format of a configured stream.
+*/
+WAVGEN_API int wavgen_get_format(WAVGEN_STREAM *stream, struct WAVGEN_FORMAT *format);
+
+/*
+** Write the WAV file headers describing the stream (as wavgen itself would) into a buffer.
+** If the stream's sample data is an odd number of bytes, a WAV file must end with a zero pad
+** byte after it, which the RIFF size in the headers includes.
+** Returns the size of the headers in bytes, or a (negative) error.
+*/
+WAVGEN_API int64_t wavgen_header(WAVGEN_STREAM *stream, void *buffer, size_t capacity);
+
+/*
+** Render the next num_frames frames of the stream into a buffer, which must hold
+** num_frames * bytes_per_frame bytes.
+** Returns the number of frames rendered (fewer at the end of the stream, then zero)
+** or a (negative) error.
+*/
+WAVGEN_API int64_t wavgen_render(WAVGEN_STREAM *stream, void *buffer, uint32_t num_frames);
+
+/*
+** Move a configured stream so that the next frame rendered is the one given.
+*/
+WAVGEN_API int wavgen_seek(WAVGEN_STREAM *stream, uint64_t frame);
+
+/*
+** Free a stream and everything belonging to it.
+*/
+WAVGEN_API void wavgen_destroy(WAVGEN_STREAM *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
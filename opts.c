@@ -7,7 +7,34 @@
 #include <getopt.h>
 #include "wavgen.h"
 
-void parse_duration(const char* arg_str, uint32_t *duration_ms)
+/*
+** Options that only have a long form use these (non-character) values with getopt_long().
+*/
+enum LONG_ONLY_OPTS {
+    OPT_BLOCKSIZE = 256,
+    OPT_THREADS,
+    OPT_NOCACHE,
+    OPT_MMAP,
+    OPT_REALTIME,
+    OPT_UNBOUNDED,
+    OPT_BATCH,
+    OPT_SERVE,
+    OPT_DITHER,
+    OPT_SEED,
+    OPT_PINK,
+    OPT_CHAN,
+    OPT_ENDFREQ,
+    OPT_SWEEP,
+    OPT_FADE,
+    OPT_INVERSE,
+    OPT_MIX,
+};
+
+/*
+** Parse a duration, which is in milliseconds unless it has a units suffix.
+** Returns false if the units are not recognised.
+*/
+static bool parse_duration(struct FIXED_PARAMS *fixed, const char* arg_str, uint32_t *duration_ms)
 {
     int items;
     char units[2];
@@ -23,8 +50,8 @@ void parse_duration(const char* arg_str, uint32_t *duration_ms)
             }
             else {
                 if (units[1] != 's') { // A suffix of 'ms' is allowed.
-                    printf("ERROR: Unknown units for duration (use s, m, h, ms or nothing)");
-                    exit(EXIT_FAILURE);
+                    log_info(fixed, "ERROR: Unknown units for duration (use s, m, h, ms or nothing)\n");
+                    return false;
                 }
             }
         }
@@ -32,13 +59,19 @@ void parse_duration(const char* arg_str, uint32_t *duration_ms)
             *duration_ms *= 3600000; // Hours to ms.
         }
         else if (units[0] != '\0') {
-            printf("ERROR: Unknown units for duration (use h, m, s, ms/nothing)");
-            exit(EXIT_FAILURE);
+            log_info(fixed, "ERROR: Unknown units for duration (use h, m, s, ms/nothing)\n");
+            return false;
         }
     } // else ms is assumed.
+
+    return true;
 }
 
-void parse_frequency(const char* arg_str, uint32_t *freq_hz)
+/*
+** Parse a frequency, which is in hertz unless it has a kHz suffix.
+** Returns false if the units are not recognised.
+*/
+static bool parse_frequency(struct FIXED_PARAMS *fixed, const char* arg_str, uint32_t *freq_hz)
 {
     int items;
     char units[2];
@@ -49,31 +82,248 @@ void parse_frequency(const char* arg_str, uint32_t *freq_hz)
             *freq_hz *= 1000U; // kHz to Hz.
         }
         else if (units[1] != 'h' && units[1] != 'H') {
-            printf("ERROR: Unknown units for frequency (use kHz or Hz/nothing)");
-            exit(EXIT_FAILURE);
+            log_info(fixed, "ERROR: Unknown units for frequency (use kHz or Hz/nothing)\n");
+            return false;
         }
     } // else hz is assumed.
+
+    return true;
+}
+
+/*
+** Parse a waveform type name (for -t and --chan).
+** Returns false if the name is not recognised.
+*/
+static bool parse_type(const char *arg_str, WAVEFORM_TYPE *wf_type)
+{
+    if ((strcmp(arg_str, "saw") == 0) || (strcmp(arg_str, "sawtooth") == 0)) {
+        *wf_type = WAVEFORM_TYPE_SAW;
+    }
+    else if ((strcmp(arg_str, "sine") == 0) || (strcmp(arg_str, "sinewave") == 0)) {
+        *wf_type = WAVEFORM_TYPE_SINE;
+    }
+    else if ((strcmp(arg_str, "step") == 0) || (strcmp(arg_str, "steps") == 0)) {
+        *wf_type = WAVEFORM_TYPE_STEPS;
+    }
+    else if ((strcmp(arg_str, "square") == 0) || (strcmp(arg_str, "squarewave") == 0)) {
+        *wf_type = WAVEFORM_TYPE_SQUARE;
+    }
+    else if ((strcmp(arg_str, "count") == 0) || (strcmp(arg_str, "counter") == 0)) {
+        *wf_type = WAVEFORM_TYPE_COUNTER;
+    }
+    else if (strcmp(arg_str, "silence") == 0) {
+        *wf_type = WAVEFORM_TYPE_SILENCE;
+    }
+    else if (strcmp(arg_str, "pink") == 0) {
+        *wf_type = WAVEFORM_TYPE_PINK;
+    }
+    else if (strcmp(arg_str, "burst") == 0) {
+        *wf_type = WAVEFORM_TYPE_BURST;
+    }
+    else if (strcmp(arg_str, "white") == 0) {
+        *wf_type = WAVEFORM_TYPE_WHITE;
+    }
+    else if (strcmp(arg_str, "sweep") == 0) {
+        *wf_type = WAVEFORM_TYPE_SWEEP;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+** Parse a channel's own waveform (--chan), given as "channel:type" or "channel:type:frequency",
+** e.g. "2:sine:1k". Channels are numbered from 1. The frequency defaults to that given by -f,
+** which may come later on the command-line, so it is filled in afterwards if left as zero.
+** Returns false if the spec is not valid.
+*/
+static bool parse_channel_spec(struct FIXED_PARAMS *fixed, const char *arg_str, struct COMMON_USER_PARAMS *user)
+{
+    struct CHANNEL_SPEC spec;
+    unsigned int chnl;
+    char  type_str[16];
+    int   consumed = 0;
+
+    if ((sscanf(arg_str, "%u:%15[a-z]%n", &chnl, type_str, &consumed) != 2) ||
+        (chnl < 1U) || (chnl > MAX_CHANNELS)) {
+        return false;
+    }
+
+    spec.is_set       = true;
+    spec.frequency_hz = 0U;
+    if (!parse_type(type_str, &spec.wf_type)) {
+        return false;
+    }
+
+    if (arg_str[consumed] == ':') {
+        if (!parse_frequency(fixed, &arg_str[consumed + 1], &spec.frequency_hz) || (spec.frequency_hz < 1U)) {
+            return false;
+        }
+    }
+    else if (arg_str[consumed] != '\0') {
+        return false;
+    }
+
+    user->channels[chnl - 1U] = spec;
+    user->per_channel         = true;
+
+    return true;
 }
 
-void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra)
+/*
+** Returns true if the type can be mixed with others (--mix), i.e. it is an audio type whose level
+** can be changed (see level_required()).
+*/
+static bool mix_allowed(WAVEFORM_TYPE wf_type)
+{
+    switch (wf_type) {
+    case WAVEFORM_TYPE_SAW:
+    case WAVEFORM_TYPE_SINE:
+    case WAVEFORM_TYPE_SQUARE:
+    case WAVEFORM_TYPE_BURST:
+    case WAVEFORM_TYPE_PINK:
+    case WAVEFORM_TYPE_WHITE:
+    case WAVEFORM_TYPE_SWEEP:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*
+** Parse a waveform to be mixed with the main one (--mix), given as "type", "type:frequency" or
+** "type:frequency:level", e.g. "sine:7k:-12". The frequency may be left empty (e.g. "pink::-40")
+** to use that given by -f, which is filled in afterwards. The level is the peak level in dBFS
+** relative to the alignment level, as for -l, and is 0dBFS if not given.
+** Returns false if the spec is not valid or there are already MAX_MIX_SOURCES.
+*/
+static bool parse_mix_spec(struct FIXED_PARAMS *fixed, const char *arg_str, struct COMMON_USER_PARAMS *user)
+{
+    struct MIX_SOURCE source;
+    char  type_str[16];
+    char  freq_str[16];
+    int   consumed = 0;
+
+    if ((user->num_mix >= MAX_MIX_SOURCES) ||
+        (sscanf(arg_str, "%15[a-z]%n", type_str, &consumed) != 1) ||
+        !parse_type(type_str, &source.wf_type)) {
+        return false;
+    }
+
+    source.frequency_hz    = 0U;
+    source.peak_level_dbfs = 0.0f;
+    source.gain            = 1.0;
+    arg_str += consumed;
+
+    if (*arg_str == ':') {
+        consumed = 0;
+        if (sscanf(++arg_str, "%15[^:]%n", freq_str, &consumed) == 1) {
+            if (!parse_frequency(fixed, freq_str, &source.frequency_hz) || (source.frequency_hz < 1U)) {
+                return false;
+            }
+        }
+        arg_str += consumed;
+
+        if (*arg_str == ':') {
+            consumed = 0;
+            if ((sscanf(++arg_str, "%f%n", &source.peak_level_dbfs, &consumed) != 1) ||
+                (arg_str[consumed] != '\0')) {
+                return false;
+            }
+            arg_str += consumed;
+        }
+    }
+
+    if (*arg_str != '\0') {
+        return false;
+    }
+
+    user->mix[user->num_mix++] = source;
+
+    return true;
+}
+
+/*
+** Split a line of options (e.g. from a batch manifest) into whitespace-separated arguments, in
+** place, after a "program name", so that they can be passed to parse_opts() as if from main().
+** An option containing spaces (i.e. a filename) may be put in double quotes.
+** Returns the number of arguments (including the program name), or -1 if there are more than MAX_LINE_ARGS.
+*/
+int split_args(char *line, char *args[])
+{
+    int   num_args = 0;
+    char *next     = line;
+    char  end;
+
+    args[num_args++] = "wavgen";
+
+    while (*next != '\0') {
+        while (isspace((unsigned char) *next)) {
+            ++next;
+        }
+        if (*next == '\0') {
+            break;
+        }
+
+        if (num_args == MAX_LINE_ARGS) {
+            return -1;
+        }
+
+        if (*next == '"') {
+            end = '"';
+            ++next;
+        }
+        else {
+            end = ' ';
+        }
+        args[num_args++] = next;
+
+        while ((*next != '\0') && ((end == '"') ? (*next != '"') : !isspace((unsigned char) *next))) {
+            ++next;
+        }
+        if (*next != '\0') {
+            *next++ = '\0';
+        }
+    }
+
+    return num_args;
+}
+
+/*
+** Parse the command-line options into the parameter structs.
+** This never exits, so that it can be used by the library too. fixed->piping must be set
+** beforehand, as it decides whether anything is logged and whether a filename is needed, and
+** so must fixed->embedded, as asking for help or the version is then an error.
+**
+** Returns OPTS_OK to carry on, OPTS_DONE if nothing more needs doing (e.g. help was shown)
+** or OPTS_ERROR if the options are invalid.
+*/
+OPTS_RESULT parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra)
 {
     int opt;
     int num_args;
     int opt_index;
+    unsigned int chnl;
+    char trailing;
 
     bool help_required  = false;
     bool context_help   = false;
     bool calculate_gain = false;
+    bool length_given   = false;
+    bool threads_given  = false;
+    bool zero_frequency = false;
 
     /* Options that need some intermediate processing.*/
-    unsigned int opt_s = 0U;
+    uint64_t     opt_s = 0U;
     unsigned int opt_d = 1U;
 
     /*
     ** Initialise options to default parameters.
     */
     fixed->verbose         = false;
-    fixed->piping          = !isatty(STDOUT_FILENO); // Inhibit stdout logs if piping to another application.
 
     user->wf_type          = NUM_WAVEFORM_TYPES; // i.e. invalid.
     user->save_as_float    = false;
@@ -87,12 +337,34 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
     user->peak_level_dbfs  = 0.0f;
     user->align_level_dbfs = 0.0f;
     user->filename         = NULL;
+    user->block_frames     = DEFAULT_BLOCK_FRAMES;
+    user->num_threads      = 1U;
+    user->period_cache     = true;
+    user->use_mmap         = false;
+    user->realtime         = false;
+    user->unbounded        = false;
+    user->batch_file       = NULL;
+    user->serve_path       = NULL;
+    user->dither           = DITHER_NONE;
+    user->per_channel      = false;
+    memset(user->channels, 0, sizeof(user->channels));
+    user->num_mix          = 0U;
+    user->mix_gain         = 1.0;
 
     extra->power_fraction  = 1U;
     extra->period_ms       = 100U;
+    extra->num_cycles      = 1U;
     extra->markers_on      = false;
     extra->markers_in_msb  = false;
     extra->uncorrelated    = false;
+    extra->seed            = 0;
+    extra->pink_type       = PINK_KELLET;
+    extra->first_channel   = 0U;
+    extra->sweep_end_hz    = 0U;    // i.e. not given.
+    extra->sweep_linear    = false;
+    extra->fade_ms         = 0U;
+    extra->inverse_file    = NULL;
+    extra->sweep_inverse   = false;
 
     /*
     ** Define the available options, both short and long.
@@ -100,19 +372,36 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
     static const char short_opts[] = "huva:x:b:c:d:f:l:m:n:p:r:s:t:w:";
     static struct option long_opts[] = {
        {"align",        required_argument, 0, 'a' },
+       {"batch",        required_argument, 0, OPT_BATCH },
        {"bitdepth",     required_argument, 0, 'b' },
+       {"blocksize",    required_argument, 0, OPT_BLOCKSIZE },
+       {"chan",         required_argument, 0, OPT_CHAN },
        {"channels",     required_argument, 0, 'c' },
+       {"dither",       required_argument, 0, OPT_DITHER },
        {"duration",     required_argument, 0, 'd' },
+       {"endfreq",      required_argument, 0, OPT_ENDFREQ },
+       {"fade",         required_argument, 0, OPT_FADE },
        {"frequency",    required_argument, 0, 'f' },
        {"help",         no_argument,       0, 'h' },
+       {"inverse",      required_argument, 0, OPT_INVERSE },
        {"level",        required_argument, 0, 'l' },
        {"markers",      required_argument, 0, 'm' },
+       {"mix",          required_argument, 0, OPT_MIX },
+       {"mmap",         no_argument,       0, OPT_MMAP },
+       {"nocache",      no_argument,       0, OPT_NOCACHE },
        {"numcycles",    required_argument, 0, 'n' },
        {"period",       required_argument, 0, 'p' },
+       {"pink",         required_argument, 0, OPT_PINK },
        {"power",        required_argument, 0, 'w' },
        {"rate",         required_argument, 0, 'r' },
+       {"realtime",     no_argument,       0, OPT_REALTIME },
        {"samples",      required_argument, 0, 's' },
+       {"seed",         required_argument, 0, OPT_SEED },
+       {"serve",        required_argument, 0, OPT_SERVE },
+       {"sweep",        required_argument, 0, OPT_SWEEP },
+       {"threads",      required_argument, 0, OPT_THREADS },
        {"type",         required_argument, 0, 't' },
+       {"unbounded",    no_argument,       0, OPT_UNBOUNDED },
        {"uncorrelated", no_argument,       0, 'u' },
        {"verbose",      no_argument,       0, 'v' },
        {"version",      no_argument,       0, 'x' },
@@ -121,9 +410,12 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
 
     /*
     ** Parse command-line arguments.
+    ** Start getopt() from the beginning, in case the options have been parsed before. Zero (rather
+    ** than one) makes getopt_long() forget its place in the last argument too, which may be gone.
     */
     num_args  = 0;
     opt_index = 0;
+    optind    = 0;
     while ((opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index)) != -1) {
         ++opt_index;
         switch (opt) {
@@ -143,10 +435,10 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
             log_extra(fixed, "Bit-depth option is '%s'\n", optarg);
             sscanf(optarg, "%hhu", &user->bits_per_sample);
 
-            if ((user->bits_per_sample != 32U ) && (user->bits_per_sample != 16U ) && (user->bits_per_sample != 0U)) {
+            if ((user->bits_per_sample != 32U) && (user->bits_per_sample != 24U) &&
+                (user->bits_per_sample != 16U) && (user->bits_per_sample != 8U)  && (user->bits_per_sample != 0U)) {
                 log_info(fixed, "This bit-width is not currently supported.\n");
-                /* TODO: Add 24-bit support.*/
-                exit (EXIT_FAILURE);
+                return OPTS_ERROR;
             }
 
             /* Passing -b 0 is a hacky way to ask for FLOAT_LE format.*/
@@ -171,22 +463,29 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
 
         case 'c':
             log_extra(fixed, "Channels option is '%s'\n", optarg);
-            sscanf(optarg, "%hhu", &user->num_channels);
-            if (user->num_channels > MAX_CHANNELS) {
-                user->num_channels = MAX_CHANNELS;
+            /* Read as a plain number first, as e.g. 256 would wrap to 0 channels in 8 bits.*/
+            if ((sscanf(optarg, "%u%c", &chnl, &trailing) != 1) || (chnl < 1U) || (chnl > MAX_CHANNELS)) {
+                log_info(fixed, "The number of channels must be from 1 to %u.\n", MAX_CHANNELS);
+                return OPTS_ERROR;
             }
+            user->num_channels = (uint8_t) chnl;
             num_args += 2;
             break;
 
         case 'd':
             log_extra(fixed, "Duration option is '%s'\n", optarg);
-            parse_duration(optarg, &opt_d);
+            if (!parse_duration(fixed, optarg, &opt_d)) {
+                return OPTS_ERROR;
+            }
+            length_given = true;
             num_args += 2;
             break;
 
         case 'f':
             log_extra(fixed, "Frequency option is '%s'\n", optarg);
-            parse_frequency(optarg, &user->frequency_hz);
+            if (!parse_frequency(fixed, optarg, &user->frequency_hz)) {
+                return OPTS_ERROR;
+            }
             /* Constrained later when the sample rate is known.*/
             num_args += 2;
             break;
@@ -221,18 +520,25 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
         case 'n':
             log_extra(fixed, "Num cycles option is '%s'\n", optarg);
             sscanf(optarg, "%u", &extra->num_cycles);
+            if (extra->num_cycles < 1U) {
+                extra->num_cycles = 1U;
+            }
             num_args += 2;
             break;
 
         case 'p':
             log_extra(fixed, "Period option is '%s' ms\n", optarg);
-            parse_duration(optarg, &extra->period_ms);
+            if (!parse_duration(fixed, optarg, &extra->period_ms)) {
+                return OPTS_ERROR;
+            }
             num_args += 2;
             break;
 
         case 'r':
             log_extra(fixed, "Sample Rate option is '%s'\n", optarg);
-            parse_frequency(optarg, &user->sample_rate);
+            if (!parse_frequency(fixed, optarg, &user->sample_rate)) {
+                return OPTS_ERROR;
+            }
             if (user->sample_rate > MAX_SAMPLE_RATE_HZ) {
                 user->sample_rate = MAX_SAMPLE_RATE_HZ;
             }
@@ -241,10 +547,11 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
 
         case 's':
             log_extra(fixed, "Sample count option is '%s'\n", optarg);
-            sscanf(optarg, "%u", &opt_s);
+            sscanf(optarg, "%" SCNu64, &opt_s);
             if (opt_s > MAX_SAMPLES_PER_CHNL) {
                 opt_s = MAX_SAMPLES_PER_CHNL;
             }
+            length_given = true;
             num_args += 2;
             break;
 
@@ -252,36 +559,11 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
             log_extra(fixed, "Waveform requested: '%s'\n", optarg);
             context_help = true;
 
-            if ((strcmp(optarg, "saw") == 0) || (strcmp(optarg, "sawtooth") == 0)) {
-                user->wf_type = WAVEFORM_TYPE_SAW;
-            }
-            else if ((strcmp(optarg, "sine") == 0) || (strcmp(optarg, "sinewave") == 0)) {
-                user->wf_type = WAVEFORM_TYPE_SINE;
-            }
-            else if ((strcmp(optarg, "step") == 0) || (strcmp(optarg, "steps") == 0)) {
-                user->wf_type = WAVEFORM_TYPE_STEPS;
-            }
-            else if ((strcmp(optarg, "square") == 0) || (strcmp(optarg, "squarewave") == 0)) {
-                user->wf_type = WAVEFORM_TYPE_SQUARE;
-            }
-            else if ((strcmp(optarg, "count") == 0) || (strcmp(optarg, "counter") == 0)) {
-                user->wf_type = WAVEFORM_TYPE_COUNTER;
-            }
-            else if (strcmp(optarg, "silence") == 0) {
-                user->wf_type = WAVEFORM_TYPE_SILENCE;
-            }
-            else if (strcmp(optarg, "pink") == 0) {
-                user->wf_type = WAVEFORM_TYPE_PINK;
-            }
-            else if (strcmp(optarg, "burst") == 0) {
-                user->wf_type = WAVEFORM_TYPE_BURST;
-            }
-            else if (strcmp(optarg, "white") == 0) {
-                user->wf_type = WAVEFORM_TYPE_WHITE;
-            }
-            else {
-                help_type_unknown();
-                exit(EXIT_FAILURE);
+            if (!parse_type(optarg, &user->wf_type)) {
+                if (!fixed->piping) {
+                    help_type_unknown();
+                }
+                return OPTS_ERROR;
             }
             num_args += 2;
             break;
@@ -309,8 +591,170 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
             break;
 
         case 'x':
+            if (fixed->embedded) {
+                return OPTS_ERROR;
+            }
             help_version();
-            exit(EXIT_SUCCESS);
+            return OPTS_DONE;
+
+        case OPT_BLOCKSIZE:
+            log_extra(fixed, "Block size option is '%s' frames\n", optarg);
+            sscanf(optarg, "%u", &user->block_frames);
+            if (user->block_frames < 1U) {
+                user->block_frames = 1U;
+            }
+            if (user->block_frames > MAX_BLOCK_FRAMES) {
+                user->block_frames = MAX_BLOCK_FRAMES;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_THREADS:
+            log_extra(fixed, "Threads option is '%s'\n", optarg);
+            sscanf(optarg, "%hu", &user->num_threads);
+            if (user->num_threads < 1U) {
+                user->num_threads = 1U;
+            }
+            if (user->num_threads > MAX_THREADS) {
+                user->num_threads = MAX_THREADS;
+            }
+            threads_given = true;
+            num_args += 2;
+            break;
+
+        case OPT_NOCACHE:
+            log_extra(fixed, "Period-table cache is OFF\n");
+            user->period_cache = false;
+            num_args += 1;
+            break;
+
+        case OPT_MMAP:
+            log_extra(fixed, "Memory-mapped output is ON\n");
+            user->use_mmap = true;
+            num_args += 1;
+            break;
+
+        case OPT_REALTIME:
+            log_extra(fixed, "Real-time streaming is ON\n");
+            user->realtime = true;
+            num_args += 1;
+            break;
+
+        case OPT_UNBOUNDED:
+            log_extra(fixed, "Unbounded (endless) output is ON\n");
+            user->unbounded = true;
+            num_args += 1;
+            break;
+
+        case OPT_BATCH:
+            log_extra(fixed, "Batch manifest is '%s'\n", optarg);
+            user->batch_file = optarg;
+            num_args += 2;
+            break;
+
+        case OPT_SERVE:
+            log_extra(fixed, "Server socket is '%s'\n", optarg);
+            user->serve_path = optarg;
+            num_args += 2;
+            break;
+
+        case OPT_DITHER:
+            log_extra(fixed, "Dither option is '%s'\n", optarg);
+            if (strcmp(optarg, "none") == 0) {
+                user->dither = DITHER_NONE;
+            }
+            else if (strcmp(optarg, "tpdf") == 0) {
+                user->dither = DITHER_TPDF;
+            }
+            else if (strcmp(optarg, "shaped") == 0) {
+                user->dither = DITHER_SHAPED;
+            }
+            else {
+                log_info(fixed, "Dither must be 'none', 'tpdf' or 'shaped'.\n");
+                return OPTS_ERROR;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_PINK:
+            log_extra(fixed, "Pink option is '%s'\n", optarg);
+            if (strcmp(optarg, "kellet") == 0) {
+                extra->pink_type = PINK_KELLET;
+            }
+            else if (strcmp(optarg, "kellet-float") == 0) {
+                extra->pink_type = PINK_KELLET_FLOAT;
+            }
+            else if (strcmp(optarg, "voss") == 0) {
+                extra->pink_type = PINK_VOSS;
+            }
+            else {
+                log_info(fixed, "Pink must be 'kellet', 'kellet-float' or 'voss'.\n");
+                return OPTS_ERROR;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_SEED:
+            log_extra(fixed, "Seed option is '%s'\n", optarg);
+            sscanf(optarg, "%" SCNu64, &extra->seed);
+            num_args += 2;
+            break;
+
+        case OPT_ENDFREQ:
+            log_extra(fixed, "End frequency option is '%s'\n", optarg);
+            if (!parse_frequency(fixed, optarg, &extra->sweep_end_hz)) {
+                return OPTS_ERROR;
+            }
+            /* Constrained later when the sample rate is known.*/
+            num_args += 2;
+            break;
+
+        case OPT_SWEEP:
+            log_extra(fixed, "Sweep option is '%s'\n", optarg);
+            if ((strcmp(optarg, "log") == 0) || (strcmp(optarg, "logarithmic") == 0)) {
+                extra->sweep_linear = false;
+            }
+            else if ((strcmp(optarg, "lin") == 0) || (strcmp(optarg, "linear") == 0)) {
+                extra->sweep_linear = true;
+            }
+            else {
+                log_info(fixed, "Sweep must be 'log' or 'linear'.\n");
+                return OPTS_ERROR;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_FADE:
+            log_extra(fixed, "Fade option is '%s'\n", optarg);
+            if (!parse_duration(fixed, optarg, &extra->fade_ms)) {
+                return OPTS_ERROR;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_INVERSE:
+            log_extra(fixed, "Inverse filter file is '%s'\n", optarg);
+            extra->inverse_file = optarg;
+            num_args += 2;
+            break;
+
+        case OPT_CHAN:
+            log_extra(fixed, "Channel option is '%s'\n", optarg);
+            if (!parse_channel_spec(fixed, optarg, user)) {
+                log_info(fixed, "Channel must be given as 'channel:type' or 'channel:type:frequency' (e.g. '2:sine:1k').\n");
+                return OPTS_ERROR;
+            }
+            num_args += 2;
+            break;
+
+        case OPT_MIX:
+            log_extra(fixed, "Mix option is '%s'\n", optarg);
+            if (!parse_mix_spec(fixed, optarg, user)) {
+                log_info(fixed, "Mix must be given as 'type', 'type:frequency' or 'type:frequency:level' (e.g. 'sine:7k:-12'),"
+                                " up to %u times.\n", MAX_MIX_SOURCES);
+                return OPTS_ERROR;
+            }
+            num_args += 2;
             break;
 
         default:
@@ -324,6 +768,9 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
     ** If the user has asked for help, do that now (including the context-sensitive option).
     */
     if (help_required) {
+        if (fixed->embedded) {
+            return OPTS_ERROR;
+        }
         if (context_help) {
             /* Help on the type specified by '-t'.*/
             waveform_type_help(user->wf_type);
@@ -332,15 +779,37 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
             /* Generic command help.*/
             help();
         }
-        exit(EXIT_SUCCESS);
+        return OPTS_DONE;
+    }
+
+    /*
+    ** A batch takes its waveforms (and filenames) from each line of the manifest, and a server
+    ** from each request, so nothing else is needed here. Unless told otherwise, a batch generates
+    ** one file per processor at a time.
+    */
+    if ((user->batch_file != NULL) || (user->serve_path != NULL)) {
+        if (!threads_given) {
+#if defined(_WIN32)
+            const char *cpus_env = getenv("NUMBER_OF_PROCESSORS");
+            long num_cpus = (cpus_env != NULL) ? atol(cpus_env) : 1;
+#else
+            long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+            user->num_threads = (num_cpus < 1) ? 1U : ((num_cpus > MAX_THREADS) ? MAX_THREADS : (uint16_t) num_cpus);
+        }
+        return OPTS_OK;
     }
 
     /*
     ** Stop now if the user didn't specify a waveform type. This is required.
+    ** Like other errors, the help isn't shown when piping (it would be read as sample data).
     */
     if (user->wf_type == NUM_WAVEFORM_TYPES) {
-        waveform_type_help(user->wf_type);
-        exit(EXIT_FAILURE);
+        if (!fixed->piping) {
+            waveform_type_help(user->wf_type);
+        }
+        return OPTS_ERROR;
     }
 
     /*
@@ -359,12 +828,112 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
     */
     if (user->frequency_hz < 1U) {
         /* 0 Hz would cause floating-point division exceptions.*/
+        zero_frequency     = true;
         user->frequency_hz = 1U;
     }
 
     if (user->frequency_hz > user->sample_rate / 2) {
         log_info(fixed, "Frequency must be less than half the sample rate (%u).\n", user->sample_rate);
-        exit(EXIT_FAILURE);
+        return OPTS_ERROR;
+    }
+
+    /*
+    ** Channels given their own waveform must exist, and any without their own frequency
+    ** use the main one.
+    */
+    for (chnl = 0; user->per_channel && (chnl < MAX_CHANNELS); ++chnl) {
+        struct CHANNEL_SPEC *spec = &user->channels[chnl];
+
+        if (!spec->is_set) {
+            continue;
+        }
+        if (chnl >= user->num_channels) {
+            log_info(fixed, "Channel %u has a waveform (--chan) but there are only %u channels.\n", chnl + 1U, user->num_channels);
+            return OPTS_ERROR;
+        }
+        if (spec->frequency_hz == 0U) {
+            spec->frequency_hz = user->frequency_hz;
+        }
+        if (spec->frequency_hz > user->sample_rate / 2) {
+            log_info(fixed, "Channel %u's frequency must be less than half the sample rate (%u).\n", chnl + 1U, user->sample_rate);
+            return OPTS_ERROR;
+        }
+    }
+
+    /*
+    ** Waveforms mixed with the main one must be audio types, as must the main one (the others
+    ** can't have their level changed), and any without their own frequency use the main one.
+    ** Each has its own gain, and the main waveform's level moves onto the mixing bus too, as
+    ** the sum is saturated once there rather than having the level applied afterwards.
+    */
+    if (user->num_mix > 0U) {
+        double   sum_gain;
+        unsigned mix;
+
+        for (mix = 0; mix < MAX_CHANNELS; ++mix) {
+            if (user->per_channel && user->channels[mix].is_set && !mix_allowed(user->channels[mix].wf_type)) {
+                break;
+            }
+        }
+        if (!mix_allowed(user->wf_type) || (mix < MAX_CHANNELS)) {
+            log_info(fixed, "Waveforms can only be mixed (--mix) with an audio type.\n");
+            return OPTS_ERROR;
+        }
+
+        user->mix_gain = fixed->gain;
+        fixed->gain    = 1.0;
+        sum_gain       = user->mix_gain;
+
+        for (mix = 0; mix < user->num_mix; ++mix) {
+            struct MIX_SOURCE *source = &user->mix[mix];
+
+            if (!mix_allowed(source->wf_type)) {
+                log_info(fixed, "Only audio types can be mixed (--mix).\n");
+                return OPTS_ERROR;
+            }
+            if (source->frequency_hz == 0U) {
+                source->frequency_hz = user->frequency_hz;
+            }
+            if (source->frequency_hz > user->sample_rate / 2) {
+                log_info(fixed, "Mixed waveforms' frequencies must be less than half the sample rate (%u).\n", user->sample_rate);
+                return OPTS_ERROR;
+            }
+
+            source->gain = gain_from_params(fixed, user->align_level_dbfs, source->peak_level_dbfs, 1U);
+            sum_gain    += source->gain;
+        }
+
+        /* The peaks may not coincide, but if they could the sum may clip.*/
+        if (sum_gain > 1.0001) {
+            log_info(fixed, "WARNING: Mixed waveforms may peak at up to %+.1fdBFS%s.\n", 20.0 * log10(sum_gain),
+                     user->save_as_float ? " (not clipped as float)" : " and will be clipped");
+        }
+        else {
+            log_extra(fixed, "Mixed waveforms have at least %.1fdB of headroom\n", -20.0 * log10(sum_gain));
+        }
+    }
+
+    /*
+    ** A sweep goes up to 20kHz unless told otherwise (or as near as the sample rate allows).
+    ** Only a sweep has an inverse filter.
+    */
+    if (extra->sweep_end_hz == 0U) {
+        extra->sweep_end_hz = (user->sample_rate / 2 < 20000U) ? (user->sample_rate / 2) : 20000U;
+    }
+    else if (extra->sweep_end_hz > user->sample_rate / 2) {
+        log_info(fixed, "End frequency must be less than half the sample rate (%u).\n", user->sample_rate);
+        return OPTS_ERROR;
+    }
+
+    /* A logarithmic sweep never gets away from 0Hz (each octave takes as long as the last).*/
+    if (zero_frequency && (user->wf_type == WAVEFORM_TYPE_SWEEP) && !extra->sweep_linear) {
+        log_info(fixed, "A logarithmic sweep can't start at 0Hz (use --sweep linear, or -f 1 or more).\n");
+        return OPTS_ERROR;
+    }
+
+    if ((extra->inverse_file != NULL) && (user->wf_type != WAVEFORM_TYPE_SWEEP)) {
+        log_info(fixed, "An inverse filter (--inverse) can only be written for a sweep.\n");
+        return OPTS_ERROR;
     }
 
     if (extra->period_ms > user->duration_ms) {
@@ -384,13 +953,47 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
         case WAVEFORM_TYPE_SQUARE:
         case WAVEFORM_TYPE_PINK:
         case WAVEFORM_TYPE_WHITE:
+        case WAVEFORM_TYPE_SWEEP:
             log_info(fixed, "Markers cannot be put in the MSB of this waveform type.\n");
-            exit(EXIT_FAILURE);
+            return OPTS_ERROR;
         default:
             break;
         }
     }
 
+    /*
+    ** Chunks are written at their final position in the file, so threads cannot be used when piping.
+    ** Likewise a pipe cannot be memory-mapped.
+    */
+    if (fixed->piping) {
+        user->num_threads = 1U;
+        user->use_mmap    = false;
+    }
+
+    /*
+    ** Real-time output without a duration (or sample count) carries on indefinitely.
+    */
+    if (user->realtime && !length_given) {
+        user->unbounded = true;
+    }
+
+    /*
+    ** Real-time and endless output is generated one block at a time as it is needed, so it
+    ** is not threaded or mapped.
+    */
+    if (user->realtime || user->unbounded) {
+        user->num_threads = 1U;
+        user->use_mmap    = false;
+    }
+
+    /*
+    ** Noise-shaped dither carries each sample's error on to the next, so the output has to be
+    ** generated in order to come out the same every time.
+    */
+    if (user->dither == DITHER_SHAPED) {
+        user->num_threads = 1U;
+    }
+
     /*
     ** The special "optind" is the index in argv of the first argv-element that is not an option.
     ** This should be a filename unless the user is piping the output to another application.
@@ -400,7 +1003,7 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
         if (strlen(user->filename) < 5) {
             log_info(fixed, "Invalid output filename (length < 5 characters).");
             log_info(fixed, "Supply a filename as the last parameter - at least 'o.wav'.\n");
-            exit(EXIT_FAILURE);
+            return OPTS_ERROR;
         }
         log_extra(fixed, "Output filename will be '%s'\n", user->filename);
     }
@@ -408,7 +1011,7 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
         if (!fixed->piping) {
             log_info(fixed, "Invalid arguments (try ./wavgen --help).\n");
             log_info(fixed, "Either provide an output filename or pipe to another application.\n");
-            exit(EXIT_FAILURE);
+            return OPTS_ERROR;
         }
         else {
             // This is expected when piping to another application.
@@ -423,7 +1026,7 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
     if (opt_s != 0) {
         /* opt_s is the number of samples PER CHANNEL specified on the command-line.*/
         user->num_samples =  opt_s * user->num_channels;
-        user->duration_ms = (opt_s * 1000U) / user->sample_rate; // This does not need to be accurate.
+        user->duration_ms = (uint32_t) ((opt_s * 1000U) / user->sample_rate); // This does not need to be accurate.
     }
     else {
         /*
@@ -440,7 +1043,7 @@ void parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMO
         user->duration_ms = opt_d;
     }
 
-    return;
+    return OPTS_OK;
 }
 
 /*
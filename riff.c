@@ -1,19 +1,60 @@
 /*
 ** riff.c
 **
-** Functions to configure and write RIFF (WAV) format chunks.
+** Functions to configure RIFF (WAV) format chunks (which are written out by wf_header.c).
 */
 #include <string.h> // memset
 #include "riff.h"
 
+/*
+** Calculate the full (64-bit) size of the main RIFF (or RF64) chunk.
+*/
+static uint64_t riff_chunk_size(uint64_t num_data_bytes, bool is_float_format, bool has_ds64)
+{
+    /*
+    ** PCM (non-float) formats are simplest and do not use the extended format chunk.
+    ** Floating-point formats must include the extra chunk that describes the float format.
+    */
+    uint64_t size = sizeof(uint32_t)                  // The FormatTag ("WAVE"), but not ChunkID/ChunkSize.
+                  + sizeof(struct RIFF_FMT_CHUNK)     // Include the size of the format chunk.
+                  + sizeof(struct RIFF_DATA_CHUNK)    // Include the size of the data chunk.
+                  + num_data_bytes                    // Include the total bytes used for sample data,
+                  + RIFF_PAD_BYTES(num_data_bytes);   // and the pad byte after an odd number of them.
+
+    if (is_float_format) {
+        size += sizeof(struct RIFF_EXT_FMT_CHUNK);    // Floating-point files must include this too.
+    }
+
+    if (has_ds64) {
+        size += sizeof(struct RIFF_DS64_CHUNK);       // RF64 files hold the real sizes in this chunk (or JUNK reserves it).
+    }
+
+    return size;
+}
+
+/*
+** Work out whether the file is too big for a RIFF header, and must be written as RF64.
+** The size allows for a (reserved) ds64 chunk, so the answer is the same either way.
+*/
+bool riff_needs_rf64(uint64_t num_data_bytes, bool is_float_format)
+{
+    if (num_data_bytes == RIFF_UNBOUNDED_SIZE) {
+        return false; // Streamed with the maximum RIFF sizes instead.
+    }
+
+    return riff_chunk_size(num_data_bytes, is_float_format, true) > RIFF_MAX_CHUNK_SIZE;
+}
+
 /*
 ** Initialise the main RIFF header.
 **
 ** param  chunk           : A pointer to the struct to initialise.
 ** param  num_data_bytes  : The number of audio data BYTES to be appended.
 ** param  is_float_format : True if an extended format ("FACT") chuck is included (req'd for float format).
+** param  has_ds64        : True if a ds64 chunk (or a JUNK chunk reserving space for one) follows.
+**                          Files that need RF64 (see riff_needs_rf64()) must have one.
 */
-void riff_init_header(struct RIFF_HEADER *chunk, uint64_t num_data_bytes, bool is_float_format)
+void riff_init_header(struct RIFF_HEADER *chunk, uint64_t num_data_bytes, bool is_float_format, bool has_ds64)
 {
     memset(chunk, 0, sizeof(struct RIFF_HEADER));
 
@@ -22,41 +63,51 @@ void riff_init_header(struct RIFF_HEADER *chunk, uint64_t num_data_bytes, bool i
     ** when viewed in a hex editor. They are therefore byte-swapped here to make it obvious.
     ** All other data is LITTLE-ENDIAN.
     */
-    chunk->ChunkID    = __builtin_bswap32(0x52494646); // "RIFF" - BIG ENDIAN.
     chunk->FormatTag  = __builtin_bswap32(0x57415645); // "WAVE" - BIG ENDIAN.
 
-    /*
-    ** PCM (non-float) formats are simplest and do not use the extended format chunk.
-    ** Floating-point formats must include the extra chunk that describes the float format.
-    */
-    if (!is_float_format) {
-        chunk->ChunkSize = (uint32_t) (
-                           sizeof(chunk->FormatTag)       // ChunkSize doesn't include ChunkID/ChunkSize fields.
-                         + sizeof(struct RIFF_FMT_CHUNK)  // Include the size of the format chunk.
-                         + sizeof(struct RIFF_DATA_CHUNK) // Include the size of the data chunk.
-                         + num_data_bytes);                // Include the total bytes used for sample data.
+    if (num_data_bytes == RIFF_UNBOUNDED_SIZE) {
+        chunk->ChunkID   = __builtin_bswap32(0x52494646); // "RIFF" - BIG ENDIAN.
+        chunk->ChunkSize = RIFF_MAX_CHUNK_SIZE;           // Unknown (endless) length.
+    }
+    else if (!riff_needs_rf64(num_data_bytes, is_float_format)) {
+        chunk->ChunkID   = __builtin_bswap32(0x52494646); // "RIFF" - BIG ENDIAN.
+        chunk->ChunkSize = (uint32_t) riff_chunk_size(num_data_bytes, is_float_format, has_ds64);
     }
     else {
-        chunk->ChunkSize = (uint32_t) (
-                           sizeof(chunk->FormatTag)
-                         + sizeof(struct RIFF_FMT_CHUNK)
-                         + sizeof(struct RIFF_EXT_FMT_CHUNK) // Floating-point files must include this too.
-                         + sizeof(struct RIFF_DATA_CHUNK)
-                         + num_data_bytes);
+        chunk->ChunkID   = __builtin_bswap32(0x52463634); // "RF64" - BIG ENDIAN.
+        chunk->ChunkSize = RIFF_MAX_CHUNK_SIZE;           // The real size is in the ds64 chunk.
     }
 }
 
 /*
-** Write a RIFF header out to file (possibly stdout).
-** Returns true if the data was written successfully.
+** Initialise the RF64 "ds64" chunk, which must immediately follow the RF64 header and holds
+** the 64-bit sizes that do not fit in the other chunks.
+**
+** param  chunk           : A pointer to the struct to initialise.
+** param  num_data_bytes  : The number of audio data BYTES to be appended.
+** param  num_frames      : The number of samples (per channel).
+** param  is_float_format : True if an extended format ("FACT") chuck is included.
 */
-bool riff_write_header(struct RIFF_HEADER *chunk, FILE *file)
+void riff_init_ds64(struct RIFF_DS64_CHUNK *chunk, uint64_t num_data_bytes, uint64_t num_frames, bool is_float_format)
 {
-    if (fwrite(chunk, 1, sizeof(struct RIFF_HEADER), file) != sizeof(struct RIFF_HEADER)) {
-        return false;
-    }
+    chunk->ChunkID     = __builtin_bswap32(0x64733634); // "ds64" - BIG ENDIAN.
+    chunk->ChunkSize   = sizeof(struct RIFF_DS64_CHUNK) - 8U;
+    chunk->RiffSize    = riff_chunk_size(num_data_bytes, is_float_format, true);
+    chunk->DataSize    = num_data_bytes;
+    chunk->SampleCount = num_frames;
+    chunk->TableLength = 0U;
+}
 
-    return true;
+/*
+** Initialise a JUNK chunk the same size as a ds64 chunk, reserving the space for one so that
+** a file whose final length isn't known yet can later be turned into RF64 in place.
+*/
+void riff_init_junk(struct RIFF_DS64_CHUNK *chunk)
+{
+    memset(chunk, 0, sizeof(struct RIFF_DS64_CHUNK));
+
+    chunk->ChunkID   = __builtin_bswap32(0x4A554E4B); // "JUNK" - BIG ENDIAN.
+    chunk->ChunkSize = sizeof(struct RIFF_DS64_CHUNK) - 8U;
 }
 
 /*
@@ -79,42 +130,18 @@ void riff_init_format(struct RIFF_FMT_CHUNK *chunk, uint32_t sample_rate, bool i
     chunk->BitsPerSample = bits_per_sample;
 }
 
-/*
-** Write a RIFF format chunk out to file (possibly stdout).
-** Returns true if the data was written successfully.
-*/
-bool riff_write_format(struct RIFF_FMT_CHUNK *chunk, FILE *file)
-{
-    if (fwrite(chunk, 1, sizeof(struct RIFF_FMT_CHUNK), file) != sizeof(struct RIFF_FMT_CHUNK)) {
-        return false;
-    }
-
-    return true;
-}
-
 /*
 ** Initialise the RIFF extended-format ("FACT") chunk (SubChunk#2).
 **
-** param  chunk : A pointer to the struct to initialise.
+** param  chunk      : A pointer to the struct to initialise.
+** param  num_frames : The number of samples (per channel). If this doesn't fit, the file must be
+**                     RF64 and the real value is in the ds64 chunk.
 */
-void riff_init_fact(struct RIFF_EXT_FMT_CHUNK *chunk, uint32_t num_samples)
+void riff_init_fact(struct RIFF_EXT_FMT_CHUNK *chunk, uint64_t num_frames)
 {
     chunk->ChunkID    = __builtin_bswap32(0x66616374); // "fact" - BIG ENDIAN.
     chunk->ChunkSize  = 4U;                            // Just the NumSamples field.
-    chunk->NumSamples = num_samples;                   // The number of samples (per channel).
-}
-
-/*
-** Write a RIFF extended format chunk out to file (possibly stdout).
-** Returns true if the data was written successfully.
-*/
-bool riff_write_fact(struct RIFF_EXT_FMT_CHUNK *chunk, FILE *file)
-{
-    if (fwrite(chunk, 1, sizeof(struct RIFF_EXT_FMT_CHUNK), file) != sizeof(struct RIFF_EXT_FMT_CHUNK)) {
-        return false;
-    }
-
-    return true;
+    chunk->NumSamples = (num_frames > RIFF_MAX_CHUNK_SIZE) ? RIFF_MAX_CHUNK_SIZE : (uint32_t) num_frames;
 }
 
 /*
@@ -122,22 +149,16 @@ bool riff_write_fact(struct RIFF_EXT_FMT_CHUNK *chunk, FILE *file)
 **
 ** param  chunk          : A pointer to the struct to initialise.
 ** param  num_data_bytes : The number of audio data BYTES to be appended.
+** param  is_rf64        : True for an RF64 file, whose data size is in the ds64 chunk.
+** Either that or an unbounded stream (RIFF_UNBOUNDED_SIZE) has the maximum size.
 */
-void riff_init_data_hdr(struct RIFF_DATA_CHUNK *chunk, uint32_t num_data_bytes)
+void riff_init_data_hdr(struct RIFF_DATA_CHUNK *chunk, uint64_t num_data_bytes, bool is_rf64)
 {
     chunk->ChunkID   = __builtin_bswap32(0x64617461); // "data" - BIG ENDIAN.
-    chunk->ChunkSize = num_data_bytes;
-}
-
-/*
-** Write a RIFF data chunk header (NOT including the data itself) out to file (possibly stdout).
-** Returns true if the data was written successfully.
-*/
-bool riff_write_data_hdr(struct RIFF_DATA_CHUNK *chunk, FILE *file)
-{
-    if (fwrite(chunk, 1, sizeof(struct RIFF_DATA_CHUNK), file) != sizeof(struct RIFF_DATA_CHUNK)) {
-        return false;
+    if (is_rf64 || (num_data_bytes == RIFF_UNBOUNDED_SIZE)) {
+        chunk->ChunkSize = RIFF_MAX_CHUNK_SIZE;
+    }
+    else {
+        chunk->ChunkSize = (uint32_t) num_data_bytes;
     }
-
-    return true;
 }
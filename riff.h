@@ -14,6 +14,24 @@
 #define WAVE_FORMAT_PCM        1U
 #define WAVE_FORMAT_IEEE_FLOAT 3U
 
+/*
+** The largest size a (32-bit) RIFF chunk can declare. Bigger files are written in the RF64
+** format (EBU Tech 3306) instead, where this value means "see the ds64 chunk".
+*/
+#define RIFF_MAX_CHUNK_SIZE    0xFFFFFFFFU
+
+/*
+** Passed as the number of data bytes when the length of the stream isn't known (it is endless).
+** Every size is then written as RIFF_MAX_CHUNK_SIZE, which players take to mean "read until the end".
+*/
+#define RIFF_UNBOUNDED_SIZE    UINT64_MAX
+
+/*
+** Every chunk starts on an even offset, so an odd-sized data chunk is followed by a zero pad
+** byte. The pad isn't counted in the data chunk's own size, but is in the RIFF (and ds64) size.
+*/
+#define RIFF_PAD_BYTES(num_data_bytes) ((num_data_bytes) & 1U)
+
 /*
 ** Structures (the RIFF headers must be packed).
 */
@@ -33,6 +51,16 @@ struct RIFF_HEADER {
     uint32_t FormatTag;     /* "WAVE" (0x57415645) */
 };
 
+#pragma pack(1)
+struct RIFF_DS64_CHUNK {
+    uint32_t ChunkID;       /* "ds64" (0x64733634) */
+    uint32_t ChunkSize;     /* 28 (there are no table entries) */
+    uint64_t RiffSize;      /* The real size of the RF64 chunk */
+    uint64_t DataSize;      /* The real size of the data chunk */
+    uint64_t SampleCount;   /* The real number of samples (per channel) for the fact chunk */
+    uint32_t TableLength;   /* The number of other 64-bit chunk sizes (always 0 for us) */
+};
+
 #pragma pack(1)
 struct RIFF_FMT_CHUNK {
     uint32_t ChunkID;       /* "fmt " (0x666d7420) */
@@ -83,17 +111,18 @@ struct RIFF_WAVE {
 */
 
 /* From riff.c */
-void riff_init_header(struct  RIFF_HEADER *chunk, uint64_t num_data_bytes, bool is_float_format);
-bool riff_write_header(struct RIFF_HEADER *chunk, FILE *file);
+bool riff_needs_rf64(uint64_t num_data_bytes, bool is_float_format);
+
+void riff_init_header(struct  RIFF_HEADER *chunk, uint64_t num_data_bytes, bool is_float_format, bool has_ds64);
+
+void riff_init_ds64(struct RIFF_DS64_CHUNK *chunk, uint64_t num_data_bytes, uint64_t num_frames, bool is_float_format);
+void riff_init_junk(struct RIFF_DS64_CHUNK *chunk);
 
 void riff_init_format(struct RIFF_FMT_CHUNK *chunk, uint32_t sample_rate, bool is_float,
                       uint16_t num_channels, uint16_t bytes_per_sample, uint16_t bits_per_sample);
-bool riff_write_format(struct RIFF_FMT_CHUNK *chunk, FILE *file);
 
-void riff_init_fact(struct  RIFF_EXT_FMT_CHUNK *chunk, uint32_t num_samples);
-bool riff_write_fact(struct RIFF_EXT_FMT_CHUNK *chunk, FILE *file);
+void riff_init_fact(struct  RIFF_EXT_FMT_CHUNK *chunk, uint64_t num_frames);
 
-void riff_init_data_hdr(struct RIFF_DATA_CHUNK *chunk, uint32_t num_data_bytes);
-bool riff_write_data_hdr(struct RIFF_DATA_CHUNK *chunk, FILE *file);
+void riff_init_data_hdr(struct RIFF_DATA_CHUNK *chunk, uint64_t num_data_bytes, bool is_rf64);
 
 #endif
@@ -0,0 +1,443 @@
+/*
+** serve.c
+**
+** Server mode (--serve). wavgen stays running and listens on a UNIX-domain socket. Each client
+** sends one request line, holding options exactly as they would be given on the command-line
+** (e.g. "-t sine -c 2 -d 10s"), and the WAV stream (headers and then sample data) is sent back
+** over the same connection, which is then closed.
+**
+** All the clients are served by a single thread with a poll() event loop. Nothing blocks: the
+** next block of a stream is only generated once the previous one has been sent, so a slow
+** client just holds up its own stream, and memory use is one block per client. Period tables
+** (see wf_cache.c) are kept for the life of the server, so repeated requests reuse them.
+**
+** There is no server on Windows, which has neither poll() nor (in general) UNIX-domain sockets.
+*/
+#include "riff.h"
+#include "wavgen.h"
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_SERVE_CLIENTS  (64U)       // The most clients served at once (more wait to be accepted).
+#define MAX_REQUEST_BYTES  (1024U)     // The longest request line.
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL       (0)         // SIGPIPE is ignored anyway, this just saves the signal.
+#endif
+
+typedef enum {
+    CLIENT_FREE,        // The slot is not in use.
+    CLIENT_READING,     // Waiting for the whole request line.
+    CLIENT_STREAMING    // Sending the WAV stream.
+} CLIENT_STATUS;
+
+/*
+** One connected client and the stream it asked for.
+*/
+struct SERVE_CLIENT {
+    CLIENT_STATUS status;
+    int      fd;
+
+    char     request[MAX_REQUEST_BYTES + 1U];   // The request line (NUL-terminated once complete).
+    size_t   request_used;
+
+    struct FIXED_PARAMS           fixed;
+    struct COMMON_USER_PARAMS     user;
+    struct ADDITIONAL_USER_PARAMS extra;
+    struct WAVEFORM_STATE         state;
+
+    uint64_t num_frames;    // The length of the stream, or UINT64_MAX if it is endless.
+    uint8_t  pad_bytes;     // The pad byte (if any) still to be sent after the last frame.
+    SAMPLE  *samples;       // One block of generated samples.
+    uint8_t *output;        // The headers, and then each packed block, waiting to be sent.
+    size_t   output_used;   // Bytes in the output buffer.
+    size_t   output_sent;   // Bytes of those already sent.
+};
+
+/*
+** Create the listening socket, replacing a stale socket left behind by an earlier server.
+** Returns the socket, or -1 if it could not be created.
+*/
+static int serve_listen(struct FIXED_PARAMS *fixed, const char *path)
+{
+    struct sockaddr_un address;
+    struct stat        info;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        log_info(fixed, "ERROR: The socket path '%s' is too long.\n", path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    /* Only ever remove a socket, never some other file given by mistake.*/
+    if ((stat(path, &info) == 0) && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_info(fixed, "ERROR: Could not create a socket.\n");
+        return -1;
+    }
+
+    if ((bind(fd, (struct sockaddr *) &address, sizeof(struct sockaddr_un)) != 0) ||
+        (listen(fd, SOMAXCONN) != 0)) {
+        log_info(fixed, "ERROR: Could not listen on '%s'.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+/*
+** Disconnect a client and free its slot.
+*/
+static void serve_close(struct SERVE_CLIENT *client)
+{
+    close(client->fd);
+    free(client->samples);
+    free(client->output);
+    generate_free(&client->state);
+
+    memset(client, 0, sizeof(struct SERVE_CLIENT));
+    client->status = CLIENT_FREE;
+    client->fd     = -1;
+}
+
+/*
+** Turn down a request, with a (best-effort) reason in place of the WAV stream.
+*/
+static void serve_reject(struct FIXED_PARAMS *fixed, struct SERVE_CLIENT *client, const char *reason)
+{
+    char message[128];
+    int  length;
+
+    log_extra(fixed, "Request rejected: %s\n", reason);
+
+    /* If this fails there's nothing more to be done, the client is being disconnected anyway.*/
+    length = snprintf(message, sizeof(message), "ERROR: %s\n", reason);
+    send(client->fd, message, (size_t) length, MSG_NOSIGNAL);
+
+    serve_close(client);
+}
+
+/*
+** Parse a complete request line and set up the client's stream, starting with its headers.
+*/
+static void serve_start(struct FIXED_PARAMS *fixed, struct SERVE_CLIENT *client)
+{
+    char    *args[MAX_LINE_ARGS];
+    int      num_args;
+    size_t   block_bytes;
+    uint64_t num_data_bytes;
+
+    log_extra(fixed, "Request: %s\n", client->request);
+
+    num_args = split_args(client->request, args);
+    if (num_args < 0) {
+        serve_reject(fixed, client, "too many options");
+        return;
+    }
+
+    /*
+    ** The stream goes to the client, so the options are parsed as if piping (and nothing is logged).
+    ** The server's own console isn't the client's, so asking for help or the version is an error.
+    */
+    client->fixed.piping   = true;
+    client->fixed.embedded = true;
+    if (parse_opts(num_args, args, &client->fixed, &client->user, &client->extra) != OPTS_OK) {
+        serve_reject(fixed, client, "invalid options (or help or the version, which can't be requested)");
+        return;
+    }
+
+    if (client->user.realtime || (client->user.batch_file != NULL) || (client->user.serve_path != NULL)) {
+        serve_reject(fixed, client, "real-time, batch and server modes can't be requested");
+        return;
+    }
+
+    /* Nothing is written on the server's side, so neither is a sweep's inverse filter.*/
+    if (client->extra.inverse_file != NULL) {
+        serve_reject(fixed, client, "an inverse filter (--inverse) can't be requested");
+        return;
+    }
+
+    /*
+    ** parse_opts() rejects these, but the stream is worked out in frames (dividing by the number of
+    ** channels), and one bad request must never take down every other client's stream.
+    */
+    if ((client->user.num_channels < 1U) || (client->user.num_channels > MAX_CHANNELS) ||
+        (client->user.block_frames < 1U) || (client->user.bytes_per_sample < 1U)) {
+        serve_reject(fixed, client, "invalid channels, block size or sample size");
+        return;
+    }
+
+    block_bytes = (size_t) client->user.block_frames * client->user.num_channels * client->user.bytes_per_sample;
+
+    client->samples = malloc((size_t) client->user.block_frames * client->user.num_channels * sizeof(SAMPLE));
+    client->output  = malloc((block_bytes > MAX_HEADER_BYTES) ? block_bytes : MAX_HEADER_BYTES);
+    if ((client->samples == NULL) || (client->output == NULL)) {
+        serve_reject(fixed, client, "not enough memory");
+        return;
+    }
+
+    if (client->user.unbounded) {
+        client->num_frames = UINT64_MAX;
+        num_data_bytes     = RIFF_UNBOUNDED_SIZE;
+        client->pad_bytes  = 0U;
+    }
+    else {
+        client->num_frames = client->user.num_samples / client->user.num_channels;
+        num_data_bytes     = client->num_frames * client->user.num_channels * client->user.bytes_per_sample;
+        client->pad_bytes  = (uint8_t) RIFF_PAD_BYTES(num_data_bytes);
+    }
+
+    client->output_used = headers_to_buffer(&client->fixed, &client->user, num_data_bytes, false,
+                                            client->output, MAX_HEADER_BYTES);
+    client->output_sent = 0;
+    if (client->output_used == 0) {
+        serve_reject(fixed, client, "could not create the headers");
+        return;
+    }
+
+    generate_init(&client->state);
+    client->status = CLIENT_STREAMING;
+}
+
+/*
+** Read (more of) a client's request line, and start its stream once the line is complete.
+*/
+static void serve_read(struct FIXED_PARAMS *fixed, struct SERVE_CLIENT *client)
+{
+    ssize_t received;
+    char   *end;
+
+    received = recv(client->fd, &client->request[client->request_used],
+                    MAX_REQUEST_BYTES - client->request_used, 0);
+    if (received < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            serve_close(client);
+        }
+        return;
+    }
+
+    /* A client that stops sending (without a newline) has sent all of its request.*/
+    if (received == 0) {
+        if (client->request_used == 0) {
+            serve_close(client);
+        }
+        else {
+            serve_start(fixed, client);
+        }
+        return;
+    }
+
+    client->request_used += (size_t) received;
+    client->request[client->request_used] = '\0';
+
+    end = strpbrk(client->request, "\r\n");
+    if (end != NULL) {
+        *end = '\0';
+        serve_start(fixed, client);
+    }
+    else if (client->request_used == MAX_REQUEST_BYTES) {
+        serve_reject(fixed, client, "request too long");
+    }
+}
+
+/*
+** Send as much of a client's stream as it will take, generating the next block whenever the
+** last has all been sent. The client is disconnected at the end of the stream (after the pad
+** byte that follows an odd-sized data chunk).
+*/
+static void serve_send(struct SERVE_CLIENT *client)
+{
+    struct OUTPUT_WRITER writer;
+    uint32_t block_frames;
+    ssize_t  sent;
+
+    while (true) {
+        if (client->output_sent == client->output_used) {
+            if ((client->state.sample_number >= client->num_frames) && (client->pad_bytes == 0U)) {
+                serve_close(client);
+                return;
+            }
+
+            if (client->state.sample_number >= client->num_frames) {
+                client->output[0]   = 0U;
+                client->output_used = client->pad_bytes;
+                client->output_sent = 0;
+                client->pad_bytes   = 0U;
+                continue;
+            }
+
+            block_frames = client->user.block_frames;
+            if ((client->num_frames - client->state.sample_number) < block_frames) {
+                block_frames = (uint32_t) (client->num_frames - client->state.sample_number);
+            }
+
+            writer_init_mapped(&writer, client->output,
+                               (size_t) block_frames * client->user.num_channels * client->user.bytes_per_sample);
+
+            generate_block(&client->state, &client->user, &client->extra, client->samples, block_frames);
+            if (!finalise_block(&client->fixed, &client->user, &client->extra, &client->state, client->samples, block_frames, &writer)) {
+                serve_close(client);
+                return;
+            }
+
+            client->output_used = writer.used;
+            client->output_sent = 0;
+        }
+
+        sent = send(client->fd, client->output + client->output_sent,
+                    client->output_used - client->output_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                serve_close(client);    // The client has gone.
+            }
+            return;
+        }
+
+        client->output_sent += (size_t) sent;
+    }
+}
+
+/*
+** Serve WAV streams on the UNIX-domain socket given by --serve, until stopped by a signal.
+** Returns false if the server could not be started.
+*/
+bool run_server(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user)
+{
+    struct SERVE_CLIENT *clients;
+    struct pollfd        fds[MAX_SERVE_CLIENTS + 1U];
+    struct SERVE_CLIENT *polled[MAX_SERVE_CLIENTS + 1U];
+    nfds_t   num_fds;
+    nfds_t   index;
+    uint32_t slot;
+    uint32_t num_clients;
+    int      listener;
+    int      fd;
+
+    clients = calloc(MAX_SERVE_CLIENTS, sizeof(struct SERVE_CLIENT));
+    if (clients == NULL) {
+        log_info(fixed, "ERROR: Not enough memory for the server.\n");
+        return false;
+    }
+
+    listener = serve_listen(fixed, user->serve_path);
+    if (listener < 0) {
+        free(clients);
+        return false;
+    }
+
+    for (slot = 0; slot < MAX_SERVE_CLIENTS; ++slot) {
+        clients[slot].status = CLIENT_FREE;
+        clients[slot].fd     = -1;
+    }
+
+    /* Serve until asked to stop. A client going away is found from the failed send().*/
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT,  writer_request_stop);
+    signal(SIGTERM, writer_request_stop);
+
+    log_info(fixed, "Serving on '%s'\n", user->serve_path);
+
+    while (!writer_stop_requested()) {
+        /* Only accept new clients while there's a free slot for them.*/
+        num_fds     = 0;
+        num_clients = 0;
+        for (slot = 0; slot < MAX_SERVE_CLIENTS; ++slot) {
+            if (clients[slot].status != CLIENT_FREE) {
+                fds[num_fds].fd      = clients[slot].fd;
+                fds[num_fds].events  = (clients[slot].status == CLIENT_READING) ? POLLIN : POLLOUT;
+                fds[num_fds].revents = 0;
+                polled[num_fds++]    = &clients[slot];
+                ++num_clients;
+            }
+        }
+        if (num_clients < MAX_SERVE_CLIENTS) {
+            fds[num_fds].fd      = listener;
+            fds[num_fds].events  = POLLIN;
+            fds[num_fds].revents = 0;
+            polled[num_fds++]    = NULL;
+        }
+
+        if (poll(fds, num_fds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_info(fixed, "ERROR: poll() failed.\n");
+            break;
+        }
+
+        for (index = 0; index < num_fds; ++index) {
+            if (fds[index].revents == 0) {
+                continue;
+            }
+
+            if (polled[index] == NULL) {
+                /* A new client: give it the first free slot.*/
+                fd = accept(listener, NULL, NULL);
+                if (fd < 0) {
+                    continue;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+                for (slot = 0; clients[slot].status != CLIENT_FREE; ++slot) {
+                }
+                clients[slot].status = CLIENT_READING;
+                clients[slot].fd     = fd;
+                log_extra(fixed, "Client connected.\n");
+            }
+            else if (polled[index]->status == CLIENT_READING) {
+                serve_read(fixed, polled[index]);
+            }
+            else {
+                serve_send(polled[index]);
+            }
+        }
+    }
+
+    log_info(fixed, "Server stopped.\n");
+
+    for (slot = 0; slot < MAX_SERVE_CLIENTS; ++slot) {
+        if (clients[slot].status != CLIENT_FREE) {
+            serve_close(&clients[slot]);
+        }
+    }
+    free(clients);
+
+    close(listener);
+    unlink(user->serve_path);
+
+    return true;
+}
+#else
+/*
+** Windows: --serve is accepted (so that the options are the same everywhere) but always fails.
+*/
+bool run_server(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user)
+{
+    (void) user;
+
+    log_info(fixed, "ERROR: --serve is not supported on Windows.\n");
+
+    return false;
+}
+#endif
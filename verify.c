@@ -0,0 +1,769 @@
+/*
+** verify.c
+**
+** Verify mode ("wavgen verify"). Reads back a captured counter (or marked silence) stream, as a
+** WAV file or raw sample data, from a file or stdin, and checks that it arrived intact: that the
+** counter goes up by one every frame (see generate_counter()) and that every sample carries its
+** own channel's marker (see add_markers()). Anything else is reported as an event, at the frame
+** where it happened: frames dropped, repeated or jumped back to, channels swapped or rotated
+** (e.g. an interleaving slip), channels out of step with each other, or corrupt markers.
+**
+** The input is read in large blocks and each frame is compared with the one expected next, with
+** a single mask and compare per sample, so a long capture is checked at the speed it can be read.
+** Only a frame that doesn't match is looked at more closely, to work out what went wrong. Events
+** are reported as soon as they are found, so a live capture can be piped straight in. Faults that
+** carry on (e.g. swapped channels) are reported when they start and when they stop, not per frame.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include "riff.h"
+#include "wavgen.h"
+
+#if !defined(O_BINARY)
+#define O_BINARY            (0)         // Only Windows distinguishes text and binary files.
+#endif
+
+#define VERIFY_READ_BYTES   (1048576U)  // Bytes read from the input at a time.
+#define VERIFY_CHUNK_FRAMES (1024U)     // Frames unpacked and checked at a time (kept on the stack).
+#define VERIFY_NOT_MARKER   (-1)        // In a marker map: the sample's marker is not any channel's.
+
+/*
+** The input: a file (or stdin) and what has been read from it but not yet checked.
+*/
+struct VERIFY_INPUT {
+    int      fd;
+    uint8_t *buffer;
+    size_t   start;         // The next byte to be used.
+    size_t   end;           // The end of the bytes read.
+    bool     at_end;        // True once the end of the input has been reached.
+};
+
+/*
+** What is expected of the stream, and what has been found in it so far.
+*/
+struct VERIFY_STATE {
+    /* The stream's format and contents.*/
+    uint16_t num_channels;
+    uint8_t  bytes_per_sample;
+    uint32_t sample_rate;
+    bool     check_counter;         // False for silence (only the markers are checked).
+    bool     check_markers;
+    unsigned marker_shift;          // Where the marker is in a (32-bit) sample.
+    unsigned counter_shift;         // Where the counter is in a sample.
+    uint32_t counter_mask;          // The counter's bits (after shifting down), as it wraps around.
+    uint32_t check_mask;            // The bits of every sample that are checked.
+    uint32_t markers[MAX_CHANNELS]; // Each channel's marker, in place.
+
+    /* Where the stream has got to.*/
+    uint64_t frame;                 // The number of frames checked (i.e. the next frame's position).
+    uint32_t count;                 // The counter value expected in the next frame.
+    bool     started;               // False until the first frame has set the counter.
+    bool     markers_wrong;         // The last frame's markers were wrong...
+    int8_t   marker_map[MAX_CHANNELS];  // ...with each channel's marker (the channel it came from).
+    bool     out_of_step;           // The last frame's channels didn't all have the same count.
+    uint64_t repeat_frame;          // The first frame of a run of repeated frames (not yet reported)...
+    uint64_t repeat_frames;         // ...how many there are in the run...
+    uint32_t repeat_count;          // ...and the counter value repeated.
+
+    /* What has been found.*/
+    uint64_t events;
+    uint64_t max_events;            // The number of events reported (the rest are just counted).
+    uint64_t drops;
+    uint64_t dropped_frames;
+    uint64_t repeats;
+    uint64_t repeated_frames;
+    uint64_t jumps;
+    uint64_t jumped_frames;
+    uint64_t marker_faults;
+    uint64_t marker_frames;
+    uint64_t step_faults;
+    uint64_t step_frames;
+};
+
+static void verify_flush(struct VERIFY_STATE *state);
+
+/*
+** Report an event at a frame (unless enough have been reported already), after any run of
+** repeated frames before it.
+*/
+__attribute__((__format__ (__printf__, 3, 4)))
+static void verify_event(struct VERIFY_STATE *state, uint64_t frame, const char *format, ...)
+{
+    va_list args;
+
+    verify_flush(state);
+
+    if (++state->events > state->max_events) {
+        if (state->events == (state->max_events + 1U)) {
+            printf("(Further events are counted but not shown.)\n");
+        }
+        return;
+    }
+
+    printf("Frame %" PRIu64 " (%.6fs): ", frame, (double) frame / (double) state->sample_rate);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    fflush(stdout);
+}
+
+/*
+** Report a run of repeated frames, if there is one waiting to be reported.
+*/
+static void verify_flush(struct VERIFY_STATE *state)
+{
+    uint64_t repeat_frames = state->repeat_frames;
+
+    if (repeat_frames > 0U) {
+        state->repeat_frames = 0U;
+        verify_event(state, state->repeat_frame, "frame repeated %" PRIu64 " time%s (counter 0x%X)",
+                     repeat_frames, (repeat_frames == 1U) ? "" : "s", state->repeat_count);
+    }
+}
+
+/*
+** Make sure at least the number of bytes wanted (and as many more as are ready) have been read.
+** Returns false if the input ended (or failed) first.
+*/
+static bool verify_fill(struct VERIFY_INPUT *input, size_t wanted)
+{
+    ssize_t num_read;
+
+    if ((input->end - input->start) >= wanted) {
+        return true;
+    }
+
+    /* Move what's left to the front, to make room for the rest.*/
+    memmove(input->buffer, &input->buffer[input->start], input->end - input->start);
+    input->end  -= input->start;
+    input->start = 0;
+
+    while (!input->at_end && (input->end < wanted)) {
+        num_read = read(input->fd, &input->buffer[input->end], VERIFY_READ_BYTES - input->end);
+        if (num_read > 0) {
+            input->end += (size_t) num_read;
+        }
+        else if ((num_read < 0) && (errno == EINTR)) {
+            continue;
+        }
+        else {
+            input->at_end = true;
+        }
+    }
+
+    return (input->end - input->start) >= wanted;
+}
+
+/*
+** Skip over bytes of the input (e.g. chunks of a WAV file that aren't needed).
+** Returns false if the input ended first.
+*/
+static bool verify_skip(struct VERIFY_INPUT *input, uint64_t num_bytes)
+{
+    size_t skip;
+
+    while (num_bytes > 0U) {
+        if (!verify_fill(input, 1U)) {
+            return false;
+        }
+        skip = input->end - input->start;
+        skip = (num_bytes < skip) ? (size_t) num_bytes : skip;
+
+        input->start += skip;
+        num_bytes    -= skip;
+    }
+
+    return true;
+}
+
+/*
+** Read a WAV (RIFF or RF64) file's headers, up to the start of its sample data, taking the format
+** from them. The data's size is set to UINT64_MAX if it isn't known (i.e. the stream was endless).
+** Returns false if the headers are not valid, or the format can't be verified.
+*/
+static bool verify_header(struct FIXED_PARAMS *fixed, struct VERIFY_INPUT *input,
+                          struct VERIFY_STATE *state, uint64_t *data_bytes)
+{
+    struct RIFF_HEADER     header;
+    struct RIFF_DS64_CHUNK ds64;
+    struct RIFF_FMT_CHUNK  fmt;
+    struct RIFF_DATA_CHUNK chunk;
+    uint64_t ds64_data_bytes = UINT64_MAX;
+    uint16_t audio_format;
+    bool     have_fmt = false;
+    bool     is_rf64;
+
+    memcpy(&header, &input->buffer[input->start], sizeof(header));
+    input->start += sizeof(header);
+    is_rf64 = (header.ChunkID == __builtin_bswap32(0x52463634));    // "RF64"
+
+    if (header.FormatTag != __builtin_bswap32(0x57415645)) {        // "WAVE"
+        log_info(fixed, "ERROR: Not a WAV file (no 'WAVE' format).\n");
+        return false;
+    }
+
+    for (;;) {
+        if (!verify_fill(input, sizeof(chunk))) {
+            log_info(fixed, "ERROR: The WAV file has no sample data.\n");
+            return false;
+        }
+        memcpy(&chunk, &input->buffer[input->start], sizeof(chunk));
+
+        if (chunk.ChunkID == __builtin_bswap32(0x64617461)) {       // "data"
+            input->start += sizeof(chunk);
+            if (is_rf64 && (chunk.ChunkSize == RIFF_MAX_CHUNK_SIZE)) {
+                *data_bytes = ds64_data_bytes;
+            }
+            else {
+                *data_bytes = (chunk.ChunkSize == RIFF_MAX_CHUNK_SIZE) ? UINT64_MAX : chunk.ChunkSize;
+            }
+            break;
+        }
+        else if ((chunk.ChunkID == __builtin_bswap32(0x666d7420)) && (chunk.ChunkSize >= 16U)) {   // "fmt "
+            if (!verify_fill(input, sizeof(chunk) + chunk.ChunkSize)) {
+                break;
+            }
+            memcpy(&fmt, &input->buffer[input->start], sizeof(fmt));
+            audio_format = fmt.AudioFormat;
+
+            /* WAVE_FORMAT_EXTENSIBLE has the real format at the start of its sub-format GUID.*/
+            if ((audio_format == 0xFFFEU) && (chunk.ChunkSize >= 26U)) {
+                memcpy(&audio_format, &input->buffer[input->start + sizeof(chunk) + 24U], sizeof(audio_format));
+            }
+            if (audio_format != WAVE_FORMAT_PCM) {
+                log_info(fixed, "ERROR: Only integer (PCM) samples can be verified.\n");
+                return false;
+            }
+
+            state->num_channels     = fmt.NumChannels;
+            state->sample_rate      = fmt.SampleRate;
+            state->bytes_per_sample = (uint8_t) (fmt.BitsPerSample / 8U);
+            have_fmt = true;
+        }
+        else if ((chunk.ChunkID == __builtin_bswap32(0x64733634)) && (chunk.ChunkSize >= 16U)) {   // "ds64"
+            if (!verify_fill(input, sizeof(ds64))) {
+                break;
+            }
+            memcpy(&ds64, &input->buffer[input->start], sizeof(ds64));
+            ds64_data_bytes = ds64.DataSize;
+        }
+
+        /* Chunks are padded to an even size.*/
+        if (!verify_skip(input, sizeof(chunk) + (uint64_t) chunk.ChunkSize + (chunk.ChunkSize & 1U))) {
+            break;
+        }
+    }
+
+    if (!have_fmt) {
+        log_info(fixed, "ERROR: The WAV file has no (valid) format chunk.\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+** Work out what is expected of every sample, from the stream's format and the waveform it
+** should hold. The layout is the same as generate_counter() and add_markers() make it, after the
+** samples have been packed (the narrower formats keep the upper bytes of each 32-bit sample).
+** Returns false if the format is not one that wavgen writes.
+*/
+static bool verify_layout(struct FIXED_PARAMS *fixed, struct VERIFY_STATE *state, bool markers_on, bool markers_in_msb)
+{
+    unsigned counter_bits;
+    uint16_t chnl;
+
+    if ((state->num_channels < 1U) || (state->num_channels > MAX_CHANNELS) ||
+        (state->bytes_per_sample < BYTES_8BIT) || (state->bytes_per_sample > BYTES_32BIT)) {
+        log_info(fixed, "ERROR: Only 1 to %u channels of 8, 16, 24 or 32-bit samples can be verified.\n", MAX_CHANNELS);
+        return false;
+    }
+    if (state->sample_rate < 1U) {
+        state->sample_rate = 1U;
+    }
+
+    /* Markers in the LSB of a 32-bit sample are lost when it is packed any narrower.*/
+    state->check_markers = markers_on && (markers_in_msb || (state->bytes_per_sample == BYTES_32BIT));
+    if (markers_on && !state->check_markers) {
+        log_info(fixed, "WARNING: Markers in the LSB don't survive packing to %u-bit, so they aren't checked.\n",
+                 8U * state->bytes_per_sample);
+    }
+
+    state->marker_shift  = markers_in_msb ? 24U : 0U;
+    state->counter_shift = ((markers_on && !markers_in_msb) ? 8U : 0U) + (32U - (8U * state->bytes_per_sample));
+    counter_bits         = 32U - state->counter_shift - ((markers_on && markers_in_msb) ? 8U : 0U);
+    state->counter_mask  = (counter_bits >= 32U) ? UINT32_MAX : ((1U << counter_bits) - 1U);
+
+    if (state->check_counter && (counter_bits == 0U)) {
+        log_info(fixed, "WARNING: No counter bits are left beside the markers, so only the markers are checked.\n");
+        state->check_counter = false;
+    }
+
+    if (!state->check_counter && !state->check_markers) {
+        log_info(fixed, "ERROR: Nothing is left to check in this format.\n");
+        return false;
+    }
+
+    state->check_mask = (state->check_counter ? (state->counter_mask << state->counter_shift) : 0U) |
+                        (state->check_markers ? (0xFFU << state->marker_shift) : 0U);
+
+    for (chnl = 0; chnl < state->num_channels; ++chnl) {
+        state->markers[chnl] = state->check_markers ? ((0xC0U + chnl + 1U) << state->marker_shift) : 0U;
+    }
+
+    return true;
+}
+
+/*
+** Unpack a run of samples to 32-bit, with each sample's bytes in the upper bytes as they were
+** when generated (so the counter and markers are where the generator put them).
+*/
+static void verify_unpack(const uint8_t *bytes, uint32_t *samples, size_t num_samples, uint8_t bytes_per_sample)
+{
+    size_t index;
+
+    switch (bytes_per_sample) {
+    case BYTES_32BIT:
+        memcpy(samples, bytes, num_samples * sizeof(uint32_t));
+        break;
+
+    case BYTES_24BIT:
+        for (index = 0; index < num_samples; ++index) {
+            samples[index] = ((uint32_t) bytes[0] << 8) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 24);
+            bytes += 3;
+        }
+        break;
+
+    case BYTES_16BIT:
+        for (index = 0; index < num_samples; ++index) {
+            samples[index] = ((uint32_t) bytes[0] << 16) | ((uint32_t) bytes[1] << 24);
+            bytes += 2;
+        }
+        break;
+
+    default:
+        /* 8-bit samples are unsigned (see pack_u8()).*/
+        for (index = 0; index < num_samples; ++index) {
+            samples[index] = (uint32_t) (bytes[index] ^ 0x80U) << 24;
+        }
+        break;
+    }
+}
+
+/*
+** Check a frame's markers, reporting any change in which channels they belong to.
+*/
+static void verify_markers(struct VERIFY_STATE *state, const uint32_t *frame)
+{
+    int8_t   map[MAX_CHANNELS];
+    uint16_t num_channels = state->num_channels;
+    uint16_t chnl;
+    uint16_t rotation;
+    uint32_t marker;
+    bool     wrong = false;
+    bool     rotated;
+
+    for (chnl = 0; chnl < num_channels; ++chnl) {
+        marker    = (frame[chnl] >> state->marker_shift) & 0xFFU;
+        map[chnl] = ((marker > 0xC0U) && (marker <= (0xC0U + num_channels))) ? (int8_t) (marker - 0xC1U) : VERIFY_NOT_MARKER;
+        wrong    |= (map[chnl] != (int8_t) chnl);
+    }
+
+    if (wrong) {
+        ++state->marker_frames;
+    }
+
+    /* Only changes are reported, so that a lasting fault is one event.*/
+    if ((wrong == state->markers_wrong) && (!wrong || (memcmp(map, state->marker_map, num_channels) == 0))) {
+        return;
+    }
+    state->markers_wrong = wrong;
+    memcpy(state->marker_map, map, num_channels);
+
+    if (!wrong) {
+        verify_event(state, state->frame, "channel markers are correct again");
+        return;
+    }
+    ++state->marker_faults;
+
+    /* All of the channels moved along by the same amount is a slip in the interleaving.*/
+    rotation = (map[0] == VERIFY_NOT_MARKER) ? 0U : (uint16_t) map[0];
+    rotated  = (rotation != 0U);
+    for (chnl = 0; rotated && (chnl < num_channels); ++chnl) {
+        rotated = (map[chnl] == (int8_t) ((chnl + rotation) % num_channels));
+    }
+    if (rotated) {
+        verify_event(state, state->frame, "channels rotated by %u (channel 1 has channel %u's data)",
+                     rotation, rotation + 1U);
+        return;
+    }
+
+    for (chnl = 0; chnl < num_channels; ++chnl) {
+        if (map[chnl] == VERIFY_NOT_MARKER) {
+            verify_event(state, state->frame, "channel %u (sample %" PRIu64 ") has no marker (0x%02X)", chnl + 1U,
+                         (state->frame * num_channels) + chnl, (frame[chnl] >> state->marker_shift) & 0xFFU);
+        }
+        else if (map[chnl] != (int8_t) chnl) {
+            verify_event(state, state->frame, "channel %u has channel %u's data%s", chnl + 1U, map[chnl] + 1U,
+                         (map[(uint16_t) map[chnl]] == (int8_t) chnl) ? " (swapped)" : "");
+        }
+    }
+}
+
+/*
+** Check a frame's counter against the one expected, reporting frames dropped, repeated or jumped
+** back to (and channels whose counter is out of step with the first channel's).
+*/
+static void verify_counter(struct VERIFY_STATE *state, const uint32_t *frame)
+{
+    uint32_t mask  = state->counter_mask;
+    uint32_t count = (frame[0] >> state->counter_shift) & mask;
+    uint32_t ahead = (count - state->count) & mask;
+    uint32_t other;
+    uint16_t chnl;
+    bool     out_of_step = false;
+
+    for (chnl = 1; chnl < state->num_channels; ++chnl) {
+        other = (frame[chnl] >> state->counter_shift) & mask;
+        if ((other != count) && !out_of_step) {
+            out_of_step = true;
+            if (!state->out_of_step) {
+                ++state->step_faults;
+                verify_event(state, state->frame, "channel %u is out of step (counter 0x%X, channel 1 has 0x%X)",
+                             chnl + 1U, other, count);
+            }
+        }
+    }
+    if (out_of_step) {
+        ++state->step_frames;
+    }
+    else if (state->out_of_step) {
+        verify_event(state, state->frame, "channels are back in step");
+    }
+    state->out_of_step = out_of_step;
+
+    /* The very first frame just sets the counter, as a capture can start anywhere.*/
+    if (!state->started) {
+        state->started = true;
+        state->count   = (count + 1U) & mask;
+        return;
+    }
+
+    if (ahead == 0U) {
+        verify_flush(state);
+    }
+    else if (ahead == mask) {
+        /* The same frame again (repeats are gathered up to be reported as one event).*/
+        if (state->repeat_frames == 0U) {
+            state->repeat_frame = state->frame;
+            state->repeat_count = count;
+            ++state->repeats;
+        }
+        ++state->repeat_frames;
+        ++state->repeated_frames;
+    }
+    else if (ahead <= (mask >> 1)) {
+        ++state->drops;
+        state->dropped_frames += ahead;
+        verify_event(state, state->frame, "%u frame%s dropped (counter 0x%X, expected 0x%X)",
+                     ahead, (ahead == 1U) ? "" : "s", count, state->count);
+    }
+    else {
+        ++state->jumps;
+        state->jumped_frames += (uint32_t) (state->count - count) & mask;
+        verify_event(state, state->frame, "jumped back %u frames (counter 0x%X, expected 0x%X)",
+                     (state->count - count) & mask, count, state->count);
+    }
+
+    state->count = (count + 1U) & mask;
+}
+
+/*
+** Check a run of (unpacked) frames. Each frame is first compared as a whole with the frame
+** expected next, and only one that doesn't match is looked at sample by sample.
+*/
+static void verify_frames(struct VERIFY_STATE *state, const uint32_t *samples, uint32_t num_frames)
+{
+    uint16_t num_channels = state->num_channels;
+    uint32_t check_mask   = state->check_mask;
+    uint32_t expected;
+    uint32_t diff;
+    uint32_t frame;
+    uint16_t chnl;
+
+    for (frame = 0; frame < num_frames; ++frame) {
+        expected = state->check_counter ? (state->count << state->counter_shift) : 0U;
+        diff     = state->started ? 0U : 1U;
+
+        for (chnl = 0; chnl < num_channels; ++chnl) {
+            diff |= (samples[chnl] ^ (expected | state->markers[chnl])) & check_mask;
+        }
+
+        if (diff == 0U) {
+            /* As expected, but it may be the end of a fault.*/
+            if (state->repeat_frames > 0U) {
+                verify_flush(state);
+            }
+            if (state->markers_wrong) {
+                verify_markers(state, samples);
+            }
+            if (state->out_of_step) {
+                state->out_of_step = false;
+                verify_event(state, state->frame, "channels are back in step");
+            }
+            state->count = (state->count + 1U) & state->counter_mask;
+        }
+        else {
+            if (state->check_markers) {
+                verify_markers(state, samples);
+            }
+            if (state->check_counter) {
+                verify_counter(state, samples);
+            }
+            state->started = true;
+        }
+
+        samples += num_channels;
+        ++state->frame;
+    }
+}
+
+/*
+** Check the sample data, a chunk of frames at a time, as it is read.
+** Returns the number of bytes left over at the end that don't make up a whole frame.
+*/
+static size_t verify_data(struct VERIFY_INPUT *input, struct VERIFY_STATE *state, uint64_t data_bytes)
+{
+    uint32_t samples[VERIFY_CHUNK_FRAMES * MAX_CHANNELS];
+    size_t   frame_bytes = (size_t) state->num_channels * state->bytes_per_sample;
+    uint64_t available;
+    uint64_t num_frames;
+    uint32_t frames;
+
+    while ((data_bytes >= frame_bytes) && verify_fill(input, frame_bytes)) {
+        available  = input->end - input->start;
+        available  = (available < data_bytes) ? available : data_bytes;
+        num_frames = available / frame_bytes;
+
+        for (; num_frames > 0U; num_frames -= frames) {
+            frames = (num_frames < VERIFY_CHUNK_FRAMES) ? (uint32_t) num_frames : VERIFY_CHUNK_FRAMES;
+
+            verify_unpack(&input->buffer[input->start], samples, (size_t) frames * state->num_channels, state->bytes_per_sample);
+            verify_frames(state, samples, frames);
+
+            input->start += frames * frame_bytes;
+            if (data_bytes != UINT64_MAX) {
+                data_bytes -= frames * frame_bytes;
+            }
+        }
+
+        /* Anything found is reported before waiting for more (e.g. from a live capture).*/
+        verify_flush(state);
+    }
+
+    if (data_bytes == UINT64_MAX) {
+        return input->end - input->start;
+    }
+    available = input->end - input->start;
+    return (available < data_bytes) ? available : (size_t) data_bytes;
+}
+
+/*
+** Print one kind of fault found (if there were any of them).
+*/
+static void verify_tally(const char *name, uint64_t num_frames, uint64_t num_places)
+{
+    if (num_places > 0U) {
+        printf("  %-15s %" PRIu64 " frame%s, in %" PRIu64 " place%s\n", name, num_frames, (num_frames == 1U) ? "" : "s",
+               num_places, (num_places == 1U) ? "" : "s");
+    }
+}
+
+/*
+** Print what was found, returning true if the stream was intact.
+*/
+static bool verify_summary(struct VERIFY_STATE *state, size_t partial_bytes)
+{
+    printf("Checked %" PRIu64 " frames (%.3fs) of %u channel%s at %u-bit, for %s%s.\n",
+           state->frame, (double) state->frame / (double) state->sample_rate,
+           state->num_channels, (state->num_channels == 1U) ? "" : "s", 8U * state->bytes_per_sample,
+           state->check_counter ? "counter continuity" : "",
+           state->check_markers ? (state->check_counter ? " and channel markers" : "channel markers") :
+                                  (state->check_counter ? "" : "nothing"));
+
+    verify_tally("Dropped:",       state->dropped_frames,  state->drops);
+    verify_tally("Repeated:",      state->repeated_frames, state->repeats);
+    verify_tally("Jumped back:",   state->jumped_frames,   state->jumps);
+    verify_tally("Wrong markers:", state->marker_frames,   state->marker_faults);
+    verify_tally("Out of step:",   state->step_frames,     state->step_faults);
+    if (partial_bytes > 0U) {
+        printf("  The stream ends part-way through a frame (%zu bytes left over).\n", partial_bytes);
+    }
+
+    if (state->frame == 0U) {
+        printf("  No complete frames were found.\n");
+    }
+
+    if ((state->frame > 0U) && (state->drops + state->repeats + state->jumps + state->marker_faults + state->step_faults) == 0U) {
+        printf("PASSED\n");
+        return true;
+    }
+
+    printf("FAILED\n");
+    return false;
+}
+
+/*
+** Verify a captured stream: "wavgen verify [options] [file]". The file is read from stdin if it
+** isn't given (or is "-"). A WAV file's format is taken from its headers, and raw sample data
+** is taken to be in the format given by the options (the same as wavgen's own).
+** Returns true if the stream was read and found to be intact.
+*/
+bool run_verify(int argc, char *argv[])
+{
+    struct FIXED_PARAMS  fixed;
+    struct VERIFY_INPUT  input;
+    struct VERIFY_STATE  state;
+    uint64_t data_bytes = UINT64_MAX;
+    size_t   partial_bytes;
+    unsigned value;
+    int      opt;
+    bool     markers_on     = false;
+    bool     markers_in_msb = false;
+    bool     success;
+
+    static const char short_opts[] = "hvb:c:e:m:r:t:";
+    static struct option long_opts[] = {
+       {"bitdepth",     required_argument, 0, 'b' },
+       {"channels",     required_argument, 0, 'c' },
+       {"events",       required_argument, 0, 'e' },
+       {"help",         no_argument,       0, 'h' },
+       {"markers",      required_argument, 0, 'm' },
+       {"rate",         required_argument, 0, 'r' },
+       {"type",         required_argument, 0, 't' },
+       {"verbose",      no_argument,       0, 'v' },
+       {0,              0,                 0,  0  }
+    };
+
+    memset(&fixed, 0, sizeof(fixed));
+    memset(&state, 0, sizeof(state));
+    fixed.piping = false;   // The report always goes to stdout (the input may be stdin).
+
+    state.num_channels     = 1U;
+    state.bytes_per_sample = BYTES_32BIT;
+    state.sample_rate      = 48000U;
+    state.check_counter    = true;
+    state.max_events       = VERIFY_MAX_EVENTS;
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            value = (unsigned) atoi(optarg);
+            state.bytes_per_sample = (uint8_t) (value / 8U);
+            if ((value % 8U) != 0U) {
+                state.bytes_per_sample = BYTES_NONE;
+            }
+            break;
+
+        case 'c':
+            state.num_channels = (uint16_t) atoi(optarg);
+            break;
+
+        case 'e':
+            sscanf(optarg, "%" SCNu64, &state.max_events);
+            break;
+
+        case 'm':
+            markers_on     = (strcmp(optarg, "none") != 0);
+            markers_in_msb = (strcmp(optarg, "msb") == 0);
+            if (markers_on && !markers_in_msb && (strcmp(optarg, "lsb") != 0)) {
+                log_info(&fixed, "Markers must be 'lsb', 'msb' or 'none'.\n");
+                return false;
+            }
+            break;
+
+        case 'r':
+            state.sample_rate = (uint32_t) atoi(optarg);
+            break;
+
+        case 't':
+            if ((strcmp(optarg, "count") == 0) || (strcmp(optarg, "counter") == 0)) {
+                state.check_counter = true;
+            }
+            else if (strcmp(optarg, "silence") == 0) {
+                state.check_counter = false;
+            }
+            else {
+                log_info(&fixed, "Only a 'counter' or (marked) 'silence' stream can be verified.\n");
+                return false;
+            }
+            break;
+
+        case 'v':
+            fixed.verbose = true;
+            break;
+
+        case 'h':
+            help_verify();
+            return true;
+
+        default:
+            help_verify();
+            return false;
+        }
+    }
+
+    if (!state.check_counter && !markers_on) {
+        log_info(&fixed, "Silence can only be verified by its markers (-m).\n");
+        return false;
+    }
+
+    if ((optind < argc) && (strcmp(argv[optind], "-") != 0)) {
+        input.fd = open(argv[optind], O_RDONLY | O_BINARY);
+        if (input.fd < 0) {
+            log_info(&fixed, "ERROR: Could not open '%s'\n", argv[optind]);
+            return false;
+        }
+#if defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(input.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+    else {
+        input.fd = STDIN_FILENO;
+    }
+
+    input.buffer = malloc(VERIFY_READ_BYTES);
+    input.start  = 0;
+    input.end    = 0;
+    input.at_end = false;
+    success      = (input.buffer != NULL);
+
+    /* A WAV file is recognised by its header, and anything else is raw sample data.*/
+    if (success && verify_fill(&input, sizeof(struct RIFF_HEADER)) &&
+        ((memcmp(input.buffer, "RIFF", 4) == 0) || (memcmp(input.buffer, "RF64", 4) == 0))) {
+        success = verify_header(&fixed, &input, &state, &data_bytes);
+    }
+
+    if (success) {
+        success = verify_layout(&fixed, &state, markers_on, markers_in_msb);
+    }
+
+    if (success) {
+        log_extra(&fixed, "Verifying %u channel%s of %u-bit samples at %uHz\n", state.num_channels,
+                  (state.num_channels == 1U) ? "" : "s", 8U * state.bytes_per_sample, state.sample_rate);
+
+        partial_bytes = verify_data(&input, &state, data_bytes);
+        success       = verify_summary(&state, partial_bytes);
+    }
+
+    if (input.fd != STDIN_FILENO) {
+        close(input.fd);
+    }
+    free(input.buffer);
+
+    return success;
+}
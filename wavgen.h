@@ -7,6 +7,7 @@
 #define wavgen_h
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -22,11 +23,21 @@ static const char version_str[] = "0.0.5";
 */
 #define MAX_SAMPLE_RATE_HZ   (192000U)                              // 192kHz.
 #define MAX_DURATION_MS      (60U * 60U * 1000U)                    // 60 minutes maximum FILE duration.
-#define MAX_SAMPLES_PER_CHNL (MAX_DURATION_MS * MAX_SAMPLE_RATE_HZ) // 60 minutes at 192kHz for FILE o/p.
+#define MAX_SAMPLES_PER_CHNL ((uint64_t) MAX_DURATION_MS * MAX_SAMPLE_RATE_HZ / 1000U) // 60 minutes at 192kHz for FILE o/p.
 #define MAX_CHANNELS         (8U)                                   // 8 channels maximum.
 
 #define MAX_LEVEL_32BIT      (0x7FFFFFFF)
 
+#define DEFAULT_BLOCK_FRAMES (4096U)                               // Frames generated (and written) per block.
+#define MAX_BLOCK_FRAMES     (1048576U)                             // Upper limit for the --blocksize option.
+#define OUTPUT_ALIGNMENT     (4096U)                                // Alignment of the output staging buffer.
+#define MAX_THREADS          (64U)                                  // Upper limit for the --threads option.
+#define MAX_LINE_ARGS        (64)                                   // Most arguments on one line of options (e.g. --batch).
+#define MAX_HEADER_BYTES     (128U)                                 // Room for the largest set of RIFF/RF64 headers.
+#define PINK_VOSS_ROWS       (16U)                                  // Voss-McCartney pink noise rows (down to about 1Hz at 48kHz).
+#define MAX_MIX_SOURCES      (4U)                                   // Waveforms that may be mixed with the main one (--mix).
+#define VERIFY_MAX_EVENTS    (100U)                                 // Events reported by "wavgen verify" unless told otherwise.
+
 /*
 ** Typedefs and enums.
 */
@@ -40,6 +51,7 @@ typedef enum {
     WAVEFORM_TYPE_STEPS,
     WAVEFORM_TYPE_PINK,
     WAVEFORM_TYPE_WHITE,
+    WAVEFORM_TYPE_SWEEP,
     NUM_WAVEFORM_TYPES
 } WAVEFORM_TYPE;
 
@@ -51,6 +63,37 @@ enum BYTES_PER_SAMPLE {
     BYTES_32BIT = 4
 };
 
+typedef enum {
+    DITHER_NONE,        // Truncate to the output word size.
+    DITHER_TPDF,        // Triangular (TPDF) dither.
+    DITHER_SHAPED       // TPDF dither with first-order noise shaping.
+} DITHER_TYPE;
+
+typedef enum {
+    PINK_KELLET,        // Paul Kellet's 1/f filter, in double-precision.
+    PINK_KELLET_FLOAT,  // The same filter in single-precision (twice as many channels at once).
+    PINK_VOSS           // The Voss-McCartney algorithm.
+} PINK_TYPE;
+
+/*
+** The waveform given to one channel with --chan, in place of the -t/-f waveform.
+*/
+struct CHANNEL_SPEC {
+    bool          is_set;       // False for channels that follow -t and -f.
+    WAVEFORM_TYPE wf_type;
+    uint32_t      frequency_hz;
+};
+
+/*
+** A waveform added to the main one on the mixing bus with --mix, at its own level.
+*/
+struct MIX_SOURCE {
+    WAVEFORM_TYPE wf_type;
+    uint32_t      frequency_hz;
+    float         peak_level_dbfs;  // Relative to the alignment level, as for -l.
+    double        gain;             // Worked out from the level (see gain_from_params()).
+};
+
 /* Mixed pointer to a sample/buffer that can hold either a 32-bit int or a float sample */
 typedef union {
     int32_t i;
@@ -64,16 +107,30 @@ typedef union {
 struct COMMON_USER_PARAMS {
     bool     save_as_float;     // -b 0
     uint8_t  num_channels;      // -c 1:8
-    uint8_t  bits_per_sample;   // -b 32|24|16
-    uint8_t  bytes_per_sample;  //    =4 =4 =2
+    uint8_t  bits_per_sample;   // -b 32|24|16|8
+    uint8_t  bytes_per_sample;  //    =4 =3 =2 =1
     uint32_t frequency_hz;      // -f (of the main waveform)
     uint32_t sample_rate;       // -r 48000|44100 etc,
     uint32_t duration_ms;       // -d (or calculated from -s)
-    uint32_t num_samples;       // -s (or calculated from -d)
+    uint64_t num_samples;       // -s (or calculated from -d), across ALL channels
+    uint32_t block_frames;      // --blocksize (frames generated and written per block)
+    uint16_t num_threads;       // --threads (worker threads used for file output)
+    bool     period_cache;      // --nocache clears this (periodic waveforms are copied from a table)
+    bool     use_mmap;          // --mmap (write the output file through a memory mapping)
+    bool     realtime;          // --realtime (pace the output at the sample rate)
+    bool     unbounded;         // --unbounded, or --realtime with no duration or sample count (stream indefinitely)
+    const char *batch_file;     // --batch (a manifest of files to generate), or NULL
+    const char *serve_path;     // --serve (the UNIX socket to serve streams on), or NULL
+    DITHER_TYPE dither;         // --dither (for 8, 16 and 24-bit output)
     float    peak_level_dbfs;   // -l
     float    align_level_dbfs;  // -a
 
     WAVEFORM_TYPE wf_type;      // -t
+    bool     per_channel;       // True if any channel has its own waveform (--chan).
+    struct CHANNEL_SPEC channels[MAX_CHANNELS]; // --chan
+    uint8_t  num_mix;           // The number of waveforms mixed with the main one (--mix).
+    struct MIX_SOURCE mix[MAX_MIX_SOURCES];     // --mix
+    double   mix_gain;          // The main waveform's gain on the mixing bus (the level stage is then unity).
     const char *filename;       // The final parameter (no prefix).
 };
 
@@ -87,8 +144,25 @@ struct ADDITIONAL_USER_PARAMS {
     bool     markers_on;        // -m
     bool     markers_in_msb;    // -m tb|msb (not bb|lsb)
     bool     uncorrelated;      // -u (for pink noise)
+    uint64_t seed;              // --seed (for noise)
+    PINK_TYPE pink_type;        // --pink
+    uint8_t  first_channel;     // The channel a stream's noise starts on (a channel generated alone for --chan).
+    uint32_t sweep_end_hz;      // --endfreq (for sweeps, which start at -f)
+    bool     sweep_linear;      // --sweep linear (rather than log)
+    uint32_t fade_ms;           // --fade (for sweeps)
+    const char *inverse_file;   // --inverse (the sweep's inverse filter), or NULL
+    bool     sweep_inverse;     // Generate the inverse filter rather than the sweep itself.
 };
 
+/*
+** The outcome of parsing the command-line options.
+*/
+typedef enum {
+    OPTS_OK,        // Carry on and generate the waveform.
+    OPTS_DONE,      // Nothing more to do (help or the version was shown).
+    OPTS_ERROR      // The options are invalid (the reason has been logged).
+} OPTS_RESULT;
+
 /*
 ** Fixed parameters that aren't DIRECTLY set by the user, or are internal only.
 */
@@ -96,10 +170,41 @@ struct FIXED_PARAMS {
     double gain;        // Gain value calculated from user params (align, level, power).
     bool   verbose;     // Output information to the console.
     bool   piping;      // True if piping the "wavfile" to another application.
+    bool   embedded;    // True if there's no console at all (libwavgen), so help can't be shown.
+};
+
+/*
+** Per-stream generator state. Anything a generator must carry from one block to the next lives
+** here rather than in function-local statics, so that independent streams can run side-by-side
+** and a stream can be moved to any frame with generate_seek().
+*/
+struct WAVEFORM_STATE {
+    uint64_t sample_number;     // The frame number of the next frame to be generated.
+    double   pink_taps[7][MAX_CHANNELS];                // Pink noise 1/f filter taps, for each channel.
+    double   pink_rows[PINK_VOSS_ROWS][MAX_CHANNELS];   // Voss-McCartney pink noise rows (see wf_noise.c).
+    double   pink_sums[MAX_CHANNELS];                   // The sum of each channel's rows.
+    bool     pink_rows_set;                             // False until the rows have been set up.
+    int32_t  dither_errors[MAX_CHANNELS];               // Noise-shaped dither feedback (see wf_dither.c).
+
+    struct PERIOD_TABLE *period_table;  // Cached period of a periodic waveform (see wf_cache.c).
+    bool     period_table_checked;      // True once the cache has been searched for a table.
+
+    struct WAVEFORM_STATE *channel_states;  // Each channel's own stream for --chan (see wf_channels.c), or NULL.
+    struct WAVEFORM_STATE *mix_states;      // Each of the mixed waveforms' streams for --mix (see wf_mix.c), or NULL.
+    uint8_t  num_mix_states;                // How many there are (the main waveform's and the mixed ones').
+};
 
-    SAMPLE   sample_value;  // Holds the value of the current sample being generated.
-    uint32_t sample_number; // Holds the offset of the current sample (i.e. the sample number).
-    uint16_t current_chnl;  // Holds the channel number of the current sample being generated.
+/*
+** The buffered output stage. Packed samples are collected in an aligned staging buffer
+** and written to the file descriptor in bulk.
+*/
+struct OUTPUT_WRITER {
+    int      fd;        // The output file descriptor (a file, or stdout when piping).
+    uint8_t *staging;   // Aligned staging buffer holding packed output data.
+    size_t   capacity;  // Size of the staging buffer in bytes.
+    size_t   used;      // Number of bytes currently waiting to be written.
+    off_t    position;  // File offset for the next flush (pwrite), or -1 to write sequentially.
+    bool     mapped;    // True if the staging buffer is a memory-mapped output file (no flushing).
 };
 
 /*
@@ -110,34 +215,144 @@ struct FIXED_PARAMS {
 void help(void);
 void waveform_type_help(WAVEFORM_TYPE type);
 void help_type_unknown(void);
+void help_verify(void);
 void help_version(void);
 
+/* From batch.c */
+bool run_batch(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user);
+
+/* From serve.c */
+bool run_server(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user);
+
+/* From verify.c */
+bool run_verify(int argc, char *argv[]);
+
 /* From log.c */
 void log_info(struct FIXED_PARAMS *fixed, const char *format, ...);
 void log_extra(struct FIXED_PARAMS *fixed, const char *format, ...);
 
 /* From opts.c */
-void   parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra);
-double gain_from_params(struct FIXED_PARAMS *fixed, float align_dbfs, float peak_dbfs, uint16_t power_fraction);
+int         split_args(char *line, char *args[]);
+OPTS_RESULT parse_opts(int argc, char *argv[], struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra);
+double      gain_from_params(struct FIXED_PARAMS *fixed, float align_dbfs, float peak_dbfs, uint16_t power_fraction);
 
-/* From wf_xxx.c - these waveforms can have channel-markers overlaid.*/
-void generate_saw(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params);
-void generate_steps(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params);
-void generate_silence(struct FIXED_PARAMS *fixed);
-void generate_counter(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params);
+/*
+** From wf_xxx.c - these waveforms can have channel-markers overlaid.
+** All generators fill an INTERLEAVED buffer of num_frames frames (num_frames * num_channels samples),
+** starting at the frame given by state->sample_number (which is advanced by generate_block()).
+** The samples are 32-bit integers, or floats if generates_float() is true.
+*/
+void generate_saw(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, SAMPLE *buffer, uint32_t num_frames);
+void generate_steps(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, SAMPLE *buffer, uint32_t num_frames);
+void generate_silence(struct COMMON_USER_PARAMS *user_params, SAMPLE *buffer, uint32_t num_frames);
+void generate_counter(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params,
+                      SAMPLE *buffer, uint32_t num_frames);
 
 /* From wf_xxx.c - these waveforms cannot have markers, but their level can be specified by power fraction.*/
-void generate_square(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params);
-void generate_sine(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params);
-void generate_burst(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params);
-void generate_white(struct FIXED_PARAMS *fixed, struct ADDITIONAL_USER_PARAMS *extra_params);
-void generate_pink(struct FIXED_PARAMS *fixed, struct ADDITIONAL_USER_PARAMS *extra_params);
+void generate_square(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, SAMPLE *buffer, uint32_t num_frames);
+void generate_sine(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, SAMPLE *buffer, uint32_t num_frames);
+void generate_burst(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params,
+                    SAMPLE *buffer, uint32_t num_frames);
+void generate_white(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params,
+                    SAMPLE *buffer, uint32_t num_frames);
+void generate_pink(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params,
+                   SAMPLE *buffer, uint32_t num_frames);
+void generate_sweep(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user_params, struct ADDITIONAL_USER_PARAMS *extra_params,
+                    SAMPLE *buffer, uint32_t num_frames);
+
+/* From wf_sweep.c */
+bool write_sweep_inverse(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra);
+
+/* From wf_noise.c */
+void seek_noise(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, uint64_t frame);
+
+/* From wf_generate.c */
+bool generates_float(struct COMMON_USER_PARAMS *user);
+void generate_init(struct WAVEFORM_STATE *state);
+void generate_free(struct WAVEFORM_STATE *state);
+void generate_seek(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, uint64_t frame);
+void generate_block(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                    SAMPLE *buffer, uint32_t num_frames);
+void generate_direct(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                     SAMPLE *buffer, uint32_t num_frames);
+
+/* From wf_channels.c */
+void generate_channels(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                       SAMPLE *buffer, uint32_t num_frames);
+void seek_channels(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, uint64_t frame);
+void free_channels(struct WAVEFORM_STATE *state);
+
+/* From wf_mix.c */
+void generate_mix(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                  SAMPLE *buffer, uint32_t num_frames);
+void seek_mix(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, uint64_t frame);
+void free_mix(struct WAVEFORM_STATE *state);
+
+/* From wf_cache.c */
+bool period_cache_generate(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                           SAMPLE *buffer, uint32_t num_frames);
+const SAMPLE *period_cache_samples(struct WAVEFORM_STATE *state, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                                   uint32_t *period_frames);
+void period_cache_clear(void);
+
+/* From wf_threads.c */
+bool generate_threaded(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                       int fd, off_t data_offset, uint8_t *mapped_data, uint64_t num_frames);
+
+/* From wf_realtime.c */
+bool realtime_stream(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                     int fd, uint64_t num_frames);
+
+/* From wf_splice.c */
+bool splice_periodic(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra,
+                     int fd, uint64_t num_frames, bool *spliced);
+
+/* From wf_stream.c */
+bool write_stream(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, FILE *wavfile);
+
+/* From wf_header.c */
+bool   write_headers(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, FILE *wavfile,
+                     uint64_t num_data_bytes, bool reserve_ds64);
+size_t headers_to_buffer(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, uint64_t num_data_bytes,
+                         bool reserve_ds64, uint8_t *buffer, size_t capacity);
+
+/* From wf_dither.c */
+bool dither_required(struct COMMON_USER_PARAMS *user);
+void check_dither(struct COMMON_USER_PARAMS *user, struct WAVEFORM_STATE *state, SAMPLE *buffer, uint32_t num_frames);
 
 /* From wf_markers.c */
-bool check_markers(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra);
-bool add_markers(struct FIXED_PARAMS *fixed, bool markers_in_msb);
+bool check_markers(struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra, SAMPLE *buffer, uint32_t num_frames);
+bool add_markers(SAMPLE *buffer, uint32_t num_frames, uint16_t num_channels, bool markers_in_msb);
 
 /* From wf_output.c */
-bool finalise_data(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra_params, FILE *wavfile);
+bool finalise_block(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra_params,
+                    struct WAVEFORM_STATE *state, SAMPLE *buffer, uint32_t num_frames, struct OUTPUT_WRITER *writer);
+
+/* From wf_gain.c */
+void apply_gain(SAMPLE *buffer, size_t num_samples, double gain);
+void convert_to_float(SAMPLE *buffer, size_t num_samples, double scale);
+void scale_float(SAMPLE *buffer, size_t num_samples, double gain);
+
+/* From wf_pack.c */
+void pack_s16(const SAMPLE *buffer, size_t num_samples, uint8_t *output);
+void pack_s24(const SAMPLE *buffer, size_t num_samples, uint8_t *output);
+void pack_u8(const SAMPLE *buffer, size_t num_samples, uint8_t *output);
+
+/* From wf_writer.c */
+bool     writer_init(struct OUTPUT_WRITER *writer, int fd, size_t capacity);
+void     writer_init_mapped(struct OUTPUT_WRITER *writer, uint8_t *destination, size_t capacity);
+SAMPLE  *writer_in_place(struct OUTPUT_WRITER *writer, struct COMMON_USER_PARAMS *user);
+uint8_t *writer_map_file(int fd, size_t file_size);
+bool     writer_unmap_file(uint8_t *mapping, size_t file_size);
+void     writer_free(struct OUTPUT_WRITER *writer);
+bool     writer_flush(struct OUTPUT_WRITER *writer);
+bool     writer_write(int fd, const uint8_t *data, size_t num_bytes);
+void    *writer_alloc(size_t num_bytes);
+void     writer_release(void *data);
+bool     writer_pad(int fd, off_t position, uint64_t num_data_bytes);
+void     writer_request_stop(int signum);
+bool     writer_stop_requested(void);
+uint8_t *writer_reserve(struct OUTPUT_WRITER *writer, size_t num_bytes);
+bool     writer_commit(struct OUTPUT_WRITER *writer, size_t num_bytes);
 
 #endif
@@ -18,16 +18,20 @@ static const double PI = 3.1415926536;
 /*
 ** Generate the sample buffer with periodic sine-wave bursts.
 */
-void generate_burst(struct FIXED_PARAMS *fixed,
+void generate_burst(struct WAVEFORM_STATE *state,
                     struct COMMON_USER_PARAMS *user,
-                    struct ADDITIONAL_USER_PARAMS *extra_params)
+                    struct ADDITIONAL_USER_PARAMS *extra_params,
+                    SAMPLE   *buffer,
+                    uint32_t  num_frames)
 {
-    static uint64_t burst_sample = 0;
-
     uint32_t burst_length_samples;
     uint32_t period_length_samples;
+    uint32_t burst_sample;
+    uint32_t frame;
+    uint16_t chnl;
 
-    double sample_value_f;
+    double  sample_value_f;
+    int32_t sample_value;
 
     /*
     ** Sanitise input to avoid any potential floating-point exceptions etc.
@@ -38,25 +42,31 @@ void generate_burst(struct FIXED_PARAMS *fixed,
 
     burst_length_samples  = user->sample_rate / user->frequency_hz;
     period_length_samples = (user->sample_rate / 1000U) * extra_params->period_ms;
-
-    /*
-    ** At the beginning of a the burst duration (for the first channel), reset the counter
-    ** that will cause the sinusiodal burst to be generated.
-    */
-    if (((fixed->sample_number % period_length_samples) == 0) && (fixed->current_chnl == 0)) {
-        burst_sample = 0;
+    if (period_length_samples < 1U) {
+        period_length_samples = 1U;
     }
 
-    if (burst_sample < (burst_length_samples * extra_params->num_cycles)) {
-        /* Generate a sinusoidal waveform ("burst") during this period.*/
-        sample_value_f  = sin(2.0 * PI * (double) burst_sample / (double) burst_length_samples);
-        sample_value_f *= (double) MAX_LEVEL_32BIT;
+    for (frame = 0; frame < num_frames; ++frame) {
+        /*
+        ** The position within the current period is all that is needed to tell whether
+        ** (and where) the sinusiodal burst is being generated.
+        */
+        burst_sample = (state->sample_number + frame) % period_length_samples;
 
-        fixed->sample_value.i = (int32_t) (sample_value_f + 0.5);
+        if (burst_sample < (burst_length_samples * extra_params->num_cycles)) {
+            /* Generate a sinusoidal waveform ("burst") during this period.*/
+            sample_value_f  = sin(2.0 * PI * (double) burst_sample / (double) burst_length_samples);
+            sample_value_f *= (double) MAX_LEVEL_32BIT;
 
-        ++burst_sample;
-    }
-    else {
-        fixed->sample_value.i = 0;
+            sample_value = (int32_t) (sample_value_f + 0.5);
+        }
+        else {
+            sample_value = 0;
+        }
+
+        /* The burst advances once per FRAME, so every channel carries the same waveform.*/
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            (buffer++)->i = sample_value;
+        }
     }
 }
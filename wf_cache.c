@@ -0,0 +1,240 @@
+/*
+** wf_cache.c
+**
+** A cache of "period tables" for strictly periodic waveforms (sine, square, saw and burst).
+** One exact period of the interleaved output is rendered into a table the first time it is
+** needed, after which every block is simply copied out of the table. The least common period
+** is used, so a sine-wave whose frequency does not divide into the sample rate still repeats
+** exactly (e.g. 440Hz at 48kHz repeats every 1200 frames, which is 11 whole cycles).
+**
+** Tables are kept for the life of the process and shared between all streams (and threads),
+** so any later stream with the same rate, frequency and channel count reuses them.
+*/
+#include <pthread.h>
+#include "wavgen.h"
+
+/*
+** Only keep tables small enough to stay resident in the cache, otherwise there is little gain
+** over calculating the samples directly.
+*/
+#define MAX_PERIOD_TABLE_SAMPLES (262144U)
+
+/*
+** One rendered period, identified by everything that its content depends on.
+*/
+struct PERIOD_TABLE {
+    WAVEFORM_TYPE wf_type;
+    uint32_t      sample_rate;
+    uint32_t      frequency_hz;
+    uint16_t      num_channels;
+    uint32_t      num_cycles;       // Burst only.
+    uint32_t      period_ms;        // Burst only.
+    bool          is_float;         // Rendered as float samples (see generates_float()).
+
+    uint32_t      period_frames;    // The length of the table in frames.
+    SAMPLE       *samples;          // One period of interleaved samples.
+
+    struct PERIOD_TABLE *next;
+};
+
+static struct PERIOD_TABLE *period_tables = NULL;
+static pthread_mutex_t      period_lock   = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+** Work out the exact repeat length (in frames) of the waveform, or zero if it doesn't repeat.
+** These follow the definitions used by the generators themselves.
+*/
+static uint32_t period_frames(struct COMMON_USER_PARAMS *user,
+                              struct ADDITIONAL_USER_PARAMS *extra)
+{
+    uint32_t period;
+
+    switch (user->wf_type) {
+    case WAVEFORM_TYPE_SINE:
+        /* The exact-phase sine repeats once a whole number of cycles fits into a whole number of frames.*/
+        return user->sample_rate / gcd(user->sample_rate, user->frequency_hz);
+
+    case WAVEFORM_TYPE_SAW:
+        return user->sample_rate / user->frequency_hz;
+
+    case WAVEFORM_TYPE_SQUARE:
+        return ((user->sample_rate / user->frequency_hz) / 2U) * 2U;
+
+    case WAVEFORM_TYPE_BURST:
+        period = (user->sample_rate / 1000U) * extra->period_ms;
+        return (period < 1U) ? 1U : period;
+
+    default:
+        return 0;
+    }
+}
+
+/*
+** Find (or render and add) the period table for the stream's parameters.
+** Returns NULL if the waveform is not periodic or its period is too long to be worth caching.
+*/
+static struct PERIOD_TABLE *period_table_find(struct COMMON_USER_PARAMS *user,
+                                              struct ADDITIONAL_USER_PARAMS *extra)
+{
+    struct PERIOD_TABLE  *table;
+    struct WAVEFORM_STATE render_state;
+    uint32_t period = period_frames(user, extra);
+
+    if ((period == 0) || (((uint64_t) period * user->num_channels) > MAX_PERIOD_TABLE_SAMPLES)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&period_lock);
+
+    for (table = period_tables; table != NULL; table = table->next) {
+        if ((table->wf_type      == user->wf_type)      &&
+            (table->sample_rate  == user->sample_rate)  &&
+            (table->frequency_hz == user->frequency_hz) &&
+            (table->num_channels == user->num_channels) &&
+            (table->is_float     == generates_float(user)) &&
+            ((user->wf_type != WAVEFORM_TYPE_BURST) ||
+             ((table->num_cycles == extra->num_cycles) && (table->period_ms == extra->period_ms)))) {
+            break;
+        }
+    }
+
+    if (table == NULL) {
+        /* Not seen before, so render one period using the normal generator.*/
+        table = calloc(1, sizeof(struct PERIOD_TABLE));
+        if (table != NULL) {
+            table->samples = malloc((size_t) period * user->num_channels * sizeof(SAMPLE));
+            if (table->samples == NULL) {
+                free(table);
+                table = NULL;
+            }
+        }
+
+        if (table != NULL) {
+            table->wf_type       = user->wf_type;
+            table->sample_rate   = user->sample_rate;
+            table->frequency_hz  = user->frequency_hz;
+            table->num_channels  = user->num_channels;
+            table->num_cycles    = extra->num_cycles;
+            table->period_ms     = extra->period_ms;
+            table->is_float      = generates_float(user);
+            table->period_frames = period;
+
+            generate_init(&render_state);
+            generate_direct(&render_state, user, extra, table->samples, period);
+
+            table->next   = period_tables;
+            period_tables = table;
+        }
+    }
+
+    pthread_mutex_unlock(&period_lock);
+
+    return table;
+}
+
+/*
+** Get the stream's period table, looking it up the first time the stream is used.
+** Streams with per-channel (--chan) or mixed (--mix) waveforms have none, as each of those has its own.
+*/
+static struct PERIOD_TABLE *period_table_for_stream(struct WAVEFORM_STATE *state,
+                                                    struct COMMON_USER_PARAMS *user,
+                                                    struct ADDITIONAL_USER_PARAMS *extra)
+{
+    if (!state->period_table_checked) {
+        state->period_table         = (user->period_cache && !user->per_channel && (user->num_mix == 0U)) ? period_table_find(user, extra) : NULL;
+        state->period_table_checked = true;
+    }
+
+    return state->period_table;
+}
+
+/*
+** Get one exact period of the stream's (interleaved) samples, if it has a period table.
+** Returns NULL if the waveform is not cached.
+*/
+const SAMPLE *period_cache_samples(struct WAVEFORM_STATE *state,
+                                   struct COMMON_USER_PARAMS *user,
+                                   struct ADDITIONAL_USER_PARAMS *extra,
+                                   uint32_t *period_frames)
+{
+    struct PERIOD_TABLE *table = period_table_for_stream(state, user, extra);
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    *period_frames = table->period_frames;
+
+    return table->samples;
+}
+
+/*
+** Generate a block by copying from the stream's period table, if it has one.
+** Returns false if the waveform must be generated directly instead.
+*/
+bool period_cache_generate(struct WAVEFORM_STATE *state,
+                           struct COMMON_USER_PARAMS *user,
+                           struct ADDITIONAL_USER_PARAMS *extra,
+                           SAMPLE   *buffer,
+                           uint32_t  num_frames)
+{
+    struct PERIOD_TABLE *table;
+    uint32_t position;
+    uint32_t run;
+
+    table = period_table_for_stream(state, user, extra);
+    if (table == NULL) {
+        return false;
+    }
+
+    /* Copy runs of whole frames, wrapping around at the end of the table.*/
+    position = state->sample_number % table->period_frames;
+
+    while (num_frames > 0) {
+        run = table->period_frames - position;
+        if (run > num_frames) {
+            run = num_frames;
+        }
+
+        memcpy(buffer, &table->samples[(size_t) position * table->num_channels],
+               (size_t) run * table->num_channels * sizeof(SAMPLE));
+
+        buffer     += (size_t) run * table->num_channels;
+        num_frames -= run;
+        position    = 0;
+    }
+
+    return true;
+}
+
+/*
+** Free all the cached period tables. No stream may be using them.
+*/
+void period_cache_clear(void)
+{
+    struct PERIOD_TABLE *table;
+
+    pthread_mutex_lock(&period_lock);
+
+    while (period_tables != NULL) {
+        table         = period_tables;
+        period_tables = table->next;
+        free(table->samples);
+        free(table);
+    }
+
+    pthread_mutex_unlock(&period_lock);
+}
@@ -0,0 +1,141 @@
+/*
+** wf_channels.c
+**
+** Per-channel waveforms (--chan). Each channel is generated as a stream of its own: a mono stream
+** with the channel's type and frequency, and its own generator state (and period table, if it
+** is periodic). The channels without a waveform of their own use -t and -f in the same way.
+**
+** A block is generated a chunk of frames at a time, and within each chunk a channel at a time:
+** the channel's generator fills a small mono buffer, which is then interleaved into the block.
+** So each generator runs over a whole chunk with its state held in registers and the cache,
+** rather than all of the generators being switched between on every frame, and the mono buffer
+** and the chunk of the block being interleaved into both stay in the L1 cache.
+*/
+#include "wavgen.h"
+
+#define CHANNEL_CHUNK_FRAMES (1024U)    // Frames generated per channel at a time (kept on the stack).
+
+/*
+** Make the parameters of the mono stream that generates one channel.
+** The samples are always integers, as the block is finalised as a whole (see generates_float()).
+** Noise channels take their values from the same channel of the multi-channel stream, so that
+** they are uncorrelated with -u and all the same without it.
+*/
+static void channel_params(struct COMMON_USER_PARAMS *user,
+                           struct ADDITIONAL_USER_PARAMS *extra,
+                           uint8_t chnl,
+                           struct COMMON_USER_PARAMS *chnl_user,
+                           struct ADDITIONAL_USER_PARAMS *chnl_extra)
+{
+    *chnl_user  = *user;
+    *chnl_extra = *extra;
+
+    chnl_user->num_channels  = 1U;
+    chnl_user->num_samples   = user->num_samples / user->num_channels;
+    chnl_user->save_as_float = false;
+    chnl_user->per_channel   = false;
+    chnl_user->num_mix       = 0U;
+
+    if (user->channels[chnl].is_set) {
+        chnl_user->wf_type      = user->channels[chnl].wf_type;
+        chnl_user->frequency_hz = user->channels[chnl].frequency_hz;
+    }
+
+    chnl_extra->first_channel = extra->uncorrelated ? (uint8_t) (extra->first_channel + chnl) : extra->first_channel;
+}
+
+/*
+** Get the stream's channel states, creating them (at the stream's position) the first time.
+** Returns NULL if they could not be allocated.
+*/
+static struct WAVEFORM_STATE *channel_states(struct WAVEFORM_STATE *state,
+                                             struct COMMON_USER_PARAMS *user,
+                                             struct ADDITIONAL_USER_PARAMS *extra)
+{
+    if (state->channel_states == NULL) {
+        state->channel_states = malloc(user->num_channels * sizeof(struct WAVEFORM_STATE));
+        if (state->channel_states == NULL) {
+            return NULL;
+        }
+        seek_channels(state, user, extra, state->sample_number);
+    }
+
+    return state->channel_states;
+}
+
+/*
+** Generate a block with each channel's own waveform, into an interleaved buffer.
+** Like generate_direct(), this does not move the stream on (but the channels' streams are).
+** If the channel states could not be allocated, the block is silent.
+*/
+void generate_channels(struct WAVEFORM_STATE *state,
+                       struct COMMON_USER_PARAMS *user,
+                       struct ADDITIONAL_USER_PARAMS *extra,
+                       SAMPLE   *buffer,
+                       uint32_t  num_frames)
+{
+    struct COMMON_USER_PARAMS     chnl_user[MAX_CHANNELS];
+    struct ADDITIONAL_USER_PARAMS chnl_extra[MAX_CHANNELS];
+    struct WAVEFORM_STATE *states;
+    SAMPLE   mono[CHANNEL_CHUNK_FRAMES];
+    uint16_t num_channels = user->num_channels;
+    uint32_t frames;
+    uint32_t frame;
+    uint8_t  chnl;
+
+    states = channel_states(state, user, extra);
+    if (states == NULL) {
+        memset(buffer, 0, (size_t) num_frames * num_channels * sizeof(SAMPLE));
+        return;
+    }
+
+    for (chnl = 0; chnl < num_channels; ++chnl) {
+        channel_params(user, extra, chnl, &chnl_user[chnl], &chnl_extra[chnl]);
+    }
+
+    for (; num_frames > 0; num_frames -= frames) {
+        frames = (num_frames < CHANNEL_CHUNK_FRAMES) ? num_frames : CHANNEL_CHUNK_FRAMES;
+
+        for (chnl = 0; chnl < num_channels; ++chnl) {
+            generate_block(&states[chnl], &chnl_user[chnl], &chnl_extra[chnl], mono, frames);
+
+            for (frame = 0; frame < frames; ++frame) {
+                buffer[((size_t) frame * num_channels) + chnl] = mono[frame];
+            }
+        }
+
+        buffer += (size_t) frames * num_channels;
+    }
+}
+
+/*
+** Move each channel's stream to the given frame (if they have been created yet).
+*/
+void seek_channels(struct WAVEFORM_STATE *state,
+                   struct COMMON_USER_PARAMS *user,
+                   struct ADDITIONAL_USER_PARAMS *extra,
+                   uint64_t frame)
+{
+    struct COMMON_USER_PARAMS     chnl_user;
+    struct ADDITIONAL_USER_PARAMS chnl_extra;
+    uint8_t chnl;
+
+    if (state->channel_states == NULL) {
+        return;
+    }
+
+    for (chnl = 0; chnl < user->num_channels; ++chnl) {
+        channel_params(user, extra, chnl, &chnl_user, &chnl_extra);
+        generate_init(&state->channel_states[chnl]);
+        generate_seek(&state->channel_states[chnl], &chnl_user, &chnl_extra, frame);
+    }
+}
+
+/*
+** Free the channels' streams (if any).
+*/
+void free_channels(struct WAVEFORM_STATE *state)
+{
+    free(state->channel_states);
+    state->channel_states = NULL;
+}
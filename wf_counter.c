@@ -18,9 +18,11 @@
 /*
 ** Create a buffer consisting of an integer count (essentially a slow saw-tooth).
 */
-void generate_counter(struct FIXED_PARAMS *fixed,
+void generate_counter(struct WAVEFORM_STATE *state,
                       struct COMMON_USER_PARAMS *user,
-                      struct ADDITIONAL_USER_PARAMS *extra)
+                      struct ADDITIONAL_USER_PARAMS *extra,
+                      SAMPLE   *buffer,
+                      uint32_t  num_frames)
 {
     /*
     ** Samples are Little-Endian:
@@ -30,12 +32,9 @@ void generate_counter(struct FIXED_PARAMS *fixed,
     */
 
     uint32_t counter_value;
-
-    /*
-    ** The counter value increaments independently of CHANNEL, so multi-channel
-    ** waveforms will have the same counter value across all sample in the frame.
-    */
-    counter_value = fixed->sample_number;
+    uint32_t frame;
+    uint16_t chnl;
+    uint8_t  shift = 0U;
 
     /*
     ** If the user has asked for channel markers in the LSB, make room
@@ -43,7 +42,7 @@ void generate_counter(struct FIXED_PARAMS *fixed,
     ** then the markers will just overwrite the upper counter bits.
     */
     if (extra->markers_on && !extra->markers_in_msb) {
-        counter_value = counter_value << 8;
+        shift += 8U;
     }
 
     /*
@@ -52,15 +51,30 @@ void generate_counter(struct FIXED_PARAMS *fixed,
     ** in 32-bit format for now.
     */
     if ((user->bytes_per_sample == BYTES_32BIT) || (user->save_as_float)) {
-        fixed->sample_value.i = (int32_t) counter_value;
+        shift += 0U;
     }
     else if (user->bytes_per_sample == BYTES_24BIT) {
-        fixed->sample_value.i = (int32_t) (counter_value << 8U);
+        shift += 8U;
     }
     else if (user->bytes_per_sample == BYTES_16BIT) {
-        fixed->sample_value.i = (int32_t) (counter_value << 16U);
+        shift += 16U;
+    }
+    else if (user->bytes_per_sample == BYTES_8BIT) {
+        shift += 24U;
     }
     else {
-        fixed->sample_value.i = 0U; // Unsupported formats.
+        shift = 32U; // Unsupported formats.
+    }
+
+    for (frame = 0; frame < num_frames; ++frame) {
+        /*
+        ** The counter value increaments independently of CHANNEL, so multi-channel
+        ** waveforms will have the same counter value across all sample in the frame.
+        */
+        counter_value = (shift < 32U) ? ((state->sample_number + frame) << shift) : 0U;
+
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            (buffer++)->i = (int32_t) counter_value;
+        }
     }
 }
@@ -0,0 +1,292 @@
+/*
+** wf_dither.c
+**
+** Dither for the reduced bit-depths (8, 16 and 24-bit), selected with --dither. Without it the
+** narrower formats simply keep the upper bytes of each 32-bit sample, and the truncation error
+** follows the signal (i.e. it is distortion), which pollutes low-level THD+N measurements.
+**
+** TPDF dither adds the sum of two uniform random values of up to one output LSB each, plus half
+** an LSB so that the truncation done when packing becomes rounding. The noise-shaped variant
+** also subtracts each channel's previous quantisation error from its next sample (first-order
+** error feedback), which moves the noise towards high frequencies and out of the audio band.
+**
+** The random values are a hash of each sample's position in the stream, rather than the next
+** values from a generator, so any number of them can be calculated at once (using the compiler's
+** vector extensions, which map onto the target's SIMD registers) and a stream is dithered the
+** same however it is split into blocks (or chunks for --threads).
+**/
+#include "wavgen.h"
+
+#define DITHER_LANES        (8U)        // Samples dithered at once.
+#define DITHER_CHUNK_FRAMES (256U)      // Frames dithered per pass (the offsets are kept on the stack).
+#define DITHER_SALT_1       (0x3C6EF372U)   // Separate the two random values of each sample.
+#define DITHER_SALT_2       (0xA54FF53AU)
+
+typedef int32_t  DITHER_IVEC __attribute__((vector_size(DITHER_LANES * sizeof(int32_t))));
+typedef uint32_t DITHER_UVEC __attribute__((vector_size(DITHER_LANES * sizeof(uint32_t))));
+
+/*
+** A 32-bit integer hash with good avalanche properties (a "lowbias32" from Chris Wellons' hash prospector),
+** written so that it works on single values and on vectors alike.
+*/
+#define DITHER_HASH(x)                     \
+    do {                                   \
+        (x) ^= (x) >> 16; (x) *= 0x7FEB352DU; \
+        (x) ^= (x) >> 15; (x) *= 0x846CA68BU; \
+        (x) ^= (x) >> 16;                  \
+    } while (0)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DITHER_HAVE_AVX2
+#endif
+
+/*
+** The number of bits that packing drops from each sample (so the output LSB is 1 << shift).
+*/
+static unsigned dither_shift(struct COMMON_USER_PARAMS *user)
+{
+    return 32U - (8U * user->bytes_per_sample);
+}
+
+/*
+** Returns true if the stream's output is to be dithered. That is only when asked for, when the
+** output is narrower than the generated samples, and for the audio types (the counter, steps
+** and silence must stay exactly as generated).
+*/
+bool dither_required(struct COMMON_USER_PARAMS *user)
+{
+    if ((user->dither == DITHER_NONE) || user->save_as_float || (user->bytes_per_sample >= BYTES_32BIT)) {
+        return false;
+    }
+
+    switch (user->wf_type) {
+    case WAVEFORM_TYPE_SAW:
+    case WAVEFORM_TYPE_SINE:
+    case WAVEFORM_TYPE_SQUARE:
+    case WAVEFORM_TYPE_BURST:
+    case WAVEFORM_TYPE_PINK:
+    case WAVEFORM_TYPE_WHITE:
+    case WAVEFORM_TYPE_SWEEP:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/*
+** The dither offset for one sample: the sum of two random values (each less than one output LSB)
+** less half an LSB. The random values come from the sample's position in the stream, the lower
+** 32 bits being hashed with the upper 32 bits as a salt.
+*/
+static inline int32_t dither_offset(uint32_t position, uint32_t salt, unsigned shift)
+{
+    uint32_t r1 = position ^ (DITHER_SALT_1 + salt);
+    uint32_t r2;
+
+    /* Up to 16-bit output one hash has enough bits for both random values.*/
+    DITHER_HASH(r1);
+    if (shift > 16U) {
+        r2 = position ^ (DITHER_SALT_2 + salt);
+        DITHER_HASH(r2);
+    }
+    else {
+        r2 = r1 << shift;
+    }
+
+    return (int32_t) ((r1 >> (32U - shift)) + (r2 >> (32U - shift))) - (int32_t) (1U << (shift - 1U));
+}
+
+/*
+** The same as dither_offset(), for DITHER_LANES consecutive positions at a time from base.
+** Returns the number of offsets calculated (the rest are left for the scalar loop).
+*/
+static inline __attribute__((always_inline))
+size_t dither_offset_lanes(int32_t *offsets, size_t num_offsets, uint32_t salt, uint32_t base, unsigned shift)
+{
+    DITHER_UVEC position;
+    DITHER_UVEC random_1;
+    DITHER_UVEC random_2;
+    DITHER_IVEC offset;
+    size_t   index;
+    uint32_t lane;
+
+    for (lane = 0; lane < DITHER_LANES; ++lane) {
+        position[lane] = base + lane;
+    }
+
+    for (index = 0; (index + DITHER_LANES) <= num_offsets; index += DITHER_LANES) {
+        random_1 = position ^ (DITHER_SALT_1 + salt);
+        DITHER_HASH(random_1);
+        if (shift > 16U) {
+            random_2 = position ^ (DITHER_SALT_2 + salt);
+            DITHER_HASH(random_2);
+        }
+        else {
+            random_2 = random_1 << shift;
+        }
+
+        offset = (DITHER_IVEC) ((random_1 >> (32U - shift)) + (random_2 >> (32U - shift))) - (int32_t) (1U << (shift - 1U));
+        memcpy(&offsets[index], &offset, sizeof(offset));
+
+        position += DITHER_LANES;
+    }
+
+    return index;
+}
+
+#if defined(DITHER_HAVE_AVX2)
+/*
+** AVX2 version, which has a proper 32-bit vector multiply for the hash (chosen at run-time).
+*/
+__attribute__((target("avx2")))
+static size_t dither_offset_avx2(int32_t *offsets, size_t num_offsets, uint32_t salt, uint32_t base, unsigned shift)
+{
+    return dither_offset_lanes(offsets, num_offsets, salt, base, shift);
+}
+#endif
+
+/*
+** Calculate the dither offsets for a run of consecutive samples of the stream.
+*/
+static void dither_offsets(int32_t *offsets, size_t num_offsets, uint64_t first_sample, unsigned shift)
+{
+    uint32_t salt = (uint32_t) (first_sample >> 32);
+    uint32_t base = (uint32_t) first_sample;
+    size_t   index;
+
+    /* Where the lower 32 bits would wrap around, leave the rest to the scalar loop.*/
+    if (((uint64_t) base + num_offsets) > ((uint64_t) UINT32_MAX + 1U)) {
+        index = 0;
+    }
+#if defined(DITHER_HAVE_AVX2)
+    else if (__builtin_cpu_supports("avx2")) {
+        index = dither_offset_avx2(offsets, num_offsets, salt, base, shift);
+    }
+#endif
+    else {
+        index = dither_offset_lanes(offsets, num_offsets, salt, base, shift);
+    }
+    base += (uint32_t) index;
+
+    for (; index < num_offsets; ++index) {
+        offsets[index] = dither_offset(base, salt, shift);
+        if (++base == 0) {
+            ++salt;
+        }
+    }
+}
+
+/*
+** Plain TPDF dither: add each offset to its sample, saturating at full-scale, then clear the
+** bits that packing drops so that they are rounded rather than truncated.
+*/
+static void dither_tpdf(SAMPLE *buffer, const int32_t *offsets, size_t num_samples, unsigned shift)
+{
+    const int32_t mask = (int32_t) (~0U << shift);
+    DITHER_IVEC sample;
+    DITHER_IVEC offset;
+    DITHER_IVEC sum;
+    DITHER_IVEC overflow;
+    size_t  index;
+    int32_t dithered;
+
+    for (index = 0; (index + DITHER_LANES) <= num_samples; index += DITHER_LANES) {
+        memcpy(&sample, &buffer[index], sizeof(sample));
+        memcpy(&offset, &offsets[index], sizeof(offset));
+
+        /* Add with wrap-around, then replace any that overflowed with the full-scale value.*/
+        sum      = (DITHER_IVEC) ((DITHER_UVEC) sample + (DITHER_UVEC) offset);
+        overflow = ((sample ^ sum) & (offset ^ sum)) >> 31;
+        sum      = ((sum & ~overflow) | (((sample >> 31) ^ INT32_MAX) & overflow)) & mask;
+
+        memcpy(&buffer[index], &sum, sizeof(sum));
+    }
+
+    for (; index < num_samples; ++index) {
+        if (__builtin_add_overflow(buffer[index].i, offsets[index], &dithered)) {
+            dithered = (buffer[index].i < 0) ? INT32_MIN : INT32_MAX;
+        }
+        buffer[index].i = dithered & mask;
+    }
+}
+
+/*
+** TPDF dither with first-order noise shaping. Each sample depends on the error left by the one
+** before it on the same channel, so each channel is worked through in order (keeping its error
+** in a register). The first sample must be on the first channel.
+**
+** The error carried on is the part of the sum that the rounding drops (so it includes the dither
+** itself). This is worked out as if the sample hadn't clipped, which keeps it within a couple of
+** LSBs, and keeps the clamping out of the chain of calculations from one sample to the next.
+*/
+static void dither_shaped(SAMPLE *buffer, const int32_t *offsets, size_t num_samples, unsigned shift,
+                          int32_t *errors, uint16_t num_channels)
+{
+    const int64_t mask = -((int64_t) 1 << shift);
+    size_t   index;
+    uint16_t chnl;
+    int64_t  error;
+    int64_t  sum;
+
+    for (chnl = 0; chnl < num_channels; ++chnl) {
+        error = errors[chnl];
+
+        for (index = chnl; index < num_samples; index += num_channels) {
+            sum   = (int64_t) buffer[index].i - error + offsets[index];
+            error = offsets[index] - (sum & ~mask);
+
+            if (sum > INT32_MAX) {
+                sum = INT32_MAX;
+            }
+            else if (sum < INT32_MIN) {
+                sum = INT32_MIN;
+            }
+            buffer[index].i = (int32_t) (sum & mask);
+        }
+
+        errors[chnl] = (int32_t) error;
+    }
+}
+
+/*
+** Dither a block of integer samples ready for packing to a narrower word size, if asked for.
+** The state is that of the stream that generated the block (and so has already been moved on
+** past it by generate_block()). Must be done before markers are added so as not to change them.
+*/
+void check_dither(struct COMMON_USER_PARAMS *user,
+                  struct WAVEFORM_STATE *state,
+                  SAMPLE  *buffer,
+                  uint32_t num_frames)
+{
+    int32_t  offsets[DITHER_CHUNK_FRAMES * MAX_CHANNELS];
+    uint64_t first_frame;
+    uint32_t frames;
+    size_t   num_samples;
+    unsigned shift;
+
+    if (!dither_required(user)) {
+        return;
+    }
+
+    shift       = dither_shift(user);
+    first_frame = state->sample_number - num_frames;
+
+    /* A chunk of frames at a time, so that the offsets are still in the cache when they're used.*/
+    for (; num_frames > 0; num_frames -= frames) {
+        frames = (num_frames < DITHER_CHUNK_FRAMES) ? num_frames : DITHER_CHUNK_FRAMES;
+        num_samples = (size_t) frames * user->num_channels;
+
+        dither_offsets(offsets, num_samples, first_frame * user->num_channels, shift);
+
+        if (user->dither == DITHER_SHAPED) {
+            dither_shaped(buffer, offsets, num_samples, shift, state->dither_errors, user->num_channels);
+        }
+        else {
+            dither_tpdf(buffer, offsets, num_samples, shift);
+        }
+
+        buffer      += num_samples;
+        first_frame += frames;
+    }
+}
@@ -0,0 +1,233 @@
+/*
+** wf_gain.c
+**
+** The whole-buffer gain kernels used for level adjustment (--align, --level and --power) and
+** for conversion to float output.
+**
+** For integer output each sample is scaled in double-precision (the gain is a double), rounded
+** to the nearest integer with halves rounded away from zero, so that positive and negative
+** samples are treated alike, and saturated to the 32-bit range. For float output the gain and
+** the normalisation to 1.0 are combined into one multiply, with a single rounding to float.
+**
+** There are portable scalar versions, with SIMD versions used where the target supports them:
+** AVX2 (chosen at run-time) or SSE2 on x86, and NEON on 64-bit ARM. They all give exactly the
+** same result as the scalar versions.
+*/
+#include "wavgen.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define GAIN_HAVE_AVX2
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GAIN_HAVE_NEON
+#endif
+
+#define GAIN_MAX_SAMPLE ((double) INT32_MAX)
+#define GAIN_MIN_SAMPLE ((double) INT32_MIN)
+
+/*
+** Scale one sample, rounding symmetrically and saturating.
+*/
+static inline int32_t gain_sample(int32_t sample, double gain)
+{
+    double scaled = (double) sample * gain;
+
+    scaled += (scaled < 0.0) ? -0.5 : 0.5;
+
+    if (scaled >= GAIN_MAX_SAMPLE) {
+        return INT32_MAX;
+    }
+    if (scaled <= GAIN_MIN_SAMPLE) {
+        return INT32_MIN;
+    }
+
+    return (int32_t) scaled;    // Truncation, after the half added above.
+}
+
+#if defined(GAIN_HAVE_AVX2)
+/*
+** AVX2 version: eight samples at a time, as two sets of four doubles.
+** Returns the number of samples scaled (the rest are left for the scalar loop).
+*/
+__attribute__((target("avx2")))
+static size_t apply_gain_avx2(SAMPLE *buffer, size_t num_samples, double gain)
+{
+    const __m256d gains = _mm256_set1_pd(gain);
+    const __m256d half  = _mm256_set1_pd(0.5);
+    const __m256d sign  = _mm256_set1_pd(-0.0);
+    const __m256d upper = _mm256_set1_pd(GAIN_MAX_SAMPLE);
+    const __m256d lower = _mm256_set1_pd(GAIN_MIN_SAMPLE);
+    size_t index;
+
+    for (index = 0; (index + 8U) <= num_samples; index += 8U) {
+        __m256i samples = _mm256_loadu_si256((const __m256i *) &buffer[index]);
+        __m256d lo = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), gains);
+        __m256d hi = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)), gains);
+
+        /* Add a half with the sign of the result, clamp, then truncate.*/
+        lo = _mm256_add_pd(lo, _mm256_or_pd(half, _mm256_and_pd(lo, sign)));
+        hi = _mm256_add_pd(hi, _mm256_or_pd(half, _mm256_and_pd(hi, sign)));
+        lo = _mm256_max_pd(_mm256_min_pd(lo, upper), lower);
+        hi = _mm256_max_pd(_mm256_min_pd(hi, upper), lower);
+
+        _mm256_storeu_si256((__m256i *) &buffer[index],
+                            _mm256_set_m128i(_mm256_cvttpd_epi32(hi), _mm256_cvttpd_epi32(lo)));
+    }
+
+    return index;
+}
+#endif
+
+/*
+** Scale a whole buffer of (32-bit integer) samples by the gain.
+*/
+void apply_gain(SAMPLE *buffer, size_t num_samples, double gain)
+{
+    size_t index = 0;
+
+#if defined(GAIN_HAVE_NEON)
+    {
+        const float64x2_t gains = vdupq_n_f64(gain);
+        const float64x2_t half  = vdupq_n_f64(0.5);
+
+        /* Four samples at a time. Converting to 64-bit and narrowing again saturates for free.*/
+        for (; (index + 4U) <= num_samples; index += 4U) {
+            int32x4_t   samples = vld1q_s32(&buffer[index].i);
+            float64x2_t lo = vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(samples))), gains);
+            float64x2_t hi = vmulq_f64(vcvtq_f64_s64(vmovl_high_s32(samples)), gains);
+
+            lo = vaddq_f64(lo, vbslq_f64(vcltzq_f64(lo), vnegq_f64(half), half));
+            hi = vaddq_f64(hi, vbslq_f64(vcltzq_f64(hi), vnegq_f64(half), half));
+
+            vst1q_s32(&buffer[index].i, vcombine_s32(vqmovn_s64(vcvtq_s64_f64(lo)),
+                                                     vqmovn_s64(vcvtq_s64_f64(hi))));
+        }
+    }
+#else
+#if defined(GAIN_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        index = apply_gain_avx2(buffer, num_samples, gain);
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128d gains = _mm_set1_pd(gain);
+        const __m128d half  = _mm_set1_pd(0.5);
+        const __m128d sign  = _mm_set1_pd(-0.0);
+        const __m128d upper = _mm_set1_pd(GAIN_MAX_SAMPLE);
+        const __m128d lower = _mm_set1_pd(GAIN_MIN_SAMPLE);
+
+        /* Four samples at a time, as two sets of two doubles.*/
+        for (; (index + 4U) <= num_samples; index += 4U) {
+            __m128i samples = _mm_loadu_si128((const __m128i *) &buffer[index]);
+            __m128d lo = _mm_mul_pd(_mm_cvtepi32_pd(samples), gains);
+            __m128d hi = _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(samples, samples)), gains);
+
+            lo = _mm_add_pd(lo, _mm_or_pd(half, _mm_and_pd(lo, sign)));
+            hi = _mm_add_pd(hi, _mm_or_pd(half, _mm_and_pd(hi, sign)));
+            lo = _mm_max_pd(_mm_min_pd(lo, upper), lower);
+            hi = _mm_max_pd(_mm_min_pd(hi, upper), lower);
+
+            _mm_storeu_si128((__m128i *) &buffer[index],
+                             _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi)));
+        }
+    }
+#endif
+#endif
+
+    for (; index < num_samples; ++index) {
+        buffer[index].i = gain_sample(buffer[index].i, gain);
+    }
+}
+
+#if defined(GAIN_HAVE_AVX2)
+/*
+** AVX2 version of the float conversion: eight samples at a time, as two sets of four doubles.
+** Returns the number of samples converted (the rest are left for the scalar loop).
+*/
+__attribute__((target("avx2")))
+static size_t convert_to_float_avx2(SAMPLE *buffer, size_t num_samples, double scale)
+{
+    const __m256d scales = _mm256_set1_pd(scale);
+    size_t index;
+
+    for (index = 0; (index + 8U) <= num_samples; index += 8U) {
+        __m256i samples = _mm256_loadu_si256((const __m256i *) &buffer[index]);
+        __m128  lo = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), scales));
+        __m128  hi = _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)), scales));
+
+        _mm256_storeu_ps(&buffer[index].f, _mm256_set_m128(hi, lo));
+    }
+
+    return index;
+}
+#endif
+
+/*
+** Convert a whole buffer of (32-bit integer) samples to float in place, multiplying each by the
+** scale (i.e. the gain divided by the full-scale integer value).
+*/
+void convert_to_float(SAMPLE *buffer, size_t num_samples, double scale)
+{
+    size_t index = 0;
+
+#if defined(GAIN_HAVE_NEON)
+    {
+        const float64x2_t scales = vdupq_n_f64(scale);
+
+        for (; (index + 4U) <= num_samples; index += 4U) {
+            int32x4_t   samples = vld1q_s32(&buffer[index].i);
+            float64x2_t lo = vmulq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(samples))), scales);
+            float64x2_t hi = vmulq_f64(vcvtq_f64_s64(vmovl_high_s32(samples)), scales);
+
+            vst1q_f32(&buffer[index].f, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+        }
+    }
+#else
+#if defined(GAIN_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        index = convert_to_float_avx2(buffer, num_samples, scale);
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128d scales = _mm_set1_pd(scale);
+
+        for (; (index + 4U) <= num_samples; index += 4U) {
+            __m128i samples = _mm_loadu_si128((const __m128i *) &buffer[index]);
+            __m128  lo = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(samples), scales));
+            __m128  hi = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(samples, samples)), scales));
+
+            _mm_storeu_ps(&buffer[index].f, _mm_movelh_ps(lo, hi));
+        }
+    }
+#endif
+#endif
+
+    for (; index < num_samples; ++index) {
+        buffer[index].f = (float) ((double) buffer[index].i * scale);
+    }
+}
+
+/*
+** Scale a whole buffer of float samples by the gain (for generators that produce float directly).
+** The samples are already float, so the multiply is done in single-precision, which is plenty
+** for a gain and lets the compiler vectorise the loop for whatever the target has.
+*/
+void scale_float(SAMPLE *buffer, size_t num_samples, double gain)
+{
+    float *samples = &buffer->f;
+    float  factor  = (float) gain;
+    size_t index;
+
+    for (index = 0; index < num_samples; ++index) {
+        samples[index] *= factor;
+    }
+}
@@ -0,0 +1,168 @@
+/*
+** wf_generate.c
+**
+** The block-based generation engine. Rather than generating (and writing) one sample at a time,
+** each waveform generator fills a whole buffer of interleaved frames in a single call, and the
+** level, format, marker and output stages are then run as passes over that whole buffer.
+*/
+#include "wavgen.h"
+
+/*
+** Returns true if the stream's generator produces float samples (normalised to 1.0) directly,
+** rather than 32-bit integers that are converted afterwards. This is only done for float output
+** from the generators that work in floating-point anyway, which saves the conversion pass and
+** the precision lost in rounding to an integer first. Channels with their own waveforms (--chan)
+** are always integers, so that they can be mixed in one block. Mixed waveforms (--mix) are always
+** float, as the sum is converted straight from double-precision (see wf_mix.c).
+*/
+bool generates_float(struct COMMON_USER_PARAMS *user)
+{
+    return user->save_as_float &&
+           ((user->num_mix > 0U) ||
+            (!user->per_channel &&
+             ((user->wf_type == WAVEFORM_TYPE_SINE) || (user->wf_type == WAVEFORM_TYPE_PINK) ||
+              (user->wf_type == WAVEFORM_TYPE_SWEEP))));
+}
+
+/*
+** Initialise the state of a stream so that it will generate from the very first frame.
+*/
+void generate_init(struct WAVEFORM_STATE *state)
+{
+    memset(state, 0, sizeof(struct WAVEFORM_STATE));
+
+    state->sample_number = 0;
+}
+
+/*
+** Release anything the stream's state has allocated (i.e. the channels' own streams for --chan,
+** or the mixed waveforms' streams for --mix). Must be called when a stream is finished with, once
+** it has generated anything.
+*/
+void generate_free(struct WAVEFORM_STATE *state)
+{
+    free_mix(state);
+    free_channels(state);
+}
+
+/*
+** Move a stream to any frame, so that the next block generated starts there.
+** Periodic waveforms are calculated directly from the frame number so they only need the
+** position updating, as does white noise, while pink noise has its own state to move.
+** With mixed waveforms (--mix) or per-channel waveforms (--chan) each of their streams is moved instead.
+*/
+void generate_seek(struct WAVEFORM_STATE *state,
+                   struct COMMON_USER_PARAMS *user,
+                   struct ADDITIONAL_USER_PARAMS *extra,
+                   uint64_t frame)
+{
+    if (user->num_mix > 0U) {
+        seek_mix(state, user, extra, frame);
+    }
+    else if (user->per_channel) {
+        seek_channels(state, user, extra, frame);
+    }
+    else {
+        switch (user->wf_type) {
+        case WAVEFORM_TYPE_PINK:
+        case WAVEFORM_TYPE_WHITE:
+            seek_noise(state, user, extra, frame);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    /* Noise-shaped dither starts again from wherever the stream is moved to.*/
+    memset(state->dither_errors, 0, sizeof(state->dither_errors));
+
+    state->sample_number = frame;
+}
+
+/*
+** Generate a block of the requested waveform by calling its generator.
+** This does not move the stream on (see generate_block()).
+*/
+void generate_direct(struct WAVEFORM_STATE *state,
+                     struct COMMON_USER_PARAMS *user,
+                     struct ADDITIONAL_USER_PARAMS *extra,
+                     SAMPLE   *buffer,
+                     uint32_t  num_frames)
+{
+    switch (user->wf_type) {
+    case WAVEFORM_TYPE_SILENCE:
+        generate_silence(user, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_SAW:
+        generate_saw(state, user, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_SQUARE:
+        generate_square(state, user, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_STEPS:
+        generate_steps(state, user, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_COUNTER:
+        generate_counter(state, user, extra, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_SINE:
+        generate_sine(state, user, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_BURST:
+        generate_burst(state, user, extra, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_PINK:
+        generate_pink(state, user, extra, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_WHITE:
+        generate_white(state, user, extra, buffer, num_frames);
+        break;
+
+    case WAVEFORM_TYPE_SWEEP:
+        generate_sweep(state, user, extra, buffer, num_frames);
+        break;
+
+    default:
+        /* Non-specified types are guarded against in the options parsing module.*/
+        generate_silence(user, buffer, num_frames);
+        break;
+    }
+}
+
+/*
+** Generate the next block of the requested waveform into an interleaved buffer.
+** The buffer must hold at least (num_frames * num_channels) samples. The first frame
+** generated is the one given by state->sample_number, which is then moved on to the
+** frame following the block.
+**
+** Periodic waveforms are copied from a cached period table where possible, channels with their
+** own waveforms (--chan) are each generated separately and interleaved, and mixed waveforms
+** (--mix) are each generated separately and summed.
+*/
+void generate_block(struct WAVEFORM_STATE *state,
+                    struct COMMON_USER_PARAMS *user,
+                    struct ADDITIONAL_USER_PARAMS *extra,
+                    SAMPLE   *buffer,
+                    uint32_t  num_frames)
+{
+    if (user->num_mix > 0U) {
+        generate_mix(state, user, extra, buffer, num_frames);
+    }
+    else if (user->per_channel) {
+        generate_channels(state, user, extra, buffer, num_frames);
+    }
+    else if (!period_cache_generate(state, user, extra, buffer, num_frames)) {
+        generate_direct(state, user, extra, buffer, num_frames);
+    }
+
+    state->sample_number += num_frames;
+}
@@ -0,0 +1,154 @@
+/*
+** wf_header.c
+**
+** Write the RIFF (or RF64) chunk headers that precede the sample data, as described by the
+** user's parameters. Used for WAV files, for piped output and by the library.
+*/
+#include "riff.h"
+#include "wavgen.h"
+
+/*
+** Append one chunk (or chunk header) to the headers being built in memory.
+** Returns true if there was room for it.
+*/
+static bool append_chunk(struct OUTPUT_WRITER *writer, const void *chunk, size_t chunk_bytes)
+{
+    uint8_t *destination = writer_reserve(writer, chunk_bytes);
+
+    if (destination == NULL) {
+        return false;
+    }
+
+    memcpy(destination, chunk, chunk_bytes);
+    return writer_commit(writer, chunk_bytes);
+}
+
+/*
+** Initialise all the chunk headers that precede the sample data and write them into memory.
+** This is done once up-front and again, for a regular file whose length turned out to differ
+** from the one expected (e.g. an unbounded stream), to "back-patch" the final sizes.
+**
+** param  num_data_bytes : The number of data bytes that follow, or RIFF_UNBOUNDED_SIZE.
+** param  reserve_ds64   : True to reserve space for a ds64 chunk even if it isn't needed yet.
+** Returns the size of the headers, or zero if they did not fit in the buffer.
+*/
+size_t headers_to_buffer(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, uint64_t num_data_bytes,
+                         bool reserve_ds64, uint8_t *buffer, size_t capacity)
+{
+    bool     success = true;
+    bool     is_rf64;
+    uint64_t num_frames;
+
+    /* The header information that describes the WAV file, and the memory it is written to.*/
+    struct RIFF_HEADER        riff_header;
+    struct RIFF_DS64_CHUNK    riff_ds64;
+    struct RIFF_FMT_CHUNK     riff_fmt;
+    struct RIFF_EXT_FMT_CHUNK riff_fact;
+    struct RIFF_DATA_CHUNK    riff_data;
+    struct OUTPUT_WRITER      writer;
+
+    if (num_data_bytes == RIFF_UNBOUNDED_SIZE) {
+        num_frames = UINT64_MAX;
+    }
+    else {
+        num_frames = num_data_bytes / ((uint64_t) user->num_channels * user->bytes_per_sample);
+    }
+
+    /*
+    ** Initialise the RIFF header. Files too big for the 32-bit RIFF sizes are written as
+    ** RF64 instead, with the real sizes in a ds64 chunk straight after the header.
+    */
+    is_rf64 = riff_needs_rf64(num_data_bytes, user->save_as_float);
+    reserve_ds64 = reserve_ds64 || is_rf64;
+    riff_init_header(&riff_header, num_data_bytes, user->save_as_float, reserve_ds64);
+
+    if (is_rf64) {
+        riff_init_ds64(&riff_ds64, num_data_bytes, num_frames, user->save_as_float);
+        log_extra(fixed, "Total RF64 chunk size is %" PRIu64 " bytes.\n", riff_ds64.RiffSize);
+    }
+    else {
+        riff_init_junk(&riff_ds64);
+        log_extra(fixed, "Total RIFF chunk size is %u bytes.\n", riff_header.ChunkSize);
+    }
+
+    /*
+    ** Initialise the FORMAT chunk from the various user-defined parameters.
+    */
+    riff_init_format(&riff_fmt, user->sample_rate, user->save_as_float, user->num_channels,
+                     user->bytes_per_sample, user->bits_per_sample);
+
+    /*
+    ** Only if floating-point samples are being written, an EXTENDED FORMAT chunk is required too.
+    */
+    if (user->save_as_float) {
+        riff_init_fact(&riff_fact, num_frames);
+    }
+
+    /*
+    ** Initialise the DATA chunk header.
+    */
+    riff_init_data_hdr(&riff_data, num_data_bytes, is_rf64);
+
+    /*
+    ** The RIFF header chunk comes first. An RF64 header must be followed immediately by the
+    ** ds64 chunk (or the JUNK chunk keeping its place), then the format chunk.
+    */
+    writer_init_mapped(&writer, buffer, capacity);
+
+    if (!append_chunk(&writer, &riff_header, sizeof(riff_header))) {
+        log_info(fixed, "Error: failed to write RIFF header.\n");
+        success = false;
+    }
+
+    if (reserve_ds64 && success && !append_chunk(&writer, &riff_ds64, sizeof(riff_ds64))) {
+        log_info(fixed, "Error: failed to write DS64 chunk.\n");
+        success = false;
+    }
+
+    if (success && !append_chunk(&writer, &riff_fmt, sizeof(riff_fmt))) {
+        log_info(fixed, "Error: failed to write FMT chunk.\n");
+        success = false;
+    }
+
+    /*
+    ** If this is a floating-point file, an EXTENDED FMT chunk is mandatory.
+    */
+    if (user->save_as_float && success && !append_chunk(&writer, &riff_fact, sizeof(riff_fact))) {
+        log_info(fixed, "Error: failed to write EXTENDED FMT chunk.\n");
+        success = false;
+    }
+
+    /*
+    ** Now the DATA chunk (HEADER ONLY), immediately preceeding the sample data itself.
+    */
+    if (success && !append_chunk(&writer, &riff_data, sizeof(riff_data))) {
+        log_info(fixed, "Error: failed to write DATA chunk.\n");
+        success = false;
+    }
+
+    return success ? writer.used : 0;
+}
+
+/*
+** Write all the chunk headers that precede the sample data to the file (possibly stdout).
+** They are built in memory by headers_to_buffer() and written in one go.
+** Returns true if the headers were written successfully.
+*/
+bool write_headers(struct FIXED_PARAMS *fixed, struct COMMON_USER_PARAMS *user, FILE *wavfile,
+                   uint64_t num_data_bytes, bool reserve_ds64)
+{
+    uint8_t headers[MAX_HEADER_BYTES];
+    size_t  size;
+
+    size = headers_to_buffer(fixed, user, num_data_bytes, reserve_ds64, headers, sizeof(headers));
+    if (size == 0) {
+        return false;
+    }
+
+    if (fwrite(headers, 1, size, wavfile) != size) {
+        log_info(fixed, "Error: failed to write the headers.\n");
+        return false;
+    }
+
+    return true;
+}
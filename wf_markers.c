@@ -9,33 +9,43 @@
 #include "wavgen.h"
 
 /*
-** Adds a channel marker to the current sample with no regard to the waveform type.
+** Adds channel markers to every sample in an interleaved buffer with no regard to the waveform type.
 ** Returns true if markers were added.
 */
-bool add_markers(struct FIXED_PARAMS *fixed,
-                 bool   markers_in_msb)
+bool add_markers(SAMPLE   *buffer,
+                 uint32_t  num_frames,
+                 uint16_t  num_channels,
+                 bool      markers_in_msb)
 {
-    uint32_t marker_value = fixed->current_chnl + 1;
+    uint32_t keep_mask;
+    uint32_t markers[MAX_CHANNELS];
+    uint32_t frame;
+    uint16_t chnl;
 
-    if (markers_in_msb) {
-        fixed->sample_value.i &= 0x00FFFFFF;
-        fixed->sample_value.i |= ((0xC0 + marker_value) << 24);
+    /* Work out the mask and the (one-based) marker for each channel once, not per sample.*/
+    keep_mask = markers_in_msb ? 0x00FFFFFFU : 0xFFFFFF00U;
+    for (chnl = 0; chnl < num_channels; ++chnl) {
+        markers[chnl] = markers_in_msb ? ((0xC0U + chnl + 1U) << 24) : (0xC0U + chnl + 1U);
     }
-    else {
-        fixed->sample_value.i &= 0xFFFFFF00;
-        fixed->sample_value.i |= (0xC0 + marker_value);
+
+    for (frame = 0; frame < num_frames; ++frame) {
+        for (chnl = 0; chnl < num_channels; ++chnl) {
+            buffer->i = (int32_t) (((uint32_t) buffer->i & keep_mask) | markers[chnl]);
+            ++buffer;
+        }
     }
 
     return true;
 }
 
 /*
-** Check whether channel markers should be added, and add them if so.
+** Check whether channel markers should be added to a block, and add them if so.
 ** Returns true if markers were added.
 */
-bool check_markers(struct FIXED_PARAMS *fixed,
-                   struct COMMON_USER_PARAMS *user,
-                   struct ADDITIONAL_USER_PARAMS *extra)
+bool check_markers(struct COMMON_USER_PARAMS *user,
+                   struct ADDITIONAL_USER_PARAMS *extra,
+                   SAMPLE   *buffer,
+                   uint32_t  num_frames)
 {
     bool added = false;
 
@@ -55,6 +65,7 @@ bool check_markers(struct FIXED_PARAMS *fixed,
         case WAVEFORM_TYPE_SINE:
         case WAVEFORM_TYPE_SQUARE:
         case WAVEFORM_TYPE_BURST:
+        case WAVEFORM_TYPE_SWEEP:
         break;
 
         /* These types MAY have markers added if the output format is not float.*/
@@ -64,7 +75,7 @@ bool check_markers(struct FIXED_PARAMS *fixed,
         case WAVEFORM_TYPE_PINK:
         case WAVEFORM_TYPE_WHITE:
         if (!user->save_as_float) {
-            added = add_markers(fixed, extra->markers_in_msb);
+            added = add_markers(buffer, num_frames, user->num_channels, extra->markers_in_msb);
         }
         break;
 
@@ -0,0 +1,195 @@
+/*
+** wf_mix.c
+**
+** The mixing bus (--mix). The main waveform (-t) and each waveform mixed with it are generated
+** as streams of their own, with their own generator state, and summed into one block, each at its
+** own gain (worked out from its level by gain_from_params()). This makes e.g. the SMPTE and CCIF
+** two-tone intermodulation signals, or a tone over a noise floor, in a single pass.
+**
+** The sum is accumulated in double-precision, which has room for any number of full-scale sources,
+** so nothing is clamped as each source is added. There is then a single rounding and saturation
+** pass into the block, or for float output a single conversion without any saturation at all (as
+** float samples can go beyond full-scale). The headroom (how far the sum of the gains is below
+** full-scale) is worked out once when the options are parsed, with a warning if it may clip.
+**
+** As for per-channel waveforms (see wf_channels.c) a block is worked through a chunk of frames at
+** a time, so that the accumulator and each source's samples stay in the L1 cache.
+*/
+#include "wavgen.h"
+
+#define MIX_CHUNK_SAMPLES (2048U)   // Samples summed at a time (kept on the stack).
+#define MIX_MAX_SAMPLE    ((double) INT32_MAX)
+#define MIX_MIN_SAMPLE    ((double) INT32_MIN)
+
+/*
+** Make the parameters of the stream for one source on the bus: the main waveform (source zero)
+** or one of the mixed waveforms. Each is generated as integer samples at full-scale. Each mixed
+** waveform has the next noise seed, so that noise sources aren't the same as each other.
+*/
+static void mix_params(struct COMMON_USER_PARAMS *user,
+                       struct ADDITIONAL_USER_PARAMS *extra,
+                       uint8_t source,
+                       struct COMMON_USER_PARAMS *src_user,
+                       struct ADDITIONAL_USER_PARAMS *src_extra)
+{
+    *src_user  = *user;
+    *src_extra = *extra;
+
+    src_user->num_mix       = 0U;
+    src_user->save_as_float = false;
+
+    if (source > 0U) {
+        src_user->wf_type      = user->mix[source - 1U].wf_type;
+        src_user->frequency_hz = user->mix[source - 1U].frequency_hz;
+        src_user->per_channel  = false;
+        src_extra->seed        = extra->seed + source;
+    }
+}
+
+/*
+** Get the stream's mixed waveforms' states, creating them (at the stream's position) the first time.
+** Returns NULL if they could not be allocated.
+*/
+static struct WAVEFORM_STATE *mix_states(struct WAVEFORM_STATE *state,
+                                         struct COMMON_USER_PARAMS *user,
+                                         struct ADDITIONAL_USER_PARAMS *extra)
+{
+    if (state->mix_states == NULL) {
+        state->mix_states = malloc((1U + user->num_mix) * sizeof(struct WAVEFORM_STATE));
+        if (state->mix_states == NULL) {
+            return NULL;
+        }
+        memset(state->mix_states, 0, (1U + user->num_mix) * sizeof(struct WAVEFORM_STATE));
+        state->num_mix_states = 1U + user->num_mix;
+        seek_mix(state, user, extra, state->sample_number);
+    }
+
+    return state->mix_states;
+}
+
+/*
+** The single pass from the accumulated sum to integer samples: rounding symmetrically (as the
+** level stage does, see wf_gain.c) and saturating. Written so that the compiler can vectorise it.
+*/
+static void mix_saturate(const double *sum, SAMPLE *output, size_t num_samples)
+{
+    size_t index;
+    double value;
+
+    for (index = 0; index < num_samples; ++index) {
+        value = sum[index] + ((sum[index] < 0.0) ? -0.5 : 0.5);
+        value = (value > MIX_MAX_SAMPLE) ? MIX_MAX_SAMPLE : value;
+        value = (value < MIX_MIN_SAMPLE) ? MIX_MIN_SAMPLE : value;
+        output[index].i = (int32_t) value;
+    }
+}
+
+/*
+** Generate a block of the main waveform mixed with the others, into an interleaved buffer.
+** The samples are already at their final level, and are floats if generates_float() is true.
+** Like generate_direct(), this does not move the stream on (but the sources' streams are).
+** If the sources' states could not be allocated, the block is silent.
+*/
+void generate_mix(struct WAVEFORM_STATE *state,
+                  struct COMMON_USER_PARAMS *user,
+                  struct ADDITIONAL_USER_PARAMS *extra,
+                  SAMPLE   *buffer,
+                  uint32_t  num_frames)
+{
+    struct COMMON_USER_PARAMS     src_user[1U + MAX_MIX_SOURCES];
+    struct ADDITIONAL_USER_PARAMS src_extra[1U + MAX_MIX_SOURCES];
+    struct WAVEFORM_STATE *states;
+    double   gains[1U + MAX_MIX_SOURCES];
+    double   sum[MIX_CHUNK_SAMPLES];
+    SAMPLE   samples[MIX_CHUNK_SAMPLES];
+    uint32_t chunk_frames = MIX_CHUNK_SAMPLES / user->num_channels;
+    uint32_t frames;
+    size_t   num_samples;
+    size_t   index;
+    uint8_t  source;
+
+    states = mix_states(state, user, extra);
+    if (states == NULL) {
+        memset(buffer, 0, (size_t) num_frames * user->num_channels * sizeof(SAMPLE));
+        return;
+    }
+
+    for (source = 0; source <= user->num_mix; ++source) {
+        mix_params(user, extra, source, &src_user[source], &src_extra[source]);
+        gains[source] = (source == 0U) ? user->mix_gain : user->mix[source - 1U].gain;
+
+        /* Float output is normalised to 1.0, which can be folded into the gains.*/
+        if (generates_float(user)) {
+            gains[source] /= (double) MAX_LEVEL_32BIT;
+        }
+    }
+
+    for (; num_frames > 0; num_frames -= frames) {
+        frames      = (num_frames < chunk_frames) ? num_frames : chunk_frames;
+        num_samples = (size_t) frames * user->num_channels;
+
+        /* The main waveform starts the sum off.*/
+        generate_block(&states[0], &src_user[0], &src_extra[0], samples, frames);
+        for (index = 0; index < num_samples; ++index) {
+            sum[index] = (double) samples[index].i * gains[0];
+        }
+
+        for (source = 1; source <= user->num_mix; ++source) {
+            generate_block(&states[source], &src_user[source], &src_extra[source], samples, frames);
+            for (index = 0; index < num_samples; ++index) {
+                sum[index] += (double) samples[index].i * gains[source];
+            }
+        }
+
+        if (generates_float(user)) {
+            for (index = 0; index < num_samples; ++index) {
+                buffer[index].f = (float) sum[index];
+            }
+        }
+        else {
+            mix_saturate(sum, buffer, num_samples);
+        }
+
+        buffer += num_samples;
+    }
+}
+
+/*
+** Move each source's stream to the given frame (if they have been created yet).
+*/
+void seek_mix(struct WAVEFORM_STATE *state,
+              struct COMMON_USER_PARAMS *user,
+              struct ADDITIONAL_USER_PARAMS *extra,
+              uint64_t frame)
+{
+    struct COMMON_USER_PARAMS     src_user;
+    struct ADDITIONAL_USER_PARAMS src_extra;
+    uint8_t source;
+
+    if (state->mix_states == NULL) {
+        return;
+    }
+
+    for (source = 0; source <= user->num_mix; ++source) {
+        mix_params(user, extra, source, &src_user, &src_extra);
+        generate_free(&state->mix_states[source]);
+        generate_init(&state->mix_states[source]);
+        generate_seek(&state->mix_states[source], &src_user, &src_extra, frame);
+    }
+}
+
+/*
+** Free the sources' streams (if any), including anything they have allocated themselves.
+*/
+void free_mix(struct WAVEFORM_STATE *state)
+{
+    uint8_t source;
+
+    for (source = 0; (state->mix_states != NULL) && (source < state->num_mix_states); ++source) {
+        generate_free(&state->mix_states[source]);
+    }
+
+    free(state->mix_states);
+    state->mix_states     = NULL;
+    state->num_mix_states = 0U;
+}
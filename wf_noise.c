@@ -3,108 +3,695 @@
 **
 ** Generate white/pink noise sources, typically used for frequency analysis or
 ** for measuring/setting output levels.
+**
+** Pink noise is made by filtering white noise with Paul Kellet's 1/f filter, in double-precision
+** or (with --pink kellet-float) single-precision, or by the Voss-McCartney algorithm (--pink voss),
+** which sums white noise values that are each held for twice as long as the one before. Every
+** channel has its own filter state, and the channels of a frame are filtered at once using the
+** compiler's vector extensions (as many channels as fit in the target's SIMD registers).
 **/
 #include <string.h>
-#include <time.h>
 #include "wavgen.h"
 
+#define NOISE_LANES     (4U)                        // Noise values generated at once.
+#define NOISE_GAMMA     (0x9E3779B97F4A7C15ULL)     // The SplitMix64 increment (2^64 / golden ratio).
+#define NOISE_CHANNELS  (0xD1B54A32D192ED03ULL)     // Separates the per-channel streams' keys.
+
+typedef uint64_t NOISE_VEC __attribute__((vector_size(NOISE_LANES * sizeof(uint64_t))));
+
+/*
+** The SplitMix64 output function, written so that it works on single values and on vectors alike.
+** Algorithm source : https://prng.di.unimi.it/splitmix64.c
+*/
+#define NOISE_MIX(z)                                          \
+    do {                                                      \
+        (z) ^= (z) >> 30; (z) *= 0xBF58476D1CE4E5B9ULL;       \
+        (z) ^= (z) >> 27; (z) *= 0x94D049BB133111EBULL;       \
+        (z) ^= (z) >> 31;                                     \
+    } while (0)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NOISE_HAVE_AVX2
+#endif
+
 /*
-** Generate a pseudo-random number for noise generation.
-** Algorithm source : http://www.firstpr.com.au/dsp/rand31/
+** The pink-noise filter state cannot be calculated directly for an arbitrary sample, so seeking
+** restarts the filter this many noise values before the target and lets it settle. The filter
+** taps decay well below the precision of a double within this distance, so the settled state
+** matches the one reached by generating from the very start.
 */
-uint32_t rand_31(int32_t *seed) {
-    uint32_t hi, lo;
+#define PINK_SEEK_SETTLE   (65536U)
 
-    lo = 16807UL * (*seed & 0xFFFFUL);
-    hi = 16807UL * (*seed >> 16);
+#define PINK_LANES          (4U)    // Channels filtered at once in double-precision.
+#define PINK_FLOAT_LANES    (8U)    // Channels filtered at once in single-precision.
+#define PINK_CHUNK_FRAMES   (256U)  // Frames of Voss-McCartney row values (or settling) on the stack.
+#define PINK_VOSS_DIVISOR   ((double) (PINK_VOSS_ROWS + 1U))   // The number of values summed by Voss-McCartney.
 
-    lo += (hi & 0x7FFFUL) << 16;
-    lo += hi >> 15;
+typedef double  PINK_VEC   __attribute__((vector_size(PINK_LANES * sizeof(double))));
+typedef int32_t PINK_IVEC  __attribute__((vector_size(PINK_LANES * sizeof(int32_t))));
+typedef float   PINK_FVEC  __attribute__((vector_size(PINK_FLOAT_LANES * sizeof(float))));
+typedef int32_t PINK_FIVEC __attribute__((vector_size(PINK_FLOAT_LANES * sizeof(int32_t))));
 
-    if (lo > 0x7FFFFFFFUL) {
-        lo -= 0x7FFFFFFFUL;
+/*
+** The noise source is counter-based: each channel has its own stream, given by a key made from
+** the seed (--seed) and the channel number, and the value for a frame is a mix of the key and the
+** frame number (as SplitMix64 does with its state). Nothing is carried from one value to the
+** next, so any frame can be generated directly (i.e. seeking and parallel chunks are free),
+** several frames can be generated at once in SIMD lanes, and each value has a full 32 bits.
+*/
+static uint64_t noise_key(struct ADDITIONAL_USER_PARAMS *extra, uint16_t chnl)
+{
+    uint64_t key = extra->seed + ((uint64_t) (extra->first_channel + chnl) * NOISE_CHANNELS);
+
+    NOISE_MIX(key);
+
+    return key;
+}
+
+/*
+** The whole 64-bit noise value for one frame of a channel's stream.
+*/
+static inline uint64_t noise_mix(uint64_t key, uint64_t frame)
+{
+    uint64_t z = key + (frame * NOISE_GAMMA);
+
+    NOISE_MIX(z);
+
+    return z;
+}
+
+/*
+** The noise value (a full-range 32-bit sample) for one frame of a channel's stream.
+** This is the upper half of the 64-bit value (the lower half is used by Voss-McCartney pink noise).
+*/
+static inline int32_t noise_value(uint64_t key, uint64_t frame)
+{
+    return (int32_t) (noise_mix(key, frame) >> 32);
+}
+
+/*
+** Fill one channel of an interleaved buffer with noise from the stream with the given key,
+** NOISE_LANES frames at a time. If lower isn't NULL, the lower halves of the 64-bit values
+** are put there (in the same layout). Returns the number of frames filled (the rest are left
+** for the scalar loop).
+*/
+static inline __attribute__((always_inline))
+uint32_t noise_fill_lanes(SAMPLE *buffer, SAMPLE *lower, uint16_t stride, uint64_t key, uint64_t first_frame,
+                          uint32_t num_frames)
+{
+    NOISE_VEC counter;
+    NOISE_VEC z;
+    uint32_t  frame;
+    uint32_t  lane;
+
+    for (lane = 0; lane < NOISE_LANES; ++lane) {
+        counter[lane] = key + ((first_frame + lane) * NOISE_GAMMA);
+    }
+
+    for (frame = 0; (frame + NOISE_LANES) <= num_frames; frame += NOISE_LANES) {
+        z = counter;
+        NOISE_MIX(z);
+
+        for (lane = 0; lane < NOISE_LANES; ++lane) {
+            buffer[(size_t) (frame + lane) * stride].i = (int32_t) (z[lane] >> 32);
+        }
+        if (lower != NULL) {
+            for (lane = 0; lane < NOISE_LANES; ++lane) {
+                lower[(size_t) (frame + lane) * stride].i = (int32_t) (uint32_t) z[lane];
+            }
+        }
+
+        counter += NOISE_LANES * NOISE_GAMMA;
     }
 
-    return ( *seed = (int32_t) lo);
+    return frame;
+}
+
+#if defined(NOISE_HAVE_AVX2)
+/*
+** AVX2 version, which has twice the vector width (chosen at run-time).
+*/
+__attribute__((target("avx2")))
+static uint32_t noise_fill_avx2(SAMPLE *buffer, SAMPLE *lower, uint16_t stride, uint64_t key, uint64_t first_frame,
+                                uint32_t num_frames)
+{
+    return noise_fill_lanes(buffer, lower, stride, key, first_frame, num_frames);
 }
+#endif
 
 /*
-** Generate white noise.
-** Algorithm source : https://www.firstpr.com.au/dsp/rand31/
+** Fill one channel of an interleaved buffer (stride samples apart) with noise from a stream,
+** and optionally the same channel of a second buffer with the lower halves of the values.
+*/
+static void noise_fill(SAMPLE *buffer, SAMPLE *lower, uint16_t stride, uint64_t key, uint64_t first_frame,
+                       uint32_t num_frames)
+{
+    uint64_t value;
+    uint32_t frame;
+
+#if defined(NOISE_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        frame = noise_fill_avx2(buffer, lower, stride, key, first_frame, num_frames);
+    }
+    else
+#endif
+    {
+        frame = noise_fill_lanes(buffer, lower, stride, key, first_frame, num_frames);
+    }
+
+    for (; frame < num_frames; ++frame) {
+        value = noise_mix(key, first_frame + frame);
+
+        buffer[(size_t) frame * stride].i = (int32_t) (value >> 32);
+        if (lower != NULL) {
+            lower[(size_t) frame * stride].i = (int32_t) (uint32_t) value;
+        }
+    }
+}
+
+/*
+** Fill a block of frames with white noise: a stream per channel for uncorrelated noise,
+** otherwise the first channel's stream repeated on every channel.
+*/
+static void noise_fill_block(struct COMMON_USER_PARAMS *user,
+                             struct ADDITIONAL_USER_PARAMS *extra,
+                             SAMPLE   *buffer,
+                             uint64_t  first_frame,
+                             uint32_t  num_frames)
+{
+    uint32_t frame;
+    uint16_t chnl;
+
+    if (extra->uncorrelated) {
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            noise_fill(&buffer[chnl], NULL, user->num_channels, noise_key(extra, chnl), first_frame, num_frames);
+        }
+    }
+    else {
+        noise_fill(buffer, NULL, user->num_channels, noise_key(extra, 0), first_frame, num_frames);
+
+        for (frame = 0; (user->num_channels > 1U) && (frame < num_frames); ++frame) {
+            for (chnl = 1; chnl < user->num_channels; ++chnl) {
+                buffer[chnl] = buffer[0];
+            }
+            buffer += user->num_channels;
+        }
+    }
+}
+
+/*
+** Pass one white noise value through the 1/f filter (updating its taps) to make it pink.
+** Written so that it works on single values and on vectors alike, in float or double (T).
+** Algorithm source : https://www.firstpr.com.au/dsp/pink-noise/
+*/
+#define PINK_FILTER(T, b, white, pink)                                              \
+    do {                                                                            \
+        (b)[0] = (T) 0.99886 * (b)[0] + (white) * (T) 0.0555179;                    \
+        (b)[1] = (T) 0.99332 * (b)[1] + (white) * (T) 0.0750759;                    \
+        (b)[2] = (T) 0.96900 * (b)[2] + (white) * (T) 0.1538520;                    \
+        (b)[3] = (T) 0.86650 * (b)[3] + (white) * (T) 0.3104856;                    \
+        (b)[4] = (T) 0.55000 * (b)[4] + (white) * (T) 0.5329522;                    \
+        (b)[5] = (T) -0.7616 * (b)[5] - (white) * (T) 0.0168980;                    \
+        (pink) = (b)[0] + (b)[1] + (b)[2] + (b)[3] + (b)[4] + (b)[5] + (b)[6] +     \
+                 ((white) * (T) 0.5362);                                            \
+        (b)[6] = (white) * (T) 0.115926;                                            \
+    } while (0)
+
+/*
+** Filter one channel of a block of white noise in place, one sample at a time, in float or
+** double (T). Used for channels left over from the groups filtered by the functions below.
 **
-** Example command : One second of white noise at -20dBFS (to be safe).
-** ./wavgen -t white -b 32 -c 2 -d 1000 -l -20.0 ~/tmp/test-white.wav
+** Pink noise PEAK level is approximately 5x that of the source white noise, so it is scaled.
+** This results in noise that measures an RMS level of around -15dBFS.
+** For float output it is normalised to 1.0 straight away.
+*/
+#define PINK_KELLET_CHANNEL(T, taps, chnl, samples, stride, num_frames, as_float)      \
+    do {                                                                                \
+        T        b[7];                                                                  \
+        T        white;                                                                 \
+        T        pink;                                                                  \
+        uint32_t frame;                                                                 \
+        unsigned tap;                                                                   \
+                                                                                        \
+        for (tap = 0; tap < 7U; ++tap) {                                                \
+            b[tap] = (T) (taps)[tap][chnl];                                             \
+        }                                                                               \
+        for (frame = 0; frame < (num_frames); ++frame, (samples) += (stride)) {         \
+            /* Scale the white noise sample to a +/- half-scale audio sample.*/         \
+            white = (T) (samples)->i / (T) 2.0;                                         \
+            PINK_FILTER(T, b, white, pink);                                             \
+            if (as_float) {                                                             \
+                (samples)->f = (float) ((pink / (T) 5.0) / (T) MAX_LEVEL_32BIT);        \
+            }                                                                           \
+            else {                                                                      \
+                (samples)->i = (int32_t) (pink / (T) 5.0);                              \
+            }                                                                           \
+        }                                                                               \
+        for (tap = 0; tap < 7U; ++tap) {                                                \
+            (taps)[tap][chnl] = (double) b[tap];                                        \
+        }                                                                               \
+    } while (0)
+
+/*
+** Filter a group of PINK_LANES adjacent channels of a block of white noise in place, in
+** double-precision, one frame (i.e. one sample of every channel in the group) at a time.
+** This gives exactly the same result as filtering each channel on its own.
+*/
+static inline __attribute__((always_inline))
+void pink_kellet_lanes(double taps[][MAX_CHANNELS], SAMPLE *buffer, uint16_t stride,
+                       uint16_t first_chnl, uint32_t num_frames, bool as_float)
+{
+    PINK_VEC  b[7];
+    PINK_VEC  white;
+    PINK_VEC  pink;
+    PINK_IVEC white_i;
+    PINK_IVEC pink_i;
+    SAMPLE   *samples = &buffer[first_chnl];
+    uint32_t  frame;
+    uint16_t  lane;
+    unsigned  tap;
+
+    for (tap = 0; tap < 7U; ++tap) {
+        memcpy(&b[tap], &taps[tap][first_chnl], sizeof(b[tap]));
+    }
+
+    for (frame = 0; frame < num_frames; ++frame, samples += stride) {
+        memcpy(&white_i, samples, sizeof(white_i));
+        white = __builtin_convertvector(white_i, PINK_VEC) / 2.0;
+
+        PINK_FILTER(double, b, white, pink);
+
+        if (as_float) {
+            pink = (pink / 5.0) / (double) MAX_LEVEL_32BIT;
+            for (lane = 0; lane < PINK_LANES; ++lane) {
+                samples[lane].f = (float) pink[lane];
+            }
+        }
+        else {
+            pink_i = __builtin_convertvector(pink / 5.0, PINK_IVEC);
+            memcpy(samples, &pink_i, sizeof(pink_i));
+        }
+    }
+
+    for (tap = 0; tap < 7U; ++tap) {
+        memcpy(&taps[tap][first_chnl], &b[tap], sizeof(b[tap]));
+    }
+}
+
+/*
+** The same as pink_kellet_lanes() in single-precision, for PINK_FLOAT_LANES channels.
+** The filter taps are kept in double-precision between blocks, which doesn't change them.
+*/
+static inline __attribute__((always_inline))
+void pink_kellet_float_lanes(double taps[][MAX_CHANNELS], SAMPLE *buffer, uint16_t stride,
+                             uint16_t first_chnl, uint32_t num_frames, bool as_float)
+{
+    PINK_FVEC  b[7];
+    PINK_FVEC  white;
+    PINK_FVEC  pink;
+    PINK_FIVEC white_i;
+    PINK_FIVEC pink_i;
+    SAMPLE    *samples = &buffer[first_chnl];
+    uint32_t   frame;
+    uint16_t   lane;
+    unsigned   tap;
+
+    for (tap = 0; tap < 7U; ++tap) {
+        for (lane = 0; lane < PINK_FLOAT_LANES; ++lane) {
+            b[tap][lane] = (float) taps[tap][first_chnl + lane];
+        }
+    }
+
+    for (frame = 0; frame < num_frames; ++frame, samples += stride) {
+        memcpy(&white_i, samples, sizeof(white_i));
+        white = __builtin_convertvector(white_i, PINK_FVEC) / 2.0f;
+
+        PINK_FILTER(float, b, white, pink);
+
+        if (as_float) {
+            pink = (pink / 5.0f) / (float) MAX_LEVEL_32BIT;
+            memcpy(samples, &pink, sizeof(pink));
+        }
+        else {
+            pink_i = __builtin_convertvector(pink / 5.0f, PINK_FIVEC);
+            memcpy(samples, &pink_i, sizeof(pink_i));
+        }
+    }
+
+    for (tap = 0; tap < 7U; ++tap) {
+        for (lane = 0; lane < PINK_FLOAT_LANES; ++lane) {
+            taps[tap][first_chnl + lane] = (double) b[tap][lane];
+        }
+    }
+}
+
+/*
+** Filter the first num_filtered channels of a block of white noise in place, a full group of
+** lanes at a time and then whatever channels are left over on their own.
 */
-void generate_white(struct FIXED_PARAMS *fixed,
-                    struct ADDITIONAL_USER_PARAMS *extra)
+static inline __attribute__((always_inline))
+void pink_kellet_channels(double taps[][MAX_CHANNELS], SAMPLE *buffer, uint16_t stride, uint16_t num_filtered,
+                          uint32_t num_frames, bool as_float, bool single_precision)
 {
-    static int32_t seed = 1;
-    static int32_t last_sample;
+    SAMPLE  *samples;
+    uint16_t chnl = 0;
 
-    /*
-    ** For uncorrelated noise, generate one new sample per channel,
-    ** otherwise just repeat the sample generated for channel 0.
-    */
-    if ((fixed->current_chnl == 0) || (extra->uncorrelated)) {
-        /* Get a white noise sample and scale it to the +/- 32-bit audio sample range.*/
-        last_sample = (rand_31(&seed) - (0x7FFFFFFFUL / 2)) * 2;
-        fixed->sample_value.i = last_sample;
+    if (single_precision) {
+        for (; (chnl + PINK_FLOAT_LANES) <= num_filtered; chnl += PINK_FLOAT_LANES) {
+            pink_kellet_float_lanes(taps, buffer, stride, chnl, num_frames, as_float);
+        }
+        for (; chnl < num_filtered; ++chnl) {
+            samples = &buffer[chnl];
+            PINK_KELLET_CHANNEL(float, taps, chnl, samples, stride, num_frames, as_float);
+        }
     }
     else {
-        /* For CORRELATED noise, repeat channel 0.*/
-        fixed->sample_value.i = last_sample;
+        for (; (chnl + PINK_LANES) <= num_filtered; chnl += PINK_LANES) {
+            pink_kellet_lanes(taps, buffer, stride, chnl, num_frames, as_float);
+        }
+        for (; chnl < num_filtered; ++chnl) {
+            samples = &buffer[chnl];
+            PINK_KELLET_CHANNEL(double, taps, chnl, samples, stride, num_frames, as_float);
+        }
     }
 }
 
+#if defined(NOISE_HAVE_AVX2)
+/*
+** AVX2 version, which has twice the vector width (chosen at run-time).
+*/
+__attribute__((target("avx2")))
+static void pink_kellet_avx2(double taps[][MAX_CHANNELS], SAMPLE *buffer, uint16_t stride, uint16_t num_filtered,
+                             uint32_t num_frames, bool as_float, bool single_precision)
+{
+    pink_kellet_channels(taps, buffer, stride, num_filtered, num_frames, as_float, single_precision);
+}
+#endif
+
+/*
+** Set up the Voss-McCartney rows as they are when the given frame is next to be generated.
+**
+** Counting frames from one, row k is given a new value on every frame whose number has k trailing
+** zeros (i.e. every 2^(k+1) frames), so the frame at which each row was last changed (and so its
+** value) can be worked out directly. The last row also takes the frames with more zeros than that.
+** The new values are the lower halves of the white noise stream's values for the same frames.
+*/
+static void pink_voss_seek(struct WAVEFORM_STATE *state, uint16_t num_filtered,
+                           struct ADDITIONAL_USER_PARAMS *extra, uint64_t frame)
+{
+    uint64_t key;
+    uint64_t changed;
+    uint16_t chnl;
+    unsigned row;
+
+    for (chnl = 0; chnl < num_filtered; ++chnl) {
+        key = noise_key(extra, chnl);
+        state->pink_sums[chnl] = 0.0;
+
+        for (row = 0; row < PINK_VOSS_ROWS; ++row) {
+            if (row < (PINK_VOSS_ROWS - 1U)) {
+                changed = (((frame + (1ULL << row)) >> (row + 1U)) << (row + 1U)) - (1ULL << row);
+            }
+            else {
+                changed = (frame >> row) << row;
+            }
+
+            if ((int64_t) changed <= 0) {
+                /* Not changed yet, so it has the value it was given before the first frame.*/
+                changed = 0ULL - row;
+            }
+            state->pink_rows[row][chnl] = (double) (int32_t) (uint32_t) noise_mix(key, changed - 1U);
+            state->pink_sums[chnl] += state->pink_rows[row][chnl];
+        }
+    }
+
+    state->pink_rows_set = true;
+}
+
+/*
+** Voss-McCartney pink noise, for one channel of a run of frames: the white noise value plus the
+** sum of the rows, one of which changes on each frame. The rows and their sums are integers,
+** which are held exactly in doubles. Dividing by the number of values summed means the result
+** can never clip (its RMS level is around -17dBFS).
+*/
+static void pink_voss_channel(double rows[][MAX_CHANNELS], double *sums, SAMPLE *buffer, const SAMPLE *values,
+                              uint16_t stride, uint16_t chnl, uint64_t count, uint32_t num_frames, bool as_float)
+{
+    double   sum = sums[chnl];
+    double   pink;
+    uint32_t frame;
+    unsigned row;
+
+    for (frame = 0; frame < num_frames; ++frame, ++count) {
+        row = (unsigned) __builtin_ctzll(count);
+        row = (row < PINK_VOSS_ROWS) ? row : (PINK_VOSS_ROWS - 1U);
+
+        sum += (double) values[chnl].i - rows[row][chnl];
+        rows[row][chnl] = (double) values[chnl].i;
+
+        pink = (sum + (double) buffer[chnl].i) / PINK_VOSS_DIVISOR;
+
+        if (as_float) {
+            buffer[chnl].f = (float) (pink / (double) MAX_LEVEL_32BIT);
+        }
+        else {
+            buffer[chnl].i = (int32_t) pink;
+        }
+
+        values += stride;
+        buffer += stride;
+    }
+
+    sums[chnl] = sum;
+}
+
+/*
+** The same as pink_voss_channel(), for a group of PINK_LANES adjacent channels at once.
+** The row that changes on each frame is the same for every channel.
+*/
+static inline __attribute__((always_inline))
+void pink_voss_lanes(double rows[][MAX_CHANNELS], double *sums, SAMPLE *buffer, const SAMPLE *values,
+                     uint16_t stride, uint16_t first_chnl, uint64_t count, uint32_t num_frames, bool as_float)
+{
+    PINK_VEC  sum;
+    PINK_VEC  value;
+    PINK_VEC  old_value;
+    PINK_VEC  pink;
+    PINK_IVEC value_i;
+    PINK_IVEC white_i;
+    PINK_IVEC pink_i;
+    uint32_t  frame;
+    uint16_t  lane;
+    unsigned  row;
+
+    memcpy(&sum, &sums[first_chnl], sizeof(sum));
+    buffer += first_chnl;
+    values += first_chnl;
+
+    for (frame = 0; frame < num_frames; ++frame, ++count) {
+        row = (unsigned) __builtin_ctzll(count);
+        row = (row < PINK_VOSS_ROWS) ? row : (PINK_VOSS_ROWS - 1U);
+
+        memcpy(&value_i, values, sizeof(value_i));
+        memcpy(&old_value, &rows[row][first_chnl], sizeof(old_value));
+        value = __builtin_convertvector(value_i, PINK_VEC);
+        sum  += value - old_value;
+        memcpy(&rows[row][first_chnl], &value, sizeof(value));
+
+        memcpy(&white_i, buffer, sizeof(white_i));
+        pink = (sum + __builtin_convertvector(white_i, PINK_VEC)) / PINK_VOSS_DIVISOR;
+
+        if (as_float) {
+            pink /= (double) MAX_LEVEL_32BIT;
+            for (lane = 0; lane < PINK_LANES; ++lane) {
+                buffer[lane].f = (float) pink[lane];
+            }
+        }
+        else {
+            pink_i = __builtin_convertvector(pink, PINK_IVEC);
+            memcpy(buffer, &pink_i, sizeof(pink_i));
+        }
+
+        values += stride;
+        buffer += stride;
+    }
+
+    memcpy(&sums[first_chnl], &sum, sizeof(sum));
+}
+
+/*
+** Voss-McCartney pink noise for the first num_filtered channels of a run of frames, a full
+** group of lanes at a time and then whatever channels are left over on their own.
+*/
+static inline __attribute__((always_inline))
+void pink_voss_groups(double rows[][MAX_CHANNELS], double *sums, SAMPLE *buffer, const SAMPLE *values,
+                      uint16_t stride, uint16_t num_filtered, uint64_t count, uint32_t num_frames, bool as_float)
+{
+    uint16_t chnl = 0;
+
+    for (; (chnl + PINK_LANES) <= num_filtered; chnl += PINK_LANES) {
+        pink_voss_lanes(rows, sums, buffer, values, stride, chnl, count, num_frames, as_float);
+    }
+    for (; chnl < num_filtered; ++chnl) {
+        pink_voss_channel(rows, sums, buffer, values, stride, chnl, count, num_frames, as_float);
+    }
+}
+
+#if defined(NOISE_HAVE_AVX2)
+/*
+** AVX2 version, which has twice the vector width (chosen at run-time).
+*/
+__attribute__((target("avx2")))
+static void pink_voss_avx2(double rows[][MAX_CHANNELS], double *sums, SAMPLE *buffer, const SAMPLE *values,
+                           uint16_t stride, uint16_t num_filtered, uint64_t count, uint32_t num_frames, bool as_float)
+{
+    pink_voss_groups(rows, sums, buffer, values, stride, num_filtered, count, num_frames, as_float);
+}
+#endif
+
+/*
+** Generate Voss-McCartney pink noise on the first num_filtered channels of a block.
+*/
+static void pink_voss_channels(struct WAVEFORM_STATE *state, struct ADDITIONAL_USER_PARAMS *extra,
+                               SAMPLE *buffer, uint16_t stride, uint16_t num_filtered,
+                               uint64_t first_frame, uint32_t num_frames, bool as_float)
+{
+    SAMPLE   values[PINK_CHUNK_FRAMES * MAX_CHANNELS];
+    uint64_t count = first_frame + 1U;     // Frames are counted from one.
+    uint32_t frames;
+    uint16_t chnl;
+
+    for (; num_frames > 0; num_frames -= frames, count += frames, buffer += (size_t) frames * stride) {
+        frames = (num_frames < PINK_CHUNK_FRAMES) ? num_frames : PINK_CHUNK_FRAMES;
+
+        /* The white noise, and the new value for whichever row changes on each frame.*/
+        for (chnl = 0; chnl < num_filtered; ++chnl) {
+            noise_fill(&buffer[chnl], &values[chnl], stride, noise_key(extra, chnl), count - 1U, frames);
+        }
+
+#if defined(NOISE_HAVE_AVX2)
+        if (__builtin_cpu_supports("avx2")) {
+            pink_voss_avx2(state->pink_rows, state->pink_sums, buffer, values, stride, num_filtered, count, frames, as_float);
+        }
+        else
+#endif
+        {
+            pink_voss_groups(state->pink_rows, state->pink_sums, buffer, values, stride, num_filtered, count, frames, as_float);
+        }
+    }
+}
+
+/*
+** Generate a block of pink noise from the given frame, with whichever engine was asked for.
+*/
+static void pink_block(struct WAVEFORM_STATE *state,
+                       struct COMMON_USER_PARAMS *user,
+                       struct ADDITIONAL_USER_PARAMS *extra,
+                       SAMPLE   *buffer,
+                       uint64_t  first_frame,
+                       uint32_t  num_frames)
+{
+    uint16_t num_filtered = extra->uncorrelated ? user->num_channels : 1U;
+    bool     as_float     = generates_float(user);
+    uint32_t frame;
+    uint16_t chnl;
+
+    if (extra->pink_type == PINK_VOSS) {
+        if (!state->pink_rows_set) {
+            pink_voss_seek(state, num_filtered, extra, first_frame);
+        }
+        pink_voss_channels(state, extra, buffer, user->num_channels, num_filtered, first_frame, num_frames, as_float);
+    }
+    else {
+        /* The white noise is generated into the buffer first, and then filtered in place.*/
+        noise_fill_block(user, extra, buffer, first_frame, num_frames);
+
+#if defined(NOISE_HAVE_AVX2)
+        if (__builtin_cpu_supports("avx2")) {
+            pink_kellet_avx2(state->pink_taps, buffer, user->num_channels, num_filtered, num_frames, as_float,
+                             extra->pink_type == PINK_KELLET_FLOAT);
+        }
+        else
+#endif
+        {
+            pink_kellet_channels(state->pink_taps, buffer, user->num_channels, num_filtered, num_frames, as_float,
+                                 extra->pink_type == PINK_KELLET_FLOAT);
+        }
+    }
+
+    /* For CORRELATED noise, channels other than 0 repeat channel 0.*/
+    if (num_filtered < user->num_channels) {
+        for (frame = 0; frame < num_frames; ++frame) {
+            for (chnl = 1; chnl < user->num_channels; ++chnl) {
+                buffer[chnl] = buffer[0];
+            }
+            buffer += user->num_channels;
+        }
+    }
+}
+
+/*
+** Generate white noise, from the counter-based noise source described above.
+**
+** Example command : One second of white noise at -20dBFS (to be safe).
+** ./wavgen -t white -b 32 -c 2 -d 1000 -l -20.0 ~/tmp/test-white.wav
+*/
+void generate_white(struct WAVEFORM_STATE *state,
+                    struct COMMON_USER_PARAMS *user,
+                    struct ADDITIONAL_USER_PARAMS *extra,
+                    SAMPLE   *buffer,
+                    uint32_t  num_frames)
+{
+    noise_fill_block(user, extra, buffer, state->sample_number, num_frames);
+}
+
 /*
 ** Generate pink noise.
-** Algorithm source : https://www.firstpr.com.au/dsp/pink-noise/
+** Algorithm sources : https://www.firstpr.com.au/dsp/pink-noise/
+**                     https://www.firstpr.com.au/dsp/pink-noise/allan-2/spectrum2.html (Voss-McCartney)
 **
 ** Example command : One second of pink noise at -10dBFS.
-** ./wavgen -t white -b 32 -c 2 -d 1000 -l -10.0 ~/tmp/test-pink.wav
-*/
-void generate_pink(struct FIXED_PARAMS *fixed,
-                   struct ADDITIONAL_USER_PARAMS *extra)
-{
-    static int32_t seed = 1;
-    static int32_t last_sample;
-    static double  b[7];
-
-    double pink;
-    double white;
-
-    /* Initialise the filter taps before generating the very first sample.*/
-    if ((fixed->sample_number == 0) && (fixed->current_chnl == 0)) {
-        memset(b, 0, sizeof(b));
-    }
-
-    /*
-    ** For uncorrelated noise, generate one new sample per channel,
-    ** otherwise just repeat the sample generated for channel 0.
-    */
-    if ((fixed->current_chnl == 0) || (extra->uncorrelated)) {
-        /* Get a white noise sample and scale it to a +/- audio sample.*/
-        white = (((double) rand_31(&seed)) - ((double) 0x7FFFFFFFUL / 2.0));
-
-        /* 1/f filter the white noise to make it pink.*/
-        b[0] = 0.99886 * b[0] + white * 0.0555179;
-        b[1] = 0.99332 * b[1] + white * 0.0750759;
-        b[2] = 0.96900 * b[2] + white * 0.1538520;
-        b[3] = 0.86650 * b[3] + white * 0.3104856;
-        b[4] = 0.55000 * b[4] + white * 0.5329522;
-        b[5] = -0.7616 * b[5] - white * 0.0168980;
-        pink = b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + (white * 0.5362);
-        b[6] = white * 0.115926;
-
-        /*
-        ** Pink noise PEAK level is approximately 5x that of the source white noise, so scale it.
-        ** This results in noise that measures an RMS level of around -15dBFS.
-        */
-        last_sample = (int32_t) (pink / 5.0);
-        fixed->sample_value.i = last_sample;
+** ./wavgen -t pink -b 32 -c 2 -d 1000 -l -10.0 ~/tmp/test-pink.wav
+*/
+void generate_pink(struct WAVEFORM_STATE *state,
+                   struct COMMON_USER_PARAMS *user,
+                   struct ADDITIONAL_USER_PARAMS *extra,
+                   SAMPLE   *buffer,
+                   uint32_t  num_frames)
+{
+    pink_block(state, user, extra, buffer, state->sample_number, num_frames);
+}
+
+/*
+** Move the noise generators in the stream state to the given frame.
+**
+** White noise is calculated directly from the frame number, so there is nothing to do, as are
+** the Voss-McCartney rows (which are set up before the next block). The 1/f filter depends on
+** the history held in its taps, so it is run (discarding its output) from a little way before
+** the target until it has settled into the state it would have had.
+*/
+void seek_noise(struct WAVEFORM_STATE *state,
+                struct COMMON_USER_PARAMS *user,
+                struct ADDITIONAL_USER_PARAMS *extra,
+                uint64_t frame)
+{
+    SAMPLE   scratch[PINK_CHUNK_FRAMES * MAX_CHANNELS];
+    uint64_t settle = PINK_SEEK_SETTLE;
+    uint32_t frames;
+
+    memset(state->pink_taps, 0, sizeof(state->pink_taps));
+    state->pink_rows_set = false;
+
+    if ((user->wf_type != WAVEFORM_TYPE_PINK) || (extra->pink_type == PINK_VOSS)) {
+        return;
     }
-    else {
-        /* For CORRELATED noise, repeat channel 0.*/
-        fixed->sample_value.i = last_sample;
+
+    if (settle > frame) {
+        settle = frame;
+    }
+
+    for (frame -= settle; settle != 0; settle -= frames, frame += frames) {
+        frames = (settle < PINK_CHUNK_FRAMES) ? (uint32_t) settle : PINK_CHUNK_FRAMES;
+        pink_block(state, user, extra, scratch, frame, frames);
     }
 }
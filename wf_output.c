@@ -3,35 +3,40 @@
 **
 ** Functions to output an output buffer of samples in "standard unified format" in the
 ** format chosen by the user (e.g. with the --bitdepth option). This is not intended to
-** be a completely loss-less process, and it may introduce minor artifacts (no attempt
-** to dither the output is made, for example).
+** be a completely loss-less process, and it may introduce minor artifacts (the output
+** is only dithered if asked for, see wf_dither.c).
 **
 ** Some pre-processing functions are included here too (mostly level adjustment).
 **
-** The data is either written to file or to stdout if piping to another application.
+** The data is packed into the buffered writer (wf_writer.c), which either writes it to file
+** or to stdout if piping to another application.
 */
 #include <limits.h>
 #include "wavgen.h"
 
 /*
-** Scale the sample to the level requested through the --align, --level and --power options (where allowed).
+** Scale a block of samples to the level requested through the --align, --level and --power options (where allowed).
 */
-void set_level(struct FIXED_PARAMS *fixed)
+void set_level(struct FIXED_PARAMS *fixed,
+               SAMPLE *buffer,
+               size_t  num_samples)
 {
     /*
     ** Gain is specified as a double so try to keep precision by converting the INTEGER
-    ** samples to/from double-precision floating-point.
+    ** samples to/from double-precision floating-point (a whole block at a time, see wf_gain.c).
     */
-    fixed->sample_value.i = (int32_t) (((double) fixed->sample_value.i * fixed->gain) + 0.5);
+    apply_gain(buffer, num_samples, fixed->gain);
 }
 
 /*
-** Check whether any level scaling is allowed and/or called for and apply it if so.
-** Returns true if a level adjustment was made.
+** Check whether any level scaling is allowed and called for.
+** The decision is made once for the whole block rather than for each sample.
 */
-void check_level(struct FIXED_PARAMS *fixed,
-                 struct COMMON_USER_PARAMS *user)
+static bool level_required(struct FIXED_PARAMS *fixed,
+                           struct COMMON_USER_PARAMS *user)
 {
+    bool required = false;
+
     switch (user->wf_type) {
         /* Level adjustment is not allowed for these non-audio types.*/
         case WAVEFORM_TYPE_COUNTER:
@@ -44,6 +49,7 @@ void check_level(struct FIXED_PARAMS *fixed,
         case WAVEFORM_TYPE_SINE:
         case WAVEFORM_TYPE_SQUARE:
         case WAVEFORM_TYPE_BURST:
+        case WAVEFORM_TYPE_SWEEP:
         /*
         ** TODO: White/Pink noise will measure an RMS level of approx. -4.6dBFS/-15dbFS if "aligned" to 0dBFS.
         **       Although the alignment level is used to set the PEAK level in this utility, that makes less
@@ -52,117 +58,182 @@ void check_level(struct FIXED_PARAMS *fixed,
         case WAVEFORM_TYPE_PINK:
         case WAVEFORM_TYPE_WHITE:
 
-        if ((fixed->gain > 1.0001) || (fixed->gain < 0.9999)) {
-            set_level(fixed);
-        }
+        required = (fixed->gain > 1.0001) || (fixed->gain < 0.9999);
         break;
 
         /* Ignore unknown or unsupported types.*/
         default:
         break;
     }
+
+    return required;
 }
 
 /*
-** Check whether the sample needs converting between integer and floating-point,
+** Apply any level scaling to a block of integer samples.
+** For float output the gain is applied as part of the conversion instead (see check_format()).
+*/
+void check_level(struct FIXED_PARAMS *fixed,
+                 struct COMMON_USER_PARAMS *user,
+                 SAMPLE *buffer,
+                 size_t  num_samples)
+{
+    if (!user->save_as_float && level_required(fixed, user)) {
+        set_level(fixed, buffer, num_samples);
+    }
+}
+
+/*
+** Check whether the block needs converting between integer and floating-point,
 ** which depends on the user's choice of output format.
 */
 void check_format(struct FIXED_PARAMS *fixed,
-                  struct COMMON_USER_PARAMS *user)
+                  struct COMMON_USER_PARAMS *user,
+                  SAMPLE *buffer,
+                  size_t  num_samples)
 {
+    double gain;
+
     if (user->save_as_float) {
-        /*
-        ** Float32 WAV format has samples aligned to 1.0f, so convert to float then
-        ** scale by the maximum integer value that the waveform generators produce.
-        */
-        fixed->sample_value.f = (float) fixed->sample_value.i;
-        fixed->sample_value.f /= MAX_LEVEL_32BIT;
+        gain = level_required(fixed, user) ? fixed->gain : 1.0;
+
+        if (generates_float(user)) {
+            /* Already float, so only the level may need changing.*/
+            if (gain != 1.0) {
+                scale_float(buffer, num_samples, gain);
+            }
+        }
+        else {
+            /*
+            ** Float32 WAV format has samples aligned to 1.0f, so convert to float scaled by the
+            ** maximum integer value that the waveform generators produce (and by the gain).
+            */
+            convert_to_float(buffer, num_samples, gain / (double) MAX_LEVEL_32BIT);
+        }
     }
 }
 
 /*
-** Write the finalised sample data to the given output file in the appropriate word size.
-** Returns true if the samples were written out successfully.
+** Pack a block of finalised sample data into the output buffer in the appropriate word size.
+** Returns the number of bytes packed, or zero if the output format is not supported.
 */
-bool save_sample(struct   FIXED_PARAMS *fixed,
-                  struct  COMMON_USER_PARAMS *user,
-                  FILE   *wavfile)
+size_t pack_samples(struct  COMMON_USER_PARAMS *user,
+                    SAMPLE  *buffer,
+                    size_t   num_samples,
+                    uint8_t *output)
 {
-    size_t num_bytes;
-    size_t bytes_written;
-
     /*
     ** Remember here that the data will already be in the required format,
     ** but the word length (sample depth) will still be 32-bit.
     */
 
-    if (user->save_as_float == true) {
+    if ((user->save_as_float == true) || (user->bytes_per_sample == BYTES_32BIT)) {
         /*
-        ** The first case is where no conversion is required because samples
-        ** have already been converted to floats in check_format().
+        ** No conversion is required because samples are either already S32LE or
+        ** have already been converted to floats in check_format(). They may even
+        ** have been generated in place (see writer_in_place()).
         */
-        num_bytes     = sizeof(float);
-        bytes_written = fwrite(&fixed->sample_value.f, 1, num_bytes, wavfile);
+        if (output != (uint8_t *) buffer) {
+            memcpy(output, buffer, num_samples * sizeof(SAMPLE));
+        }
+        return num_samples * sizeof(SAMPLE);
     }
-    else if (user->bytes_per_sample == BYTES_32BIT) {
+    else if (user->bytes_per_sample == BYTES_24BIT) {
         /*
-        ** The second case where no conversion is required (samples are already S32LE).
+        ** Packed 24-bit format S24_3LE (three bytes per sample, no padding).
         */
-        num_bytes     = sizeof(int32_t);
-        bytes_written = fwrite(&fixed->sample_value.i, 1, num_bytes, wavfile);
+        pack_s24(buffer, num_samples, output);
+        return num_samples * 3U;
     }
     else if (user->bytes_per_sample == BYTES_16BIT) {
         /*
         ** Now we deal with the 16-bit sample format S16LE.
         */
-        int16_t sample_s16;
-        sample_s16 = (int16_t) (fixed->sample_value.i >> 16);
-
-        num_bytes     = sizeof(int16_t);
-        bytes_written = fwrite(&sample_s16, 1, num_bytes, wavfile);
+        pack_s16(buffer, num_samples, output);
+        return num_samples * sizeof(int16_t);
     }
-    else {
+    else if (user->bytes_per_sample == BYTES_8BIT) {
         /*
-        ** There are plenty of other formats that are NOT supported here yet,
-        ** notibly S8LE and big-endian ones.
+        ** 8-bit WAV data is always UNSIGNED (U8).
         */
-        return false;
+        pack_u8(buffer, num_samples, output);
+        return num_samples;
     }
 
     /*
-    ** Check for errors in writing the file.
+    ** There are plenty of other formats that are NOT supported here yet,
+    ** notibly big-endian ones.
     */
-    return (bytes_written == num_bytes);
+    return 0;
+}
+
+/*
+** Pack a block of finalised sample data into the writer's staging buffer, from where it
+** will be written out in bulk.
+** Returns true if the samples were packed (and any required flush was successful).
+*/
+bool save_samples(struct  COMMON_USER_PARAMS *user,
+                  SAMPLE *buffer,
+                  size_t  num_samples,
+                  struct  OUTPUT_WRITER *writer)
+{
+    uint8_t *output;
+    size_t   num_bytes;
+
+    output = writer_reserve(writer, num_samples * user->bytes_per_sample);
+    if (output == NULL) {
+        return false;
+    }
+
+    num_bytes = pack_samples(user, buffer, num_samples, output);
+    if (num_bytes == 0) {
+        return false;
+    }
+
+    return writer_commit(writer, num_bytes);
 }
 
 /*
-** Perform final tasks on the generated waveform data to ready it for writing out.
+** Perform final tasks on a block of generated waveform data to ready it for writing out.
+** Each stage is a pass over the whole (interleaved) block. The state is that of the stream
+** that generated the block (which generate_block() has moved on past it).
 */
-bool finalise_data(struct  FIXED_PARAMS *fixed,
-                   struct  COMMON_USER_PARAMS *user,
-                   struct  ADDITIONAL_USER_PARAMS *extra,
-                   FILE   *wavfile)
+bool finalise_block(struct  FIXED_PARAMS *fixed,
+                    struct  COMMON_USER_PARAMS *user,
+                    struct  ADDITIONAL_USER_PARAMS *extra,
+                    struct  WAVEFORM_STATE *state,
+                    SAMPLE *buffer,
+                    uint32_t num_frames,
+                    struct  OUTPUT_WRITER *writer)
 {
+    size_t num_samples = (size_t) num_frames * user->num_channels;
+
     /*
-    ** Check whether level adjustment is required and apply it if so.
+    ** Check whether level adjustment is required and apply it if so (to integer output).
     ** Must be done before markers are applied to avoid changing them.
     */
-    check_level(fixed, user);
+    check_level(fixed, user, buffer, num_samples);
 
     /*
     ** Convert between integer and floating-point format if required.
     ** (must be done before markers can be added to integer formats).
     */
-    check_format(fixed, user);
+    check_format(fixed, user, buffer, num_samples);
+
+    /*
+    ** Dither integer samples that are to be reduced in size, if asked for.
+    ** Must also be done before markers are added.
+    */
+    check_dither(user, state, buffer, num_frames);
 
     /*
     ** Check whether channel markers have been asked for and add them if so.
     */
-    check_markers(fixed, user, extra);
+    check_markers(user, extra, buffer, num_frames);
 
     /*
-    ** The buffer has been converted to float or integer, so just write it out,
+    ** The buffer has been converted to float or integer, so just pack it for output,
     ** truncating the word-length if required.
     */
-    return save_sample(fixed, user, wavfile);
+    return save_samples(user, buffer, num_samples, writer);
 }
@@ -0,0 +1,136 @@
+/*
+** wf_pack.c
+**
+** Whole-buffer "pack" kernels that squeeze the unified 32-bit samples down to the narrower
+** output word sizes (S16LE, S24_3LE and U8). Each kernel has a portable scalar version, with
+** SIMD versions used where the target supports them (SSE2/SSSE3 on x86, NEON on ARM).
+**
+** The narrower formats simply keep the most-significant bytes of each sample (no dithering).
+*/
+#include "wavgen.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define PACK_HAVE_SSSE3
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PACK_HAVE_NEON
+#endif
+
+/*
+** Pack to signed 16-bit little-endian (S16LE) by keeping the upper two bytes.
+*/
+void pack_s16(const SAMPLE *buffer, size_t num_samples, uint8_t *output)
+{
+    int16_t *packed = (int16_t *) output;
+    size_t   index  = 0;
+
+#if defined(PACK_HAVE_NEON)
+    /* De-interleave 16-bit halves and keep only the upper ones.*/
+    for (; (index + 8U) <= num_samples; index += 8U) {
+        uint16x8x2_t halves = vld2q_u16((const uint16_t *) &buffer[index]);
+        vst1q_u16((uint16_t *) &packed[index], halves.val[1]);
+    }
+#elif defined(__SSE2__)
+    /* Arithmetic shift leaves values that fit exactly, so the saturating pack is lossless.*/
+    for (; (index + 8U) <= num_samples; index += 8U) {
+        __m128i lo = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index]), 16);
+        __m128i hi = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index + 4U]), 16);
+        _mm_storeu_si128((__m128i *) &packed[index], _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; index < num_samples; ++index) {
+        packed[index] = (int16_t) (buffer[index].i >> 16);
+    }
+}
+
+#if defined(PACK_HAVE_SSSE3)
+/*
+** SSSE3 version of the S24_3LE squeeze: one shuffle turns four 32-bit samples into twelve bytes.
+** Each store writes sixteen bytes, so stop while at least four samples remain to be overwritten
+** by the following store and leave the tail to the scalar loop.
+*/
+__attribute__((target("ssse3")))
+static size_t pack_s24_ssse3(const SAMPLE *buffer, size_t num_samples, uint8_t *output)
+{
+    const __m128i squeeze = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+    size_t index;
+
+    for (index = 0; (index + 8U) <= num_samples; index += 4U) {
+        __m128i samples = _mm_loadu_si128((const __m128i *) &buffer[index]);
+        _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(samples, squeeze));
+        output += 12;
+    }
+
+    return index;
+}
+#endif
+
+/*
+** Pack to signed 24-bit little-endian in three bytes (S24_3LE) by keeping the upper three bytes.
+*/
+void pack_s24(const SAMPLE *buffer, size_t num_samples, uint8_t *output)
+{
+    size_t   index = 0;
+    uint32_t value;
+
+#if defined(PACK_HAVE_NEON)
+    /* De-interleave the sample bytes into four planes and re-interleave the upper three.*/
+    for (; (index + 16U) <= num_samples; index += 16U) {
+        uint8x16x4_t planes = vld4q_u8((const uint8_t *) &buffer[index]);
+        uint8x16x3_t packed = { { planes.val[1], planes.val[2], planes.val[3] } };
+        vst3q_u8(output, packed);
+        output += 48;
+    }
+#elif defined(PACK_HAVE_SSSE3)
+    if (__builtin_cpu_supports("ssse3")) {
+        index   = pack_s24_ssse3(buffer, num_samples, output);
+        output += index * 3U;
+    }
+#endif
+
+    for (; index < num_samples; ++index) {
+        value     = (uint32_t) buffer[index].i;
+        output[0] = (uint8_t) (value >> 8);
+        output[1] = (uint8_t) (value >> 16);
+        output[2] = (uint8_t) (value >> 24);
+        output   += 3;
+    }
+}
+
+/*
+** Pack to unsigned 8-bit (U8), the only 8-bit format WAV files allow.
+** The upper byte is kept and offset by 128 so that silence is 0x80.
+*/
+void pack_u8(const SAMPLE *buffer, size_t num_samples, uint8_t *output)
+{
+    size_t index = 0;
+
+#if defined(PACK_HAVE_NEON)
+    /* The most-significant byte plane, with its sign bit flipped, is the U8 sample.*/
+    for (; (index + 16U) <= num_samples; index += 16U) {
+        uint8x16x4_t planes = vld4q_u8((const uint8_t *) &buffer[index]);
+        vst1q_u8(&output[index], veorq_u8(planes.val[3], vdupq_n_u8(0x80)));
+    }
+#elif defined(__SSE2__)
+    for (; (index + 16U) <= num_samples; index += 16U) {
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index]),       24);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index + 4U]),  24);
+        __m128i c = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index + 8U]),  24);
+        __m128i d = _mm_srai_epi32(_mm_loadu_si128((const __m128i *) &buffer[index + 12U]), 24);
+        __m128i s8 = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i *) &output[index], _mm_xor_si128(s8, _mm_set1_epi8((char) 0x80)));
+    }
+#endif
+
+    for (; index < num_samples; ++index) {
+        output[index] = (uint8_t) (((uint32_t) buffer[index].i >> 24) ^ 0x80U);
+    }
+}
@@ -0,0 +1,250 @@
+/*
+** wf_realtime.c
+**
+** Real-time paced streaming (the --realtime option). Rather than writing as fast as the output
+** will accept, each block (period) is released when its first frame is due to be played, timed
+** against CLOCK_MONOTONIC at the configured sample rate, so the consumer is fed at a steady rate
+** and the amount of data queued in the pipe stays small.
+**
+** Blocks are generated and packed on a separate thread into a small ring of preallocated slots,
+** so the time taken to generate a block (or a jittery consumer holding up a write) never delays
+** the blocks that follow. Memory use is bounded, however long the stream runs.
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "wavgen.h"
+
+/*
+** The number of blocks that may be generated ahead of the one being written.
+*/
+#define REALTIME_RING_BLOCKS (4U)
+
+#define NS_PER_SECOND        (1000000000ULL)
+
+/*
+** One block of packed output, ready to write.
+*/
+struct REALTIME_SLOT {
+    uint8_t *data;          // Aligned, packed sample data.
+    size_t   num_bytes;     // The number of valid bytes in data.
+};
+
+/*
+** State shared between the generating thread and the (writing) caller.
+*/
+struct REALTIME_RING {
+    struct FIXED_PARAMS           *fixed;
+    struct COMMON_USER_PARAMS     *user;
+    struct ADDITIONAL_USER_PARAMS *extra;
+
+    struct REALTIME_SLOT slots[REALTIME_RING_BLOCKS];
+    size_t   slot_bytes;    // The capacity of each slot (one whole block).
+    uint64_t num_frames;    // Total frames to generate (UINT64_MAX to carry on indefinitely).
+
+    uint64_t generated;     // Blocks generated so far (the next slot filled is generated % REALTIME_RING_BLOCKS).
+    uint64_t written;       // Blocks written so far.
+    bool     finished;      // Set by the generator once it has stopped, for whatever reason.
+    bool     failed;        // Set by the generator if a block could not be finalised.
+    bool     stop;          // Set by the writer to stop the generator early.
+
+    pthread_mutex_t lock;
+    pthread_cond_t  changed; // Signalled whenever any of the above changes.
+};
+
+/*
+** Generating thread: fill the slots of the ring in turn, waiting whenever it is full.
+*/
+static void *realtime_generator(void *arg)
+{
+    struct REALTIME_RING *ring = arg;
+    struct REALTIME_SLOT *slot;
+    struct WAVEFORM_STATE state;
+    struct OUTPUT_WRITER  writer;
+
+    SAMPLE  *buffer;
+    SAMPLE  *block_buffer;
+    uint32_t block_frames;
+    bool     stopping;
+    bool     success;
+
+    buffer = malloc((size_t) ring->user->block_frames * ring->user->num_channels * sizeof(SAMPLE));
+    success = (buffer != NULL);
+
+    generate_init(&state);
+
+    while (success && (state.sample_number < ring->num_frames)) {
+        pthread_mutex_lock(&ring->lock);
+        while (((ring->generated - ring->written) >= REALTIME_RING_BLOCKS) && !ring->stop) {
+            pthread_cond_wait(&ring->changed, &ring->lock);
+        }
+        slot     = &ring->slots[ring->generated % REALTIME_RING_BLOCKS];
+        stopping = ring->stop;
+        pthread_mutex_unlock(&ring->lock);
+
+        if (stopping) {
+            break;
+        }
+
+        block_frames = ring->user->block_frames;
+        if ((ring->num_frames - state.sample_number) < block_frames) {
+            block_frames = (uint32_t) (ring->num_frames - state.sample_number);
+        }
+
+        /* Pack the block straight into its slot (or, if no packing is needed, generate it there).*/
+        writer_init_mapped(&writer, slot->data, ring->slot_bytes);
+
+        block_buffer = writer_in_place(&writer, ring->user);
+        if (block_buffer == NULL) {
+            block_buffer = buffer;
+        }
+
+        generate_block(&state, ring->user, ring->extra, block_buffer, block_frames);
+        success = finalise_block(ring->fixed, ring->user, ring->extra, &state, block_buffer, block_frames, &writer);
+        slot->num_bytes = writer.used;
+
+        pthread_mutex_lock(&ring->lock);
+        if (success) {
+            ring->generated++;
+        }
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+
+    generate_free(&state);
+    free(buffer);
+
+    pthread_mutex_lock(&ring->lock);
+    ring->failed   = !success;
+    ring->finished = true;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+
+    return NULL;
+}
+
+/*
+** The time at which a frame is due, relative to the start of the stream. This is worked out
+** from the total frame count (rather than accumulated block by block) so that it never drifts.
+*/
+static struct timespec realtime_deadline(const struct timespec *start, uint64_t frame, uint32_t sample_rate)
+{
+    struct timespec deadline;
+    uint64_t ns = ((frame / sample_rate) * NS_PER_SECOND)
+                + (((frame % sample_rate) * NS_PER_SECOND) / sample_rate)
+                + (uint64_t) start->tv_nsec;
+
+    deadline.tv_sec  = start->tv_sec + (time_t) (ns / NS_PER_SECOND);
+    deadline.tv_nsec = (long) (ns % NS_PER_SECOND);
+
+    return deadline;
+}
+
+/*
+** Stream the data section in real time, each block being written when it is due.
+** If the writes fall behind (e.g. the consumer stalled), blocks are written as fast as
+** possible until the stream has caught up again, so no data is ever dropped.
+**
+** param  fd         : The output file descriptor (normally stdout, a pipe).
+** param  num_frames : The number of frames to stream, or UINT64_MAX to carry on indefinitely.
+** Returns true if all the data was generated and written successfully.
+*/
+bool realtime_stream(struct FIXED_PARAMS *fixed,
+                     struct COMMON_USER_PARAMS *user,
+                     struct ADDITIONAL_USER_PARAMS *extra,
+                     int      fd,
+                     uint64_t num_frames)
+{
+    struct REALTIME_RING  ring;
+    struct REALTIME_SLOT *slot;
+    struct timespec       start;
+    struct timespec       deadline;
+    pthread_t generator;
+    uint64_t  frame = 0;
+    size_t    frame_bytes = (size_t) user->num_channels * user->bytes_per_sample;
+    bool      success = true;
+    uint32_t  index;
+
+    memset(&ring, 0, sizeof(struct REALTIME_RING));
+
+    ring.fixed      = fixed;
+    ring.user       = user;
+    ring.extra      = extra;
+    ring.num_frames = num_frames;
+    ring.slot_bytes = (size_t) user->block_frames * frame_bytes;
+
+    for (index = 0; index < REALTIME_RING_BLOCKS; ++index) {
+        ring.slots[index].data = writer_alloc(ring.slot_bytes);
+        if (ring.slots[index].data == NULL) {
+            success = false;
+        }
+    }
+
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.changed, NULL);
+
+    if (success && (pthread_create(&generator, NULL, realtime_generator, &ring) != 0)) {
+        success = false;
+    }
+
+    if (success) {
+        log_extra(fixed, "Streaming in real time, %u frames per block.\n", user->block_frames);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        while (true) {
+            /* Wait for the next block to be ready (normally it already is).*/
+            pthread_mutex_lock(&ring.lock);
+            while ((ring.generated == ring.written) && !ring.finished) {
+                pthread_cond_wait(&ring.changed, &ring.lock);
+            }
+            if (ring.generated == ring.written) {
+                pthread_mutex_unlock(&ring.lock);
+                break;
+            }
+            slot = &ring.slots[ring.written % REALTIME_RING_BLOCKS];
+            pthread_mutex_unlock(&ring.lock);
+
+            /* Hold it back until it is due.*/
+            deadline = realtime_deadline(&start, frame, user->sample_rate);
+            while ((clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) &&
+                   !writer_stop_requested()) {
+                continue;
+            }
+
+            if (writer_stop_requested()) {
+                break;
+            }
+
+            if (!writer_write(fd, slot->data, slot->num_bytes)) {
+                success = false;
+                break;
+            }
+            frame += slot->num_bytes / frame_bytes;
+
+            pthread_mutex_lock(&ring.lock);
+            ring.written++;
+            pthread_cond_broadcast(&ring.changed);
+            pthread_mutex_unlock(&ring.lock);
+        }
+
+        /* Stop the generator (if it hasn't stopped already) and wait for it.*/
+        pthread_mutex_lock(&ring.lock);
+        ring.stop = true;
+        pthread_cond_broadcast(&ring.changed);
+        pthread_mutex_unlock(&ring.lock);
+
+        pthread_join(generator, NULL);
+
+        success = success && !ring.failed;
+    }
+
+    pthread_cond_destroy(&ring.changed);
+    pthread_mutex_destroy(&ring.lock);
+
+    for (index = 0; index < REALTIME_RING_BLOCKS; ++index) {
+        writer_release(ring.slots[index].data);
+    }
+
+    return success;
+}
@@ -19,32 +19,29 @@
 
 /*
 ** Generate the sample data in "unified" 32-bit integer format.
+**
+** The ramp is calculated directly from the position within the current cycle, so no state is
+** needed. The step size divides the whole 32-bit range into one cycle, so the ramp rises from
+** zero to the positive peak, wraps around to the negative peak and climbs back towards zero.
 */
-void generate_saw(struct FIXED_PARAMS *fixed,
-                  struct COMMON_USER_PARAMS *user)
+void generate_saw(struct WAVEFORM_STATE *state,
+                  struct COMMON_USER_PARAMS *user,
+                  SAMPLE   *buffer,
+                  uint32_t  num_frames)
 {
-    static int32_t sample_value = 0;
-
-    uint32_t num_steps = (user->sample_rate / user->frequency_hz) * 2U;
-    uint32_t step_size = (MAX_LEVEL_32BIT / num_steps) * 2U;
-
-    /* Adjust the target peak level so that it fits with our step-size.*/
-    int32_t peak_level = (step_size * num_steps) / 2U;
+    uint32_t period_samples = user->sample_rate / user->frequency_hz;
+    uint32_t step_size      = 0xFFFFFFFFU / period_samples; // Never quite reaches -2^31.
+    uint32_t frame;
+    uint16_t chnl;
+    int32_t  sample_value;
 
-    /* The saw-tooth waveform starts from zero but is then symetrical about zero.*/
-    fixed->sample_value.i = sample_value;
-
-    if (sample_value == MAX_LEVEL_32BIT) {
-        /* If the last sample value EQUALS the peak value (it may be INT_MAX), take special care.*/
-        sample_value = MAX_LEVEL_32BIT * -1;
-    }
-    else {
-        /* Otherwise ramp-up the saw-tooth level by an amount driven by the required frequency.*/
-        sample_value = sample_value + (int32_t) step_size;
+    for (frame = 0; frame < num_frames; ++frame) {
+        /* Unsigned (modulo) arithmetic makes the wrap from +ve to -ve peak happen by itself.*/
+        sample_value = (int32_t) (((state->sample_number + frame) % period_samples) * step_size);
 
-        /* Once the peak is EXCEEDED, flip to the negative peak level.*/
-        if (sample_value > peak_level) {
-            sample_value = ((int32_t) (step_size * num_steps)) * -1;
+        /* The same value is used within each frame of a multi-channel waveform.*/
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            (buffer++)->i = sample_value;
         }
     }
 }
@@ -9,7 +9,9 @@
 /*
 ** Simply fill the file with silence.
 */
-void generate_silence(struct FIXED_PARAMS *fixed)
+void generate_silence(struct COMMON_USER_PARAMS *user,
+                      SAMPLE   *buffer,
+                      uint32_t  num_frames)
 {
-    fixed->sample_value.i = 0;
+    memset(buffer, 0, (size_t) num_frames * user->num_channels * sizeof(SAMPLE));
 }
@@ -4,32 +4,141 @@
 ** Generate a sinewave at the requested frequency.
 ** The peak level can be specified, as can "fractional power" as an alternative.
 ** Markers are not allowed.
+**
+** The phase of each frame is calculated exactly from its frame number (as a fraction of the
+** sample rate) so the requested frequency is produced exactly, even when it does not divide
+** into the sample rate, and the stream can be started from any frame.
+**
+** Rather than calling sin() for every sample, a few "lanes" of a recursive (rotating phasor)
+** oscillator are run side-by-side using the compiler's vector extensions, which map onto the
+** target's SIMD registers (SSE/AVX or NEON). Each lane is re-synchronised to the exact phase
+** at fixed positions in the stream (every SINE_RESYNC_FRAMES frames) so that rounding errors
+** never accumulate, and the output doesn't depend on how the stream is split into blocks.
 **/
 #include <math.h>
 #include "wavgen.h"
 
-static const double PI = 3.1415926536;
+static const double PI = 3.14159265358979323846;
+
+#define SINE_LANES         (4U)     // Consecutive frames calculated at once.
+#define SINE_RESYNC_FRAMES (1024U)  // Frames between re-synchronisations (a multiple of SINE_LANES).
+
+typedef double  SINE_VEC  __attribute__((vector_size(SINE_LANES * sizeof(double))));
+typedef int32_t SINE_IVEC __attribute__((vector_size(SINE_LANES * sizeof(int32_t))));
+typedef float   SINE_FVEC __attribute__((vector_size(SINE_LANES * sizeof(float))));
 
 /*
-** A simple "double-maths" version is used here rather than anything high-performance.
-** As per all generators, the output is INTEGER samples, which will be converted back
-** to floating-point in the WAV file if that's what the user asked for.
+** The exact phase (in radians) of a frame. The phase only depends on the position within
+** one second, so the product is kept exact using integer arithmetic before converting.
 */
-void generate_sine(struct FIXED_PARAMS *fixed,
-                   struct COMMON_USER_PARAMS *user)
+static double sine_phase(struct COMMON_USER_PARAMS *user, uint64_t frame)
 {
-    uint32_t cycle_length_samples;
-    double   sample_value_f;
+    uint64_t position = ((frame % user->sample_rate) * user->frequency_hz) % user->sample_rate;
+
+    return 2.0 * PI * (double) position / (double) user->sample_rate;
+}
+
+/*
+** Generate a block of one channel's worth of sine-wave samples (i.e. one per frame) in
+** "unified" 32-bit integer format, or as floats normalised to 1.0.
+** The lanes are re-synchronised at fixed positions in the stream (every SINE_RESYNC_FRAMES), and
+** whole sets of lanes are always calculated, starting at a multiple of SINE_LANES, with only the
+** frames asked for being stored. So the output is the same however the stream is split into blocks.
+*/
+static void generate_sine_frames(struct COMMON_USER_PARAMS *user,
+                                 uint64_t  first_frame,
+                                 SAMPLE   *output,
+                                 uint32_t  num_frames,
+                                 bool      as_float)
+{
+    SINE_VEC  sin_v;
+    SINE_VEC  cos_v;
+    SINE_VEC  next_sin;
+    SINE_VEC  scaled;
+    SINE_IVEC sample_v;
+    SINE_FVEC float_v;
+    SAMPLE    values[SINE_LANES];
+
+    double   step_sin;
+    double   step_cos;
+    uint64_t position = first_frame;
+    uint64_t end = first_frame + num_frames;
+    uint64_t group;
+    uint64_t segment_end;
+    uint32_t lane;
+    uint32_t first;
+    uint32_t count;
 
-    cycle_length_samples  = user->sample_rate / user->frequency_hz;
+    /* Each iteration moves every lane on by SINE_LANES frames.*/
+    step_sin = sin(2.0 * PI * SINE_LANES * (double) user->frequency_hz / (double) user->sample_rate);
+    step_cos = cos(2.0 * PI * SINE_LANES * (double) user->frequency_hz / (double) user->sample_rate);
 
-    sample_value_f = sin(2.0 * PI * (double) fixed->sample_number / (double) cycle_length_samples);
-    sample_value_f *= (double) MAX_LEVEL_32BIT;
+    while (position < end) {
+        /* Start every lane at its exact phase at the start of the segment, and catch up to the first frame.*/
+        group = position - (position % SINE_RESYNC_FRAMES);
+        for (lane = 0; lane < SINE_LANES; ++lane) {
+            sin_v[lane] = sin(sine_phase(user, group + lane));
+            cos_v[lane] = cos(sine_phase(user, group + lane));
+        }
+        for (; (group + SINE_LANES) <= position; group += SINE_LANES) {
+            next_sin = (sin_v * step_cos) + (cos_v * step_sin);
+            cos_v    = (cos_v * step_cos) - (sin_v * step_sin);
+            sin_v    = next_sin;
+        }
 
-    /* Double-check sample levels. This should probably be removed.*/
-    if (sample_value_f > (double) MAX_LEVEL_32BIT) {
-        sample_value_f = (double) MAX_LEVEL_32BIT;
+        segment_end = group - (group % SINE_RESYNC_FRAMES) + SINE_RESYNC_FRAMES;
+        if (segment_end > end) {
+            segment_end = end;
+        }
+
+        for (; group < segment_end; group += SINE_LANES) {
+            if (as_float) {
+                float_v = __builtin_convertvector(sin_v, SINE_FVEC);
+                memcpy(values, &float_v, sizeof(float_v));
+            }
+            else {
+                scaled   = (sin_v * (double) MAX_LEVEL_32BIT) + 0.5;
+                sample_v = __builtin_convertvector(scaled, SINE_IVEC);
+                memcpy(values, &sample_v, sizeof(sample_v));
+            }
+
+            first = (group < position) ? (uint32_t) (position - group) : 0U;
+            count = ((group + SINE_LANES) > end) ? (uint32_t) (end - group) : SINE_LANES;
+            memcpy(output, &values[first], (count - first) * sizeof(SAMPLE));
+            output += count - first;
+
+            /* Rotate the phasors on to the next set of frames.*/
+            next_sin = (sin_v * step_cos) + (cos_v * step_sin);
+            cos_v    = (cos_v * step_cos) - (sin_v * step_sin);
+            sin_v    = next_sin;
+        }
+
+        position = segment_end;
     }
+}
 
-    fixed->sample_value.i = (int32_t) (sample_value_f + 0.5);
+/*
+** The output is INTEGER samples, unless the WAV file is to be floating-point, in which case
+** float samples are generated directly (see generates_float()).
+** The sample is identical on every channel, so each frame is only calculated once (into the
+** first channel's slots) and then copied to the other channels.
+*/
+void generate_sine(struct WAVEFORM_STATE *state,
+                   struct COMMON_USER_PARAMS *user,
+                   SAMPLE   *buffer,
+                   uint32_t  num_frames)
+{
+    uint32_t frame;
+    uint16_t chnl;
+
+    generate_sine_frames(user, state->sample_number, buffer, num_frames, generates_float(user));
+
+    if (user->num_channels > 1U) {
+        /* Spread the samples out from the end backwards so that none is overwritten before it is used.*/
+        for (frame = num_frames; frame-- > 0;) {
+            for (chnl = 0; chnl < user->num_channels; ++chnl) {
+                buffer[(size_t) frame * user->num_channels + chnl] = buffer[frame];
+            }
+        }
+    }
 }
@@ -0,0 +1,196 @@
+/*
+** wf_splice.c
+**
+** Zero-copy output of periodic waveforms to a pipe (Linux only).
+** When a waveform comes from a period table (see wf_cache.c) and nothing in the output stage
+** varies from one period to the next (i.e. it isn't dithered), the finished output is simply the
+** same bytes over and over.
+** So a "tile" of whole periods is finalised and packed once, into an in-memory file, and the pipe
+** is then fed from that file with splice(), which passes references to its pages rather than
+** copying the data. Generating, converting and packing cost nothing at all after the first tile.
+*/
+#if defined(__linux__)
+#define _GNU_SOURCE     // For splice() and memfd_create().
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "wavgen.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+
+/*
+** The smallest tile worth splicing from. Each splice() moves up to a whole pipe's worth of data,
+** so the tile should be at least that big (the default pipe is 64KiB, the maximum normally 1MiB).
+*/
+#define SPLICE_MIN_TILE_BYTES (1048576U)
+
+/*
+** Render a tile of whole periods of the finished output into a new (unlinked) file.
+** Returns the file descriptor, or -1 if it could not be created.
+*/
+static int splice_make_tile(struct FIXED_PARAMS *fixed,
+                            struct COMMON_USER_PARAMS *user,
+                            struct ADDITIONAL_USER_PARAMS *extra,
+                            const SAMPLE *period,
+                            uint32_t      period_frames,
+                            uint32_t      tile_frames)
+{
+    struct OUTPUT_WRITER  writer;
+    struct WAVEFORM_STATE state;
+    size_t   period_samples = (size_t) period_frames * user->num_channels;
+    size_t   tile_bytes     = (size_t) tile_frames * user->num_channels * user->bytes_per_sample;
+    SAMPLE  *samples;
+    uint8_t *packed;
+    uint32_t frame;
+    ssize_t  written;
+    size_t   offset = 0;
+    int      fd;
+
+    samples = malloc((size_t) tile_frames * user->num_channels * sizeof(SAMPLE));
+    packed  = malloc(tile_bytes);
+    if ((samples == NULL) || (packed == NULL)) {
+        free(samples);
+        free(packed);
+        return -1;
+    }
+
+    for (frame = 0; frame < tile_frames; frame += period_frames) {
+        memcpy(&samples[(size_t) frame * user->num_channels], period, period_samples * sizeof(SAMPLE));
+    }
+
+    writer_init_mapped(&writer, packed, tile_bytes);
+
+    /* As if the tile had just been generated from the start of a stream.*/
+    generate_init(&state);
+    state.sample_number = tile_frames;
+
+    fd = -1;
+    if (finalise_block(fixed, user, extra, &state, samples, tile_frames, &writer)) {
+        fd = memfd_create("wavgen-tile", MFD_CLOEXEC);
+    }
+
+    while ((fd >= 0) && (offset < tile_bytes)) {
+        written = write(fd, packed + offset, tile_bytes - offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            fd = -1;
+        }
+        else {
+            offset += (size_t) written;
+        }
+    }
+
+    free(samples);
+    free(packed);
+
+    return fd;
+}
+#endif
+
+/*
+** If the output is a pipe and the waveform is periodic, write the whole data section by splicing
+** from a pre-rendered tile. Otherwise (or where splice() isn't supported) nothing is written and
+** the caller carries on in the normal way.
+**
+** param  fd         : The output file descriptor.
+** param  num_frames : The number of frames to write, or UINT64_MAX to carry on indefinitely.
+** param  spliced    : Set true if the data section was written here.
+** Returns false if splicing started but failed part-way.
+*/
+bool splice_periodic(struct FIXED_PARAMS *fixed,
+                     struct COMMON_USER_PARAMS *user,
+                     struct ADDITIONAL_USER_PARAMS *extra,
+                     int      fd,
+                     uint64_t num_frames,
+                     bool    *spliced)
+{
+#if defined(__linux__)
+    struct WAVEFORM_STATE state;
+    struct stat   info;
+    const SAMPLE *period;
+    uint32_t period_frames;
+    uint32_t tile_frames;
+    size_t   frame_bytes = (size_t) user->num_channels * user->bytes_per_sample;
+    size_t   tile_bytes;
+    uint64_t remaining;
+    loff_t   position = 0;
+    size_t   length;
+    ssize_t  moved;
+    int      tile_fd;
+
+    *spliced = false;
+
+    if ((fstat(fd, &info) != 0) || !S_ISFIFO(info.st_mode) || dither_required(user)) {
+        return true;
+    }
+
+    generate_init(&state);
+    period = period_cache_samples(&state, user, extra, &period_frames);
+    if (period == NULL) {
+        return true;
+    }
+
+    /* Enough whole periods to make the tile worthwhile, and not worth it unless it repeats.*/
+    tile_frames = period_frames * (uint32_t) ((SPLICE_MIN_TILE_BYTES + (period_frames * frame_bytes) - 1U) / (period_frames * frame_bytes));
+    tile_bytes  = (size_t) tile_frames * frame_bytes;
+
+    if (num_frames < (2U * (uint64_t) tile_frames)) {
+        return true;
+    }
+
+    tile_fd = splice_make_tile(fixed, user, extra, period, period_frames, tile_frames);
+    if (tile_fd < 0) {
+        return true;
+    }
+
+    log_extra(fixed, "Splicing from a tile of %u frames.\n", tile_frames);
+
+    remaining = (num_frames == UINT64_MAX) ? UINT64_MAX : (num_frames * frame_bytes);
+
+    while ((remaining > 0) && !writer_stop_requested()) {
+        length = tile_bytes - (size_t) position;
+        if (remaining < length) {
+            length = (size_t) remaining;
+        }
+
+        moved = splice(tile_fd, &position, fd, NULL, length, SPLICE_F_MORE);
+        if (moved < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!*spliced && ((errno == EINVAL) || (errno == ENOSYS))) {
+                /* Not supported here, so write the data in the normal way.*/
+                break;
+            }
+            if (errno == EPIPE) {
+                writer_request_stop(SIGPIPE);
+            }
+            close(tile_fd);
+            *spliced = true;
+            return false;
+        }
+
+        *spliced = true;
+
+        if (remaining != UINT64_MAX) {
+            remaining -= (uint64_t) moved;
+        }
+        if ((size_t) position >= tile_bytes) {
+            position = 0;
+        }
+    }
+
+    close(tile_fd);
+#else
+    *spliced = false;
+#endif
+
+    return true;
+}
@@ -13,26 +13,35 @@
 
 /*
 ** Generate the sample data in "unified" 32-bit integer format.
+** The polarity of any frame follows directly from its frame number, so no state is needed.
 */
-void generate_square(struct FIXED_PARAMS *fixed,
-                     struct COMMON_USER_PARAMS *user)
+void generate_square(struct WAVEFORM_STATE *state,
+                     struct COMMON_USER_PARAMS *user,
+                     SAMPLE   *buffer,
+                     uint32_t  num_frames)
 {
-    static int32_t sample_value = MAX_LEVEL_32BIT;
-
     uint32_t half_period_samples;
+    uint32_t frame;
+    uint16_t chnl;
+    int32_t  sample_value;
 
     /* Calculate the nearest samples-per-period for the requested frequency.*/
     half_period_samples = (user->sample_rate / user->frequency_hz) / 2U;
 
-    /*
-    ** The square-wave starts from a +ve peak (it is never zero).
-    */
-    fixed->sample_value.i = sample_value;
+    for (frame = 0; frame < num_frames; ++frame) {
+        /*
+        ** The square-wave starts from a +ve peak (it is never zero) and flips
+        ** polarity every 1/2-period.
+        */
+        if ((((state->sample_number + frame) / half_period_samples) & 1U) == 0U) {
+            sample_value = MAX_LEVEL_32BIT;
+        }
+        else {
+            sample_value = -MAX_LEVEL_32BIT;
+        }
 
-    /* If a 1/2-period has elapsed, flip the polarity, but only at the start of a new frame.*/
-    if (fixed->current_chnl == 0) {
-        if ((fixed->sample_number % half_period_samples) == (half_period_samples - 1)) {
-            sample_value = -sample_value;
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            (buffer++)->i = sample_value;
         }
     }
 }
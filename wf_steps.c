@@ -12,26 +12,28 @@
 
 /*
 ** Generate the sample data in "unified" 32-bit integer format.
+** The step for any frame follows directly from its frame number, so no state is needed.
 */
-void generate_steps(struct FIXED_PARAMS *fixed,
-                    struct COMMON_USER_PARAMS *user)
+void generate_steps(struct WAVEFORM_STATE *state,
+                    struct COMMON_USER_PARAMS *user,
+                    SAMPLE   *buffer,
+                    uint32_t  num_frames)
 {
-    static uint32_t step = 0;
-
     /* Work out the step-size from the maximum (peak) level.*/
     uint32_t step_size = MAX_LEVEL_32BIT / NUM_STEPS;
+    uint32_t step;
+    uint32_t frame;
+    uint16_t chnl;
 
-    /* Set the current sample from the step value.*/
-    fixed->sample_value.i = (int32_t) (step_size * step);
+    for (frame = 0; frame < num_frames; ++frame) {
+        /*
+        ** The same value is used within each frame of a multi-channel waveform,
+        ** and the steps (including zero) repeat every (NUM_STEPS + 1) frames.
+        */
+        step = (state->sample_number + frame) % (NUM_STEPS + 1U);
 
-    /*
-    ** The same value is used within each frame of a multi-channel waveform,
-    ** so only increment the step after generating a sample for the last channel.
-    */
-    if (fixed->current_chnl == (user->num_channels - 1)) {
-        step = step + 1;
-        if (step > NUM_STEPS) {
-            step = 0;
+        for (chnl = 0; chnl < user->num_channels; ++chnl) {
+            (buffer++)->i = (int32_t) (step_size * step);
         }
     }
 }
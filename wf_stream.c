@@ -0,0 +1,217 @@
+/*
+** wf_stream.c
+**
+** Write one complete stream (the RIFF headers and then the sample data) to an open output file
+** or pipe, choosing the quickest way of producing it that the options allow: real-time pacing,
+** threaded chunks, a memory mapping, splicing a periodic waveform or, otherwise, one block at a
+** time through the buffered writer.
+*/
+#include "riff.h"
+#include "wavgen.h"
+
+/*
+** Generate the stream described by the parameters and write it to wavfile (which must be open
+** for writing, and for reading too if it is a regular file, so that it can be mapped).
+** Returns true if everything was written successfully.
+*/
+bool write_stream(struct FIXED_PARAMS *fixed,
+                  struct COMMON_USER_PARAMS *user,
+                  struct ADDITIONAL_USER_PARAMS *extra,
+                  FILE *wavfile)
+{
+    bool     success = true;
+    bool     reserve_ds64;
+    uint64_t num_data_bytes;
+    uint64_t num_frames;
+    uint32_t block_frames = 0;
+    SAMPLE  *buffer = NULL;
+    SAMPLE  *block_buffer;
+    uint64_t frame;
+    off_t    data_offset;
+    off_t    data_end;
+    size_t   frame_bytes;
+    bool     spliced = false;
+
+    /* With --mmap, the whole output file is mapped into memory and written through that.*/
+    uint8_t *mapping = NULL;
+    size_t   mapped_bytes = 0;
+
+    /* The buffered output stage that packed samples are written through.*/
+    struct OUTPUT_WRITER writer = { 0 };
+
+    /* The state of the generated stream, carried from one block to the next.*/
+    struct WAVEFORM_STATE state;
+
+    /*
+    ** Work out how many bytes are required for the FINAL (not intermediate) waveform,
+    ** in the format asked for through the command-line parameters.
+    ** Note that num_samples is across ALL channels.
+    */
+    frame_bytes    = (size_t) user->num_channels * user->bytes_per_sample;
+    num_data_bytes = user->num_samples * user->bytes_per_sample;
+    num_frames     = user->num_samples / user->num_channels;
+    log_extra(fixed, "Samples to generate (per channel) = %" PRIu64 ", duration ~%u ms\n",
+              num_frames, user->duration_ms);
+
+    if (user->unbounded) {
+        /* An endless stream: the header can't give the size, and the frames never run out.*/
+        log_extra(fixed, "No duration given, so streaming indefinitely.\n");
+        num_data_bytes = RIFF_UNBOUNDED_SIZE;
+        num_frames     = UINT64_MAX;
+    }
+
+    /*
+    ** Write the headers. An endless stream into a file keeps space for a ds64 chunk in case
+    ** the final length (back-patched at the end) needs RF64.
+    */
+    reserve_ds64 = user->unbounded && !fixed->piping;
+
+    if (!write_headers(fixed, user, wavfile, num_data_bytes, reserve_ds64)) {
+        success = false;
+    }
+
+    /*
+    ** Finally, write the sample data to the file in the format requested,
+    ** converting from the 32-bit generated data and adding markers if required.
+    ** The waveform is generated into the intermediate buffer one block at a time,
+    ** and each block is finalised and packed into the writer's staging buffer, which
+    ** is written out in bulk. The headers above went through stdio, so flush them first.
+    */
+    fflush(wavfile);
+    data_offset = (off_t) ftell(wavfile);
+
+    /*
+    ** If asked to, size the file up-front and map it, so that samples are packed (or, for
+    ** 32-bit and float output, generated) directly into the page cache with no copying or
+    ** write() calls at all. If that isn't possible just write the file in the normal way.
+    */
+    if (success && user->use_mmap) {
+        mapped_bytes = (size_t) data_offset + num_data_bytes + RIFF_PAD_BYTES(num_data_bytes);
+        mapping      = writer_map_file(fileno(wavfile), mapped_bytes);
+        if (mapping == NULL) {
+            log_info(fixed, "WARNING: Could not map the output file, writing it normally instead.\n");
+        }
+    }
+
+    buffer = malloc((size_t) user->block_frames * user->num_channels * sizeof(SAMPLE));
+    if (mapping != NULL) {
+        writer_init_mapped(&writer, mapping + data_offset, num_data_bytes);
+    }
+    else if (!writer_init(&writer, fileno(wavfile), (size_t) user->block_frames * user->num_channels * user->bytes_per_sample)) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    if (buffer == NULL) {
+        log_info(fixed, "Error: failed to allocate the sample buffers.\n");
+        success = false;
+    }
+
+    if (success && user->realtime) {
+        /*
+        ** Stream the data section at the sample rate, generating it on a separate thread.
+        ** The main writer is not used.
+        */
+        success = realtime_stream(fixed, user, extra, fileno(wavfile), num_frames);
+        num_frames = 0;
+    }
+    else if (success && (user->num_threads > 1U)) {
+        /*
+        ** Generate the data section in parallel chunks, each written at its own offset
+        ** after the headers (or in the mapping). The main writer is not used.
+        */
+        success = generate_threaded(fixed, user, extra, fileno(wavfile), data_offset,
+                                    (mapping != NULL) ? (mapping + data_offset) : NULL, num_frames);
+        num_frames = 0;
+    }
+    else if (success) {
+        /*
+        ** A periodic waveform going to a pipe can be spliced into it from a pre-rendered tile,
+        ** with no further generating or copying. If not, the main writer is used as normal.
+        */
+        success = splice_periodic(fixed, user, extra, fileno(wavfile), num_frames, &spliced);
+        if (spliced) {
+            num_frames = 0;
+        }
+    }
+
+    generate_init(&state);
+
+    for (frame = 0; success && (frame < num_frames) && !writer_stop_requested(); frame += block_frames) {
+        block_frames = user->block_frames;
+        if ((num_frames - frame) < block_frames) {
+            block_frames = (uint32_t) (num_frames - frame);
+        }
+
+        /* Generate straight into the mapped file when no packing is needed.*/
+        block_buffer = writer_in_place(&writer, user);
+        if (block_buffer == NULL) {
+            block_buffer = buffer;
+        }
+
+        generate_block(&state, user, extra, block_buffer, block_frames);
+
+        if (!finalise_block(fixed, user, extra, &state, block_buffer, block_frames, &writer)) {
+            success = false;
+        }
+    }
+
+    if (success && !writer_flush(&writer)) {
+        success = false;
+    }
+
+    /*
+    ** An endless stream only ends when it is stopped, or the reader closes the pipe,
+    ** so that isn't an error.
+    */
+    if (user->unbounded && writer_stop_requested()) {
+        log_extra(fixed, "Stream stopped.\n");
+        success = true;
+    }
+
+    /*
+    ** If a regular file doesn't hold the amount of data its header says (because the stream
+    ** was unbounded, or was cut short) go back and correct the sizes. Only whole frames count.
+    ** Then an odd-sized data chunk gets its pad byte (a mapped file already has it, as zero).
+    */
+    if (!fixed->piping && (mapping == NULL)) {
+        data_end = lseek(fileno(wavfile), 0, SEEK_END);
+        if (data_end >= data_offset) {
+            num_frames = (uint64_t) (data_end - data_offset) / frame_bytes;
+            if ((num_frames * frame_bytes) != num_data_bytes) {
+                log_extra(fixed, "Updating the header for %" PRIu64 " frames.\n", num_frames);
+                if ((ftruncate(fileno(wavfile), data_offset + (off_t) (num_frames * frame_bytes)) != 0) ||
+                    (fseek(wavfile, 0, SEEK_SET) != 0) ||
+                    !write_headers(fixed, user, wavfile, num_frames * frame_bytes, reserve_ds64)) {
+                    log_info(fixed, "Error: failed to update the header.\n");
+                    success = false;
+                }
+            }
+
+            if (success && !writer_pad(fileno(wavfile), data_offset + (off_t) (num_frames * frame_bytes),
+                                       num_frames * frame_bytes)) {
+                success = false;
+            }
+        }
+    }
+
+    /* A pipe can only have its pad byte appended, once all the data it was promised has gone.*/
+    if (success && fixed->piping && !user->unbounded && !writer_stop_requested() &&
+        !writer_pad(fileno(wavfile), -1, num_data_bytes)) {
+        success = false;
+    }
+
+    /*
+    ** Clean up resources.
+    */
+    generate_free(&state);
+    writer_free(&writer);
+    free(buffer);
+
+    if ((mapping != NULL) && !writer_unmap_file(mapping, mapped_bytes)) {
+        log_info(fixed, "Error: failed to write back the mapped output file.\n");
+        success = false;
+    }
+
+    return success;
+}
@@ -0,0 +1,433 @@
+/*
+** wf_sweep.c
+**
+** Generate a sine sweep (chirp) from the frequency given by -f to that given by --endfreq, over
+** the whole duration of the stream (after which it starts again). A logarithmic sweep spends the
+** same time on each octave, and a linear one (--sweep linear) the same time on each hertz. The
+** start and end may be faded in and out (--fade) with raised-cosine ramps.
+**
+** The phase of any frame is known exactly in closed form, but evaluating that (an exp() for the
+** logarithmic sweep) for every frame would cost far more than the sine itself. So, as for the
+** plain sine, a few lanes of consecutive frames are run side-by-side in SIMD registers, each with
+** a phase accumulator and a per-frame phase increment that is itself moved on each step (scaled
+** for the logarithmic sweep, stepped for the linear one). The lanes are re-synchronised to the
+** exact phase at fixed positions in the sweep (every SWEEP_RESYNC_FRAMES), and every frame is
+** calculated by the lanes, so the output is the same however the stream is split into blocks
+** (or chunks for --threads). The sine of each phase is a polynomial, so no libm calls are made
+** per frame at all.
+**
+** For measuring impulse responses the inverse filter can be written as well (--inverse): the
+** sweep reversed in time, with a 6dB/octave envelope for a logarithmic sweep so that the sweep
+** convolved with it is flat (Farina's method). It is scaled so that the convolution has a peak
+** of 1.0 for a sweep at 0dBFS, and written as a mono float file, as its values are very small.
+**/
+#include <math.h>
+#include "wavgen.h"
+
+static const double PI = 3.14159265358979323846;
+
+#define SWEEP_LANES         (4U)        // Consecutive frames calculated at once.
+#define SWEEP_RESYNC_FRAMES (1024U)     // Frames between re-synchronisations (a multiple of SWEEP_LANES).
+#define SWEEP_ROUNDING      (6755399441055744.0)    // 1.5 * 2^52, for rounding to the nearest integer.
+
+typedef double  SWEEP_VEC  __attribute__((vector_size(SWEEP_LANES * sizeof(double))));
+typedef int64_t SWEEP_LVEC __attribute__((vector_size(SWEEP_LANES * sizeof(int64_t))));
+typedef int32_t SWEEP_IVEC __attribute__((vector_size(SWEEP_LANES * sizeof(int32_t))));
+typedef float   SWEEP_FVEC __attribute__((vector_size(SWEEP_LANES * sizeof(float))));
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SWEEP_HAVE_AVX2
+#endif
+
+/*
+** Everything about a sweep that doesn't change from one frame to the next.
+** Phases are in cycles rather than radians.
+*/
+struct SWEEP {
+    uint64_t length;        // Frames in one sweep.
+    uint64_t fade;          // Frames in each of the fade-in and fade-out.
+    bool     linear;
+    uint32_t sample_rate;
+    uint32_t start_hz;
+    uint32_t end_hz;
+    double   log_rate;      // Logarithmic: ln(end / start) per frame.
+    double   log_scale;     // Logarithmic: the phase is log_scale * (exp(frame * log_rate) - 1).
+
+    /* Moving every lane on by SWEEP_LANES frames: phase += increment * phase_mul + phase_add,
+    ** then increment = increment * increment_mul + increment_add.*/
+    double   phase_mul;
+    double   phase_add;
+    double   increment_mul;
+    double   increment_add;
+};
+
+/*
+** Work out the sweep's constants from the parameters. A logarithmic "sweep" that starts and
+** ends at the same frequency is just a tone, which the linear sweep produces exactly.
+*/
+static void sweep_setup(struct SWEEP *sweep, struct COMMON_USER_PARAMS *user, struct ADDITIONAL_USER_PARAMS *extra)
+{
+    double ratio;
+
+    sweep->length      = user->num_samples / user->num_channels;
+    sweep->length      = (sweep->length < 1U) ? 1U : sweep->length;
+    sweep->fade        = ((uint64_t) extra->fade_ms * user->sample_rate) / 1000U;
+    sweep->fade        = (sweep->fade > (sweep->length / 2U)) ? (sweep->length / 2U) : sweep->fade;
+    sweep->linear      = extra->sweep_linear || (user->frequency_hz == extra->sweep_end_hz);
+    sweep->sample_rate = user->sample_rate;
+    sweep->start_hz    = user->frequency_hz;
+    sweep->end_hz      = extra->sweep_end_hz;
+
+    if (sweep->linear) {
+        /* The increment goes up by the same amount every frame.*/
+        double step = ((double) sweep->end_hz - (double) sweep->start_hz) / ((double) sweep->length * sweep->sample_rate);
+
+        sweep->log_rate      = 0.0;
+        sweep->log_scale     = 0.0;
+        sweep->phase_mul     = SWEEP_LANES;
+        sweep->phase_add     = step * (SWEEP_LANES * (SWEEP_LANES - 1U) / 2U);
+        sweep->increment_mul = 1.0;
+        sweep->increment_add = step * SWEEP_LANES;
+    }
+    else {
+        /* The increment goes up by the same ratio every frame.*/
+        sweep->log_rate  = log((double) sweep->end_hz / (double) sweep->start_hz) / (double) sweep->length;
+        sweep->log_scale = (double) sweep->start_hz / (sweep->sample_rate * sweep->log_rate);
+
+        ratio = exp(sweep->log_rate);
+        sweep->phase_mul     = 1.0 + ratio + (ratio * ratio) + (ratio * ratio * ratio);
+        sweep->phase_add     = 0.0;
+        sweep->increment_mul = exp(sweep->log_rate * SWEEP_LANES);
+        sweep->increment_add = 0.0;
+    }
+}
+
+/*
+** The exact phase (in cycles, as a fraction of a cycle) of a frame of the sweep, and the increment
+** from it to the next frame. The linear sweep's phase is a ratio of integers, so it is worked out
+** exactly with integer arithmetic before converting.
+*/
+static void sweep_phase(const struct SWEEP *sweep, uint64_t position, double *phase, double *increment)
+{
+    if (sweep->linear) {
+        /* phase = (start * n + (end - start) * n^2 / 2L) / rate, over the common denominator 2L * rate.*/
+        __int128 numerator   = (__int128) position * ((2 * (__int128) sweep->length * sweep->start_hz) +
+                                                      (((__int128) sweep->end_hz - sweep->start_hz) * (__int128) position));
+        __int128 denominator = 2 * (__int128) sweep->length * sweep->sample_rate;
+
+        *phase     = (double) (numerator % denominator) / (double) denominator;
+        *increment = ((2.0 * sweep->length * sweep->start_hz) +
+                      (((double) sweep->end_hz - sweep->start_hz) * ((2.0 * position) + 1.0))) / (double) denominator;
+    }
+    else {
+        double cycles = sweep->log_scale * expm1(sweep->log_rate * position);
+
+        *phase     = cycles - floor(cycles);
+        *increment = sweep->log_scale * exp(sweep->log_rate * position) * expm1(sweep->log_rate);
+    }
+}
+
+/*
+** The sine of each lane's phase (in cycles), in place. The phase is wrapped to [-0.5, 0.5], folded into the
+** first quarter-cycle, where the sine is an odd polynomial (its Taylor series up to the 15th power,
+** within 1e-11 of the true value) and the sign is put back afterwards.
+*/
+static inline __attribute__((always_inline))
+void sweep_sin_lanes(SWEEP_VEC *value)
+{
+    SWEEP_VEC  phase = *value;
+    const SWEEP_LVEC sign_bit = ((SWEEP_LVEC) { 0 }) | INT64_MIN;
+    SWEEP_LVEC sign;
+    SWEEP_VEC  angle;
+    SWEEP_VEC  square;
+    SWEEP_VEC  result;
+
+    phase -= (phase + SWEEP_ROUNDING) - SWEEP_ROUNDING;
+
+    /* sin(2.pi.x) = sign(x) * sin(2.pi.(1/4 - ||x| - 1/4|)).*/
+    sign   = (SWEEP_LVEC) phase & sign_bit;
+    phase  = (SWEEP_VEC) ((SWEEP_LVEC) phase ^ sign) - 0.25;
+    phase  = 0.25 - (SWEEP_VEC) ((SWEEP_LVEC) phase & ~sign_bit);
+    angle  = phase * (2.0 * PI);
+    square = angle * angle;
+
+    result = (-square * (1.0 / 1307674368000.0)) + (1.0 / 6227020800.0);
+    result = (result * -square) + (1.0 / 39916800.0);
+    result = (result * -square) + (1.0 / 362880.0);
+    result = (result * -square) + (1.0 / 5040.0);
+    result = (result * -square) + (1.0 / 120.0);
+    result = (result * -square) + (1.0 / 6.0);
+    result = (result * -square) + 1.0;
+    result = result * angle;
+
+    *value = (SWEEP_VEC) ((SWEEP_LVEC) result ^ sign);
+}
+
+/*
+** Apply the fade-in or fade-out at each lane's position (a raised-cosine, i.e. sin^2).
+*/
+static inline __attribute__((always_inline))
+void sweep_fade_lanes(const struct SWEEP *sweep, uint64_t first, SWEEP_VEC *value)
+{
+    SWEEP_VEC ramp;
+    uint64_t  position;
+    uint32_t  lane;
+
+    for (lane = 0; lane < SWEEP_LANES; ++lane) {
+        position = first + lane;
+        if (position >= sweep->length) {
+            ramp[lane] = 0.0;   // Past the end of the sweep (not stored).
+        }
+        else if (position < sweep->fade) {
+            ramp[lane] = (double) position / (4.0 * sweep->fade);
+        }
+        else if (position >= (sweep->length - sweep->fade)) {
+            ramp[lane] = (double) (sweep->length - 1U - position) / (4.0 * sweep->fade);
+        }
+        else {
+            ramp[lane] = 0.25;
+        }
+    }
+
+    sweep_sin_lanes(&ramp);
+
+    *value *= ramp * ramp;
+}
+
+/*
+** Generate frames of one sweep (i.e. without wrapping around), from the given position within
+** it, into one channel's worth of samples. Whole sets of lanes are always calculated, starting
+** at a multiple of SWEEP_LANES, with only the frames asked for being stored.
+*/
+static inline __attribute__((always_inline))
+void sweep_frames_lanes(const struct SWEEP *sweep, uint64_t position, SAMPLE *output, uint32_t num_frames, bool as_float)
+{
+    SWEEP_VEC  phase;
+    SWEEP_VEC  increment;
+    SWEEP_VEC  value;
+    SWEEP_IVEC sample_v;
+    SWEEP_FVEC float_v;
+    SAMPLE     values[SWEEP_LANES];
+    uint64_t   group;
+    uint64_t   segment_end;
+    uint64_t   end = position + num_frames;
+    uint32_t   lane;
+    uint32_t   first;
+    uint32_t   count;
+
+    while (position < end) {
+        /* Start each lane at its exact phase at the start of the segment, and catch up to the first frame.*/
+        group = position - (position % SWEEP_RESYNC_FRAMES);
+        for (lane = 0; lane < SWEEP_LANES; ++lane) {
+            sweep_phase(sweep, group + lane, &phase[lane], &increment[lane]);
+        }
+        for (; (group + SWEEP_LANES) <= position; group += SWEEP_LANES) {
+            phase    += (increment * sweep->phase_mul) + sweep->phase_add;
+            increment = (increment * sweep->increment_mul) + sweep->increment_add;
+        }
+
+        segment_end = group - (group % SWEEP_RESYNC_FRAMES) + SWEEP_RESYNC_FRAMES;
+        if (segment_end > end) {
+            segment_end = end;
+        }
+
+        for (; group < segment_end; group += SWEEP_LANES) {
+            value = phase;
+            sweep_sin_lanes(&value);
+            if ((sweep->fade > 0U) && ((group < sweep->fade) || ((group + SWEEP_LANES) > (sweep->length - sweep->fade)))) {
+                sweep_fade_lanes(sweep, group, &value);
+            }
+
+            first = (group < position) ? (uint32_t) (position - group) : 0U;
+            count = ((group + SWEEP_LANES) > end) ? (uint32_t) (end - group) : SWEEP_LANES;
+
+            if (as_float) {
+                float_v = __builtin_convertvector(value, SWEEP_FVEC);
+                memcpy(values, &float_v, sizeof(float_v));
+            }
+            else {
+                sample_v = __builtin_convertvector((value * (double) MAX_LEVEL_32BIT) + 0.5, SWEEP_IVEC);
+                memcpy(values, &sample_v, sizeof(sample_v));
+            }
+
+            if ((first == 0U) && (count == SWEEP_LANES)) {
+                memcpy(output, values, sizeof(values));
+            }
+            else {
+                memcpy(output, &values[first], (count - first) * sizeof(SAMPLE));
+            }
+            output += count - first;
+
+            phase    += (increment * sweep->phase_mul) + sweep->phase_add;
+            increment = (increment * sweep->increment_mul) + sweep->increment_add;
+        }
+
+        position = segment_end;
+    }
+}
+
+#if defined(SWEEP_HAVE_AVX2)
+/*
+** AVX2 version, with all four lanes in one register (chosen at run-time).
+*/
+__attribute__((target("avx2")))
+static void sweep_frames_avx2(const struct SWEEP *sweep, uint64_t position, SAMPLE *output, uint32_t num_frames, bool as_float)
+{
+    sweep_frames_lanes(sweep, position, output, num_frames, as_float);
+}
+#endif
+
+static void sweep_frames(const struct SWEEP *sweep, uint64_t position, SAMPLE *output, uint32_t num_frames, bool as_float)
+{
+#if defined(SWEEP_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        sweep_frames_avx2(sweep, position, output, num_frames, as_float);
+    }
+    else
+#endif
+    {
+        sweep_frames_lanes(sweep, position, output, num_frames, as_float);
+    }
+}
+
+/*
+** Turn frames of the sweep (as floats) into the same frames of its inverse filter, in place.
+** Frame n of the inverse is frame (length - 1 - n) of the sweep, so the caller generates the
+** sweep frames in reverse order to these. A logarithmic sweep spends longer on the low
+** frequencies, so they are attenuated by 6dB/octave, from 0dB at the end frequency.
+*/
+static void sweep_invert(const struct SWEEP *sweep, uint64_t position, SAMPLE *output, uint32_t num_frames)
+{
+    double   scale;
+    double   envelope;
+    double   decay;
+    uint32_t frame;
+    SAMPLE   swap;
+
+    for (frame = 0; frame < (num_frames / 2U); ++frame) {
+        swap = output[frame];
+        output[frame] = output[num_frames - 1U - frame];
+        output[num_frames - 1U - frame] = swap;
+    }
+
+    /*
+    ** The convolution's peak is the sum of each sweep frame squared (0.5 on average) times the
+    ** envelope, so scale by the inverse of that (ignoring the fades).
+    */
+    if (sweep->linear) {
+        scale = 2.0 / (double) sweep->length;
+        decay = 1.0;
+    }
+    else {
+        scale = 2.0 * -expm1(-sweep->log_rate) / -expm1(-sweep->log_rate * sweep->length);
+        decay = exp(-sweep->log_rate);
+    }
+
+    envelope = scale * exp(-sweep->log_rate * position);
+    for (frame = 0; frame < num_frames; ++frame) {
+        output[frame].f = (float) (output[frame].f * envelope);
+        envelope *= decay;
+    }
+}
+
+/*
+** The output is INTEGER samples, unless the WAV file is to be floating-point, in which case
+** float samples are generated directly (see generates_float()).
+** The sample is identical on every channel, so each frame is only calculated once (into the
+** first channel's slots) and then copied to the other channels.
+*/
+void generate_sweep(struct WAVEFORM_STATE *state,
+                    struct COMMON_USER_PARAMS *user,
+                    struct ADDITIONAL_USER_PARAMS *extra,
+                    SAMPLE   *buffer,
+                    uint32_t  num_frames)
+{
+    struct SWEEP sweep;
+    uint64_t position;
+    uint32_t frames;
+    uint32_t frame;
+    uint16_t chnl;
+    SAMPLE  *output = buffer;
+
+    sweep_setup(&sweep, user, extra);
+
+    /* Each run of frames ends at the end of the sweep, which then starts again.*/
+    position = state->sample_number % sweep.length;
+
+    for (frame = 0; frame < num_frames; frame += frames) {
+        frames = num_frames - frame;
+        if (frames > (sweep.length - position)) {
+            frames = (uint32_t) (sweep.length - position);
+        }
+
+        if (extra->sweep_inverse) {
+            sweep_frames(&sweep, sweep.length - position - frames, output, frames, true);
+            sweep_invert(&sweep, position, output, frames);
+        }
+        else {
+            sweep_frames(&sweep, position, output, frames, generates_float(user));
+        }
+
+        output  += frames;
+        position = 0;
+    }
+
+    if (user->num_channels > 1U) {
+        /* Spread the samples out from the end backwards so that none is overwritten before it is used.*/
+        for (frame = num_frames; frame-- > 0;) {
+            for (chnl = 0; chnl < user->num_channels; ++chnl) {
+                buffer[(size_t) frame * user->num_channels + chnl] = buffer[frame];
+            }
+        }
+    }
+}
+
+/*
+** Write the inverse filter of the sweep (--inverse): a mono float file of one sweep's length,
+** at the same sample rate. Levels, markers, dither and mixed waveforms don't apply to it.
+** Returns true if the file was written successfully.
+*/
+bool write_sweep_inverse(struct FIXED_PARAMS *fixed,
+                         struct COMMON_USER_PARAMS *user,
+                         struct ADDITIONAL_USER_PARAMS *extra)
+{
+    struct FIXED_PARAMS           inverse_fixed = *fixed;
+    struct COMMON_USER_PARAMS     inverse_user  = *user;
+    struct ADDITIONAL_USER_PARAMS inverse_extra = *extra;
+    FILE *file;
+    bool  success;
+
+    inverse_fixed.gain = 1.0;
+
+    inverse_user.num_channels     = 1U;
+    inverse_user.num_samples      = user->num_samples / user->num_channels;
+    inverse_user.save_as_float    = true;
+    inverse_user.bits_per_sample  = 32U;
+    inverse_user.bytes_per_sample = BYTES_32BIT;
+    inverse_user.dither           = DITHER_NONE;
+    inverse_user.realtime         = false;
+    inverse_user.unbounded        = false;
+    inverse_user.per_channel      = false;
+    inverse_user.num_mix          = 0U;
+    inverse_user.mix_gain         = 1.0;
+    inverse_user.wf_type          = WAVEFORM_TYPE_SWEEP;
+    inverse_user.filename         = extra->inverse_file;
+
+    inverse_extra.markers_on    = false;
+    inverse_extra.sweep_inverse = true;
+
+    file = fopen(extra->inverse_file, "w+");
+    if (file == NULL) {
+        log_info(fixed, "ERROR: Could not create or open inverse filter file '%s'\n", extra->inverse_file);
+        return false;
+    }
+
+    log_extra(fixed, "Writing the inverse filter to '%s'\n", extra->inverse_file);
+    success = write_stream(&inverse_fixed, &inverse_user, &inverse_extra, file);
+
+    if (fclose(file) != 0) {
+        success = false;
+    }
+
+    return success;
+}
@@ -0,0 +1,188 @@
+/*
+** wf_threads.c
+**
+** Multi-threaded, chunked generation for file output. Every waveform stream can be moved to any
+** frame with generate_seek(), so the data section can be split into chunks (runs of consecutive
+** blocks) which are generated, finalised and packed on worker threads, and then written straight
+** to their final position in the file with pwrite(), or packed straight into their place in a
+** memory-mapped file. Chunks are handed out dynamically so that faster workers simply take more
+** of them.
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include "wavgen.h"
+
+/*
+** Each chunk starts with a seek, which is not free for every waveform (pink noise must let its
+** filter settle), so chunks are kept large enough for that to be negligible.
+*/
+#define MIN_CHUNK_FRAMES (262144U)
+
+/*
+** State shared between all the worker threads.
+*/
+struct THREAD_JOB {
+    struct FIXED_PARAMS           *fixed;
+    struct COMMON_USER_PARAMS     *user;
+    struct ADDITIONAL_USER_PARAMS *extra;
+
+    int      fd;            // The output file (already holding the RIFF headers).
+    off_t    data_offset;   // Offset in the file of the first sample.
+    uint8_t *mapped_data;   // The first sample in a memory-mapped file, or NULL to use pwrite().
+    uint64_t num_frames;    // Total frames to generate.
+    uint32_t chunk_frames;  // Frames in each chunk (a whole number of blocks).
+    uint32_t num_chunks;    // Total chunks to generate.
+
+    atomic_uint next_chunk; // The next chunk to be claimed by a worker.
+    atomic_bool failed;     // Set by any worker that fails, which stops all of them.
+};
+
+/*
+** Worker thread: claim chunks until there are none left, seeking a private stream to the
+** start of each one and writing its blocks to their position in the file.
+*/
+static void *generate_worker(void *arg)
+{
+    struct THREAD_JOB    *job = arg;
+    struct WAVEFORM_STATE state;
+    struct OUTPUT_WRITER  writer;
+
+    SAMPLE  *buffer;
+    SAMPLE  *block_buffer;
+    uint32_t chunk;
+    uint64_t chunk_end;
+    uint32_t block_frames;
+    size_t   frame_bytes = (size_t) job->user->num_channels * job->user->bytes_per_sample;
+
+    buffer = malloc((size_t) job->user->block_frames * job->user->num_channels * sizeof(SAMPLE));
+    if (job->mapped_data != NULL) {
+        writer_init_mapped(&writer, job->mapped_data, 0);
+    }
+    else if (!writer_init(&writer, job->fd, job->user->block_frames * frame_bytes)) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    if (buffer == NULL) {
+        writer_free(&writer);
+        atomic_store(&job->failed, true);
+        return NULL;
+    }
+
+    generate_init(&state);
+
+    while (!atomic_load(&job->failed)) {
+        chunk = atomic_fetch_add(&job->next_chunk, 1U);
+        if (chunk >= job->num_chunks) {
+            break;
+        }
+
+        generate_seek(&state, job->user, job->extra, (uint64_t) chunk * job->chunk_frames);
+
+        chunk_end = state.sample_number + job->chunk_frames;
+        if (chunk_end > job->num_frames) {
+            chunk_end = job->num_frames;
+        }
+
+        /* Write this chunk at its computed offset rather than at the end of the file.*/
+        if (job->mapped_data != NULL) {
+            writer_init_mapped(&writer, job->mapped_data + (size_t) state.sample_number * frame_bytes,
+                               (size_t) (chunk_end - state.sample_number) * frame_bytes);
+        }
+        else {
+            writer.position = job->data_offset + (off_t) state.sample_number * (off_t) frame_bytes;
+        }
+
+        while (state.sample_number < chunk_end) {
+            block_frames = job->user->block_frames;
+            if ((chunk_end - state.sample_number) < block_frames) {
+                block_frames = (uint32_t) (chunk_end - state.sample_number);
+            }
+
+            block_buffer = writer_in_place(&writer, job->user);
+            if (block_buffer == NULL) {
+                block_buffer = buffer;
+            }
+
+            generate_block(&state, job->user, job->extra, block_buffer, block_frames);
+
+            if (!finalise_block(job->fixed, job->user, job->extra, &state, block_buffer, block_frames, &writer)) {
+                atomic_store(&job->failed, true);
+                break;
+            }
+        }
+
+        if (!writer_flush(&writer)) {
+            atomic_store(&job->failed, true);
+        }
+    }
+
+    generate_free(&state);
+    writer_free(&writer);
+    free(buffer);
+
+    return NULL;
+}
+
+/*
+** Generate the whole data section of a file using a number of worker threads.
+**
+** param  fd          : The output file descriptor (must be a regular file, not a pipe).
+** param  data_offset : The offset in the file where the sample data starts.
+** param  mapped_data : Where the sample data starts in a memory-mapped file, or NULL.
+** param  num_frames  : The number of frames to generate.
+** Returns true if all the data was generated and written successfully.
+*/
+bool generate_threaded(struct FIXED_PARAMS *fixed,
+                       struct COMMON_USER_PARAMS *user,
+                       struct ADDITIONAL_USER_PARAMS *extra,
+                       int      fd,
+                       off_t    data_offset,
+                       uint8_t *mapped_data,
+                       uint64_t num_frames)
+{
+    struct THREAD_JOB job;
+    pthread_t threads[MAX_THREADS];
+    uint16_t  num_started;
+    uint16_t  index;
+    uint64_t  chunk_frames;
+
+    job.fixed       = fixed;
+    job.user        = user;
+    job.extra       = extra;
+    job.fd          = fd;
+    job.data_offset = data_offset;
+    job.mapped_data = mapped_data;
+    job.num_frames  = num_frames;
+
+    /* Aim for a few chunks per thread (to balance the load) but keep them a whole number of blocks.*/
+    chunk_frames = num_frames / (user->num_threads * 4U);
+    if (chunk_frames < MIN_CHUNK_FRAMES) {
+        chunk_frames = MIN_CHUNK_FRAMES;
+    }
+    chunk_frames     = ((chunk_frames + user->block_frames - 1U) / user->block_frames) * user->block_frames;
+    job.chunk_frames = (uint32_t) chunk_frames;
+    job.num_chunks   = (uint32_t) ((num_frames + chunk_frames - 1U) / chunk_frames);
+
+    atomic_init(&job.next_chunk, 0U);
+    atomic_init(&job.failed, false);
+
+    log_extra(fixed, "Generating %u chunks on %u threads.\n", job.num_chunks, user->num_threads);
+
+    for (num_started = 0; num_started < user->num_threads; ++num_started) {
+        if (pthread_create(&threads[num_started], NULL, generate_worker, &job) != 0) {
+            /* Carry on with however many threads could be started.*/
+            break;
+        }
+    }
+
+    if (num_started == 0) {
+        return false;
+    }
+
+    for (index = 0; index < num_started; ++index) {
+        pthread_join(threads[index], NULL);
+    }
+
+    return !atomic_load(&job.failed);
+}
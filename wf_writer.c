@@ -0,0 +1,365 @@
+/*
+** wf_writer.c
+**
+** A buffered bulk writer for the output stage. Converted (packed) samples are collected in a
+** large, aligned staging buffer which is then flushed to the output file descriptor with a
+** single write() per block, rather than issuing a small stdio write for every sample.
+**
+** Alternatively the writer can be pointed at (part of) a memory-mapped output file, in which
+** case the "staging buffer" is the file itself and nothing needs to be flushed at all.
+**
+** A pipe (stdout) is written with plain write() too, even on Linux. Lending the staging buffers
+** to it with vmsplice() would avoid the copy, but the pipe would then refer to their pages for as
+** long as the reader wanted: it can resize the pipe, or splice or tee the pages on elsewhere, and
+** it may not be the only writer. There's no way to know when a buffer could be safely reused in
+** a pipe that this process didn't create, and giving each one away (SPLICE_F_GIFT) and mapping a
+** fresh one costs more than the copy. (Periodic waveforms can still be spliced from a tile that
+** is never changed, see wf_splice.c.)
+**
+** Windows has neither mmap() nor pwrite(). Output files are never mapped there (they are written
+** in the normal way instead) and writes at a given position are made with WriteFile().
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "riff.h"
+#include "wavgen.h"
+
+/*
+** Set when an unbounded stream should end, either by a signal or because the reader of the
+** pipe has gone away.
+*/
+static volatile sig_atomic_t stop_requested = 0;
+
+/*
+** Ask the stream to stop after the current block. This may be used directly as a signal handler.
+*/
+void writer_request_stop(int signum)
+{
+    (void) signum;
+    stop_requested = 1;
+}
+
+/*
+** Returns true if the stream has been asked to stop.
+*/
+bool writer_stop_requested(void)
+{
+    return stop_requested != 0;
+}
+
+/*
+** Initialise the writer and allocate its staging buffer.
+**
+** param  writer   : A pointer to the writer to initialise.
+** param  fd       : The (already open) file descriptor that blocks are flushed to.
+** param  capacity : The size of the staging buffer in bytes (typically one block).
+** Returns true if the staging buffer could be allocated.
+*/
+bool writer_init(struct OUTPUT_WRITER *writer, int fd, size_t capacity)
+{
+    memset(writer, 0, sizeof(struct OUTPUT_WRITER));
+
+    writer->fd       = fd;
+    writer->position = -1;
+
+    /* Round the capacity up to a whole number of aligned pages.*/
+    capacity = (capacity + OUTPUT_ALIGNMENT - 1U) & ~((size_t) OUTPUT_ALIGNMENT - 1U);
+
+    writer->staging = writer_alloc(capacity);
+    if (writer->staging == NULL) {
+        return false;
+    }
+
+    writer->capacity = capacity;
+    writer->used     = 0;
+
+    return true;
+}
+
+/*
+** Initialise the writer to pack data straight into memory, i.e. a memory-mapped output file.
+**
+** param  writer      : A pointer to the writer to initialise.
+** param  destination : Where the first packed byte is to be written.
+** param  capacity    : The number of bytes available at the destination.
+*/
+void writer_init_mapped(struct OUTPUT_WRITER *writer, uint8_t *destination, size_t capacity)
+{
+    memset(writer, 0, sizeof(struct OUTPUT_WRITER));
+
+    writer->fd       = -1;
+    writer->staging  = destination;
+    writer->capacity = capacity;
+    writer->used     = 0;
+    writer->position = -1;
+    writer->mapped   = true;
+}
+
+/*
+** If the next block can be generated directly in its final place, return that place.
+** This is the case for a memory-mapped output file when the output samples are the same
+** size as the generated ones (i.e. 32-bit and float formats), so no packing is needed.
+** Returns NULL if the block must be generated into a separate buffer and packed.
+*/
+SAMPLE *writer_in_place(struct OUTPUT_WRITER *writer, struct COMMON_USER_PARAMS *user)
+{
+    if (writer->mapped && (user->bytes_per_sample == sizeof(SAMPLE))) {
+        return (SAMPLE *) (writer->staging + writer->used);
+    }
+
+    return NULL;
+}
+
+/*
+** Free the staging buffer. Any data that has not been flushed is discarded.
+** Memory-mapped destinations belong to the caller and are left alone.
+*/
+void writer_free(struct OUTPUT_WRITER *writer)
+{
+    if (!writer->mapped) {
+        writer_release(writer->staging);
+    }
+
+    writer->staging  = NULL;
+    writer->capacity = 0;
+    writer->used     = 0;
+}
+
+/*
+** Allocate memory aligned to OUTPUT_ALIGNMENT (a page), e.g. for a staging buffer.
+** It must be freed with writer_release().
+** Returns NULL if the memory could not be allocated.
+*/
+void *writer_alloc(size_t num_bytes)
+{
+#if defined(_WIN32)
+    return _aligned_malloc(num_bytes, OUTPUT_ALIGNMENT);
+#else
+    void *data;
+
+    if (posix_memalign(&data, OUTPUT_ALIGNMENT, num_bytes) != 0) {
+        return NULL;
+    }
+
+    return data;
+#endif
+}
+
+/*
+** Free memory allocated by writer_alloc() (if not NULL).
+*/
+void writer_release(void *data)
+{
+#if defined(_WIN32)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+/*
+** Write (some of) a buffer at the given file position, without moving the file offset.
+** Windows has no pwrite(), but WriteFile() can be told where to write.
+** Returns the number of bytes written, or -1 on an error.
+*/
+static ssize_t write_at(int fd, const uint8_t *data, size_t num_bytes, off_t position)
+{
+#if defined(_WIN32)
+    OVERLAPPED overlapped = { 0 };
+    DWORD      written;
+
+    overlapped.Offset     = (DWORD) ((uint64_t) position & 0xFFFFFFFFU);
+    overlapped.OffsetHigh = (DWORD) ((uint64_t) position >> 32);
+
+    if (!WriteFile((HANDLE) _get_osfhandle(fd), data, (DWORD) num_bytes, &written, &overlapped)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return (ssize_t) written;
+#else
+    return pwrite(fd, data, num_bytes, position);
+#endif
+}
+
+/*
+** Write out a whole buffer, at the given file position (with pwrite()) or, if the position
+** is negative, wherever the file descriptor is.
+** A single write() is normally enough, but pipes may accept less than was asked for
+** (and signals may interrupt the call) so keep going until the data has all gone.
+** Returns true if the data was written successfully.
+*/
+static bool write_fully(int fd, const uint8_t *data, size_t num_bytes, off_t position)
+{
+    size_t  offset = 0;
+    ssize_t written;
+
+    while (offset < num_bytes) {
+        if (position >= 0) {
+            written = write_at(fd, data + offset, num_bytes - offset, position + (off_t) offset);
+        }
+        else {
+            written = write(fd, data + offset, num_bytes - offset);
+        }
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EPIPE) {
+                /* The reader has closed the pipe, so nothing more can be written.*/
+                stop_requested = 1;
+            }
+            return false;
+        }
+        offset += (size_t) written;
+    }
+
+    return true;
+}
+
+/*
+** Write out everything held in the staging buffer.
+** If the writer has been given a file position, pwrite() is used there instead.
+** Returns true if the data was written successfully.
+*/
+bool writer_flush(struct OUTPUT_WRITER *writer)
+{
+    /* Data packed into a memory-mapped file is already where it needs to be.*/
+    if (writer->mapped) {
+        return true;
+    }
+
+    if (!write_fully(writer->fd, writer->staging, writer->used, writer->position)) {
+        return false;
+    }
+
+    if (writer->position >= 0) {
+        writer->position += (off_t) writer->used;
+    }
+
+    writer->used = 0;
+
+    return true;
+}
+
+/*
+** Write out a buffer of packed data that was prepared outside of a writer (e.g. by wf_realtime.c).
+** Returns true if the data was written successfully.
+*/
+bool writer_write(int fd, const uint8_t *data, size_t num_bytes)
+{
+    return write_fully(fd, data, num_bytes, -1);
+}
+
+/*
+** Write the zero pad byte that must follow an odd-sized data chunk (see RIFF_PAD_BYTES), at the
+** given file position or, if the position is negative, wherever the file descriptor is.
+** Nothing is written after an even number of data bytes.
+** Returns true if the pad byte (if any) was written successfully.
+*/
+bool writer_pad(int fd, off_t position, uint64_t num_data_bytes)
+{
+    static const uint8_t pad = 0U;
+
+    return (RIFF_PAD_BYTES(num_data_bytes) == 0U) || write_fully(fd, &pad, 1U, position);
+}
+
+/*
+** Obtain space for num_bytes of packed data in the staging buffer, flushing it first if
+** there is not enough room left. The data must be committed with writer_commit().
+** Returns NULL if the request can never fit or the flush failed.
+*/
+uint8_t *writer_reserve(struct OUTPUT_WRITER *writer, size_t num_bytes)
+{
+    if (num_bytes > writer->capacity) {
+        return NULL;
+    }
+
+    if ((writer->capacity - writer->used) < num_bytes) {
+        if (!writer_flush(writer)) {
+            return NULL;
+        }
+    }
+
+    return writer->staging + writer->used;
+}
+
+/*
+** Mark num_bytes of previously reserved space as holding valid data.
+** The staging buffer is flushed as soon as it becomes full.
+** Returns true if any flush that was required succeeded.
+*/
+bool writer_commit(struct OUTPUT_WRITER *writer, size_t num_bytes)
+{
+    writer->used += num_bytes;
+
+    if ((writer->used >= writer->capacity) && !writer->mapped) {
+        return writer_flush(writer);
+    }
+
+    return true;
+}
+
+#if !defined(_WIN32)
+/*
+** Size an output file to exactly file_size bytes (allocating the space up-front, so that
+** running out of disk space is found now rather than as a fault while writing) and map it.
+** Returns the start of the mapping, or NULL if the file could not be mapped.
+*/
+uint8_t *writer_map_file(int fd, size_t file_size)
+{
+    void *mapping;
+
+    if ((file_size == 0) || (posix_fallocate(fd, 0, (off_t) file_size) != 0)) {
+        return NULL;
+    }
+
+    mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* The file is written from start to finish (by each thread), so tell the kernel.*/
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+
+    return mapping;
+}
+
+/*
+** Unmap an output file mapped by writer_map_file().
+** Returns true if the data was written back successfully.
+*/
+bool writer_unmap_file(uint8_t *mapping, size_t file_size)
+{
+    bool success = (msync(mapping, file_size, MS_ASYNC) == 0);
+
+    return (munmap(mapping, file_size) == 0) && success;
+}
+#else
+/*
+** Output files can't be mapped on Windows, so they are always written in the normal way.
+*/
+uint8_t *writer_map_file(int fd, size_t file_size)
+{
+    (void) fd;
+    (void) file_size;
+
+    return NULL;
+}
+
+bool writer_unmap_file(uint8_t *mapping, size_t file_size)
+{
+    (void) mapping;
+    (void) file_size;
+
+    return true;
+}
+#endif